@@ -0,0 +1,222 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "cpu.h"
+#include "hash.h"
+#include "htable.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#define BLOCK_WORDS 8
+#define BLOCK_BITS 256
+
+/* Words hold 32 bits of the filter each, whatever their size. */
+#if UINT_MAX >= 0xFFFFFFFFUL
+typedef unsigned int word_t;
+#else
+typedef unsigned long word_t;
+#endif
+
+struct bloom_t {
+	word_t *words; /* BLOCK_WORDS per block, block-aligned */
+	void *raw; /* words, as allocated */
+	size_t mask; /* number of blocks - 1, a power of two - 1 */
+};
+
+/* Odd multipliers spreading a key over the words of its block, as in the
+ * split-block filters of Impala and Parquet. */
+static const unsigned long salts[BLOCK_WORDS] = {
+	0x47b6137bUL, 0x44974d91UL, 0x8824ad5bUL, 0xa2b7289dUL,
+	0x705495c7UL, 0x2df1424bUL, 0x9efc4947UL, 0x5c6bfb31UL
+};
+
+/* The first word of hash's block. */
+static word_t *block_of(bloom_t *bf, size_t hash);
+
+/* The bit of block word i that key sets. */
+static word_t bit_of(unsigned long key, size_t i);
+
+/* Implementations of the block test, for key's bits in the given block. */
+static int test_scalar(const word_t *block, unsigned long key);
+#ifdef CPU_X86
+static int test_avx2(const word_t *block, unsigned long key);
+#endif
+
+/* Pick the best implementation for the running CPU on first use. */
+static int test_resolve(const word_t *block, unsigned long key);
+
+static int (*test_impl)(const word_t *block, unsigned long key) = test_resolve;
+
+/* htable_filter callbacks. */
+static int filter_add(void *ctx, size_t hash);
+static int filter_may_contain(void *ctx, size_t hash);
+static void filter_clear(void *ctx);
+
+bloom_t *bloom_create(size_t n)
+{
+	bloom_t *bf;
+	size_t blocks, bytes;
+
+	/* At least the bits asked for, in a power of two of blocks. */
+	if (n > (size_t)-1 / BLOOM_BITS_PER_KEY) {
+		return NULL;
+	}
+	for (blocks = 1; blocks * BLOCK_BITS < n * BLOOM_BITS_PER_KEY;
+	     blocks <<= 1) {
+		if (blocks > (size_t)-1 / 2 / (BLOCK_WORDS * sizeof(word_t))) {
+			return NULL;
+		}
+	}
+	bytes = blocks * BLOCK_WORDS * sizeof(word_t);
+
+	bf = malloc(sizeof(*bf));
+	if (bf == NULL) {
+		return NULL;
+	}
+	/* over-allocated by a block, to align to one */
+	bf->raw = malloc(bytes + BLOCK_WORDS * sizeof(word_t));
+	if (bf->raw == NULL) {
+		free(bf);
+		return NULL;
+	}
+	bf->words = (word_t *)((char *)bf->raw +
+			       (BLOCK_WORDS * sizeof(word_t) -
+				(size_t)bf->raw % (BLOCK_WORDS * sizeof(word_t))));
+	bf->mask = blocks - 1;
+
+	bloom_clear(bf);
+	return bf;
+}
+
+void bloom_destroy(bloom_t *bf)
+{
+	assert(bf != NULL);
+
+	free(bf->raw);
+	free(bf);
+}
+
+size_t bloom_size(bloom_t *bf)
+{
+	assert(bf != NULL);
+
+	return (bf->mask + 1) * BLOCK_WORDS * sizeof(word_t);
+}
+
+void bloom_add(bloom_t *bf, size_t hash)
+{
+	word_t *block;
+	size_t i;
+
+	assert(bf != NULL);
+
+	block = block_of(bf, hash);
+	for (i = 0; i < BLOCK_WORDS; i++) {
+		block[i] |= bit_of((unsigned long)hash, i);
+	}
+}
+
+int bloom_may_contain(bloom_t *bf, size_t hash)
+{
+	assert(bf != NULL);
+
+	return test_impl(block_of(bf, hash), (unsigned long)hash);
+}
+
+void bloom_clear(bloom_t *bf)
+{
+	assert(bf != NULL);
+
+	memset(bf->words, 0, bloom_size(bf));
+}
+
+struct htable_filter bloom_htable_filter(bloom_t *bf)
+{
+	struct htable_filter f;
+
+	assert(bf != NULL);
+
+	f.add = filter_add;
+	f.may_contain = filter_may_contain;
+	f.remove = NULL;
+	f.clear = filter_clear;
+	f.ctx = bf;
+	return f;
+}
+
+static word_t *block_of(bloom_t *bf, size_t hash)
+{
+	/* Mixed, as the key's bits come from the hash as it is. */
+	return &bf->words[(hash_int_multiandxor((unsigned long)hash) &
+			   bf->mask) *
+			  BLOCK_WORDS];
+}
+
+static word_t bit_of(unsigned long key, size_t i)
+{
+	return (word_t)1 << (((key * salts[i]) & 0xFFFFFFFFUL) >> 27);
+}
+
+static int test_scalar(const word_t *block, unsigned long key)
+{
+	size_t i;
+
+	for (i = 0; i < BLOCK_WORDS; i++) {
+		if (!(block[i] & bit_of(key, i))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#ifdef CPU_X86
+/* All eight words at once: each lane's bit is 1 << ((key * salt) >> 27), and
+ * the key may be present if the block has every one of them set. */
+__attribute__((target("avx2"))) static int test_avx2(const word_t *block,
+						    unsigned long key)
+{
+	__m256i bits, mask;
+
+	bits = _mm256_mullo_epi32(
+		_mm256_set1_epi32((int)(key & 0xFFFFFFFFUL)),
+		_mm256_setr_epi32((int)salts[0], (int)salts[1], (int)salts[2],
+				  (int)salts[3], (int)salts[4], (int)salts[5],
+				  (int)salts[6], (int)salts[7]));
+	mask = _mm256_sllv_epi32(_mm256_set1_epi32(1),
+				 _mm256_srli_epi32(bits, 27));
+	return _mm256_testc_si256(_mm256_load_si256((const __m256i *)block),
+				  mask);
+}
+#endif /* CPU_X86 */
+
+static int test_resolve(const word_t *block, unsigned long key)
+{
+	test_impl = test_scalar;
+#ifdef CPU_X86
+	if (cpu_has(CPU_FEATURE_AVX2)) {
+		test_impl = test_avx2;
+	}
+#endif
+	return test_impl(block, key);
+}
+
+static int filter_add(void *ctx, size_t hash)
+{
+	bloom_add(ctx, hash);
+	return 0;
+}
+
+static int filter_may_contain(void *ctx, size_t hash)
+{
+	return bloom_may_contain(ctx, hash);
+}
+
+static void filter_clear(void *ctx)
+{
+	bloom_clear(ctx);
+}
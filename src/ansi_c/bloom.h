@@ -0,0 +1,44 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/*
+ * A split-block Bloom filter over key hashes (e.g. from hash.h).
+ *
+ * Each key maps to one 32-byte block of eight 32-bit words and sets one bit
+ * in each word, so a lookup touches a single cache line. With AVX2, all eight
+ * bits are computed and tested at once.
+ *
+ * Keys can't be removed; clear the filter and re-add what remains instead.
+ */
+
+#include <stddef.h>
+
+#include "htable.h"
+
+/* Filter bits per expected key. Around 12 gives under 0.5% false positives. */
+#ifndef BLOOM_BITS_PER_KEY
+#define BLOOM_BITS_PER_KEY 12
+#endif
+
+typedef struct bloom_t bloom_t;
+
+/* Create a filter sized for n keys, or return NULL on allocation failure. */
+bloom_t *bloom_create(size_t n);
+void bloom_destroy(bloom_t *bf);
+
+/* Size of the filter's bit array in bytes. */
+size_t bloom_size(bloom_t *bf);
+
+void bloom_add(bloom_t *bf, size_t hash);
+
+/* Return 0 if no key with this hash was added, or non-zero if one may
+ * have been. */
+int bloom_may_contain(bloom_t *bf, size_t hash);
+
+void bloom_clear(bloom_t *bf);
+
+/* A filter for htable_set_filter backed by bf. Removals from the hashtable
+ * leave their keys in the filter until the hashtable is cleared. */
+struct htable_filter bloom_htable_filter(bloom_t *bf);
+
+#endif /* BLOOM_H */
@@ -0,0 +1,844 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+#include "htable.h"
+
+/* Alignment of nodes, a cache line. */
+#define LINE 64
+
+/* Nodes per chunk allocated. */
+#define CHUNK_NODES 32
+
+/* Keys per node: a leaf's keys and values, and an interior node's keys and
+ * children, each take a pointer per key, with one pointer to spare for a
+ * leaf's next and an interior node's last child. */
+#define KEYS_MAX \
+	((BTREE_NODE_BYTES - 2 * sizeof(void *)) / (2 * sizeof(void *)))
+#define KEYS_MIN (KEYS_MAX / 2)
+
+struct leaf {
+	size_t n;
+	struct leaf *next;
+	void *keys[KEYS_MAX];
+	void *values[KEYS_MAX];
+};
+
+/* Child i holds the keys less than keys[i], and not less than keys[i - 1].
+ * Each of keys is that of an entry in the tree. */
+struct inner {
+	size_t n;
+	void *keys[KEYS_MAX];
+	union node *children[KEYS_MAX + 1];
+};
+
+union node {
+	struct leaf leaf;
+	struct inner inner;
+	union node *next_free;
+};
+
+/* Space per node in a chunk, whole lines. */
+#define NODE_STRIDE ((sizeof(union node) + LINE - 1) / LINE * LINE)
+
+/* Nodes come from chunks of CHUNK_NODES, aligned, which are freed only when
+ * the tree is cleared or destroyed. */
+struct chunk {
+	struct chunk *next;
+};
+
+struct btree_t {
+	union node *root;
+	size_t height; /* 0 when the root is a leaf */
+	size_t len;
+
+	union node *free;
+	size_t n_free;
+	struct chunk *chunks;
+
+	btree_cmp_fn cmp_key; /* required */
+	htable_destroy_fn destroy_key, destroy_val; /* optional */
+};
+
+/* Have at least n nodes free. Returns 0, or -1 on allocation failure. */
+static int reserve(btree_t *bt, size_t n);
+
+/* Add the nodes of chunk c to the free list. */
+static void free_chunk_nodes(btree_t *bt, struct chunk *c);
+
+/* Take a reserved node, or give one back. */
+static union node *take_node(btree_t *bt);
+static void give_node(btree_t *bt, union node *node);
+
+/* Index of the first key of leaf not less than key, or of the child of inner
+ * that key belongs in. */
+static size_t leaf_lower_bound(btree_t *bt, struct leaf *leaf, void *key);
+static size_t inner_child_of(btree_t *bt, struct inner *inner, void *key);
+
+/* The leaf key belongs in. */
+static struct leaf *leaf_of(btree_t *bt, void *key);
+
+/*
+ * Set key to value in the subtree under node, of height h. sep is the
+ * separator of the nearest ancestor whose subtree node is leftmost in, or
+ * NULL. Returns as btree_set, with the new right sibling of node in *up_node
+ * (or NULL) if node was split, and its separator in *up_key.
+ */
+static int insert(btree_t *bt, union node *node, size_t h, void **sep,
+		  void *key, void *value, void **up_key, union node **up_node);
+
+/* Insert at i of a full leaf, splitting it into itself and a new right
+ * sibling. */
+static struct leaf *split_leaf(btree_t *bt, struct leaf *leaf, size_t i,
+			       void *key, void *value);
+
+/* Insert a key and its right child at i of a full interior node, splitting
+ * it; the key between the halves is put in *up_key. */
+static struct inner *split_inner(btree_t *bt, struct inner *inner, size_t i,
+				 void *key, union node *child, void **up_key);
+
+/*
+ * Remove key from the subtree under node, of height h, and sep as in insert.
+ * Returns 1 with the entry's key and value in *old_key and *old_val, or 0 if
+ * there is none. Children left underfull are rebalanced, but not node.
+ */
+static int remove_key(btree_t *bt, union node *node, size_t h, void **sep,
+		      void *key, void **old_key, void **old_val);
+
+/* Bring child i of parent, of height h, back to KEYS_MIN keys, borrowing from
+ * or merging with a sibling. */
+static void rebalance(btree_t *bt, struct inner *parent, size_t i, size_t h);
+
+/* Remove key i and child i + 1 from an interior node. */
+static void drop_inner_key(struct inner *inner, size_t i);
+
+/* The leftmost leaf. */
+static struct leaf *first_leaf(btree_t *bt);
+
+/* Destroy every entry, and free every chunk but the first, leaving an empty
+ * root leaf. */
+static void reset(btree_t *bt);
+
+/* Number of nodes n children (or entries, for leaves) fill, each as evenly as
+ * the next. */
+static size_t nodes_for(size_t n, size_t per_node);
+
+btree_t *btree_create(btree_cmp_fn cmp_key, htable_destroy_fn destroy_key,
+		      htable_destroy_fn destroy_val)
+{
+	btree_t *bt;
+
+	assert(cmp_key != NULL);
+	assert(KEYS_MIN >= 2);
+
+	bt = malloc(sizeof(*bt));
+	if (bt == NULL) {
+		return NULL;
+	}
+	bt->free = NULL;
+	bt->n_free = 0;
+	bt->chunks = NULL;
+	if (reserve(bt, 1)) {
+		free(bt);
+		return NULL;
+	}
+
+	bt->root = take_node(bt);
+	bt->root->leaf.n = 0;
+	bt->root->leaf.next = NULL;
+	bt->height = 0;
+	bt->len = 0;
+	bt->cmp_key = cmp_key;
+	bt->destroy_key = destroy_key;
+	bt->destroy_val = destroy_val;
+
+	return bt;
+}
+
+void btree_destroy(btree_t *bt)
+{
+	assert(bt != NULL);
+
+	reset(bt);
+	free(bt->chunks);
+	free(bt);
+}
+
+size_t btree_len(btree_t *bt)
+{
+	assert(bt != NULL);
+
+	return bt->len;
+}
+
+int btree_clear(btree_t *bt)
+{
+	assert(bt != NULL);
+
+	reset(bt);
+	return 0;
+}
+
+int btree_contains(btree_t *bt, void *key)
+{
+	struct leaf *leaf;
+	size_t i;
+
+	assert(bt != NULL);
+
+	leaf = leaf_of(bt, key);
+	i = leaf_lower_bound(bt, leaf, key);
+	return i < leaf->n && !bt->cmp_key(key, leaf->keys[i]);
+}
+
+void *btree_get(btree_t *bt, void *key)
+{
+	struct leaf *leaf;
+	size_t i;
+
+	assert(bt != NULL);
+
+	leaf = leaf_of(bt, key);
+	i = leaf_lower_bound(bt, leaf, key);
+	if (i < leaf->n && !bt->cmp_key(key, leaf->keys[i])) {
+		return leaf->values[i];
+	}
+	return NULL;
+}
+
+int btree_remove(btree_t *bt, void *key)
+{
+	void *old_key, *old_val;
+	union node *root;
+
+	assert(bt != NULL);
+
+	if (!remove_key(bt, bt->root, bt->height, NULL, key, &old_key,
+			&old_val)) {
+		return 0;
+	}
+
+	/* An interior root left with one child gives way to it. */
+	root = bt->root;
+	if (bt->height && !root->inner.n) {
+		bt->root = root->inner.children[0];
+		bt->height--;
+		give_node(bt, root);
+	}
+
+	bt->len--;
+	if (bt->destroy_val != NULL) {
+		bt->destroy_val(old_val);
+	}
+	if (bt->destroy_key != NULL) {
+		bt->destroy_key(old_key);
+	}
+
+	return 1;
+}
+
+int btree_set(btree_t *bt, void *key, void *value)
+{
+	union node *up_node, *root;
+	void *up_key;
+	int r;
+
+	assert(bt != NULL);
+	assert(bt->len < (size_t)-1);
+
+	/* Enough nodes to split every level and add a root, so that a failed
+	 * allocation leaves the tree as it was. */
+	if (reserve(bt, bt->height + 2)) {
+		return -1;
+	}
+
+	r = insert(bt, bt->root, bt->height, NULL, key, value, &up_key,
+		   &up_node);
+	if (up_node != NULL) {
+		root = take_node(bt);
+		root->inner.n = 1;
+		root->inner.keys[0] = up_key;
+		root->inner.children[0] = bt->root;
+		root->inner.children[1] = up_node;
+		bt->root = root;
+		bt->height++;
+	}
+	if (!r) {
+		bt->len++;
+	}
+
+	return r;
+}
+
+int btree_bulk_load(btree_t *bt, void **keys, void **values, size_t n)
+{
+	union node **level;
+	void **mins;
+	size_t count, total, h, i, j, k;
+
+	assert(bt != NULL);
+	assert(keys != NULL || !n);
+
+	if (bt->len) {
+		return -1;
+	}
+	for (i = 1; i < n; i++) {
+		if (bt->cmp_key(keys[i - 1], keys[i]) >= 0) {
+			return -1;
+		}
+	}
+	if (!n) {
+		return 0;
+	}
+
+	/* Every node, before building any. */
+	total = count = nodes_for(n, KEYS_MAX);
+	while (count > 1) {
+		count = nodes_for(count, KEYS_MAX + 1);
+		total += count;
+	}
+	count = nodes_for(n, KEYS_MAX);
+	if (count > (size_t)-1 / sizeof(*level)) {
+		return -1;
+	}
+	level = malloc(count * sizeof(*level));
+	mins = malloc(count * sizeof(*mins));
+	if (level == NULL || mins == NULL || reserve(bt, total)) {
+		free(level);
+		free(mins);
+		return -1;
+	}
+	give_node(bt, bt->root);
+
+	/* Leaves, then each level of interior nodes over the one below, with
+	 * the least key under each node to separate it from the one before. */
+	for (i = j = 0; i < count; i++) {
+		struct leaf *leaf = &take_node(bt)->leaf;
+
+		leaf->n = n / count + (i < n % count);
+		for (k = 0; k < leaf->n; k++, j++) {
+			leaf->keys[k] = keys[j];
+			leaf->values[k] = values != NULL ? values[j] : NULL;
+		}
+		leaf->next = NULL;
+		if (i) {
+			level[i - 1]->leaf.next = leaf;
+		}
+		level[i] = (union node *)leaf;
+		mins[i] = leaf->keys[0];
+	}
+
+	for (h = 0; count > 1; h++) {
+		size_t children = count;
+
+		count = nodes_for(children, KEYS_MAX + 1);
+		for (i = j = 0; i < count; i++) {
+			struct inner *inner = &take_node(bt)->inner;
+			size_t m = children / count + (i < children % count);
+
+			inner->n = m - 1;
+			for (k = 0; k < m; k++, j++) {
+				inner->children[k] = level[j];
+				if (k) {
+					inner->keys[k - 1] = mins[j];
+				}
+			}
+			/* Written behind j, which is ahead of i. */
+			mins[i] = mins[j - m];
+			level[i] = (union node *)inner;
+		}
+	}
+
+	bt->root = level[0];
+	bt->height = h;
+	bt->len = n;
+	free(level);
+	free(mins);
+
+	return 0;
+}
+
+void btree_iter_first(btree_t *bt, struct btree_iter *it)
+{
+	assert(bt != NULL);
+	assert(it != NULL);
+
+	it->bt = bt;
+	it->leaf = first_leaf(bt);
+	it->i = 0;
+	it->bounded = 0;
+	it->hi = NULL;
+}
+
+void btree_iter_lower_bound(btree_t *bt, struct btree_iter *it, void *key)
+{
+	struct leaf *leaf;
+
+	assert(bt != NULL);
+	assert(it != NULL);
+
+	leaf = leaf_of(bt, key);
+	it->bt = bt;
+	it->leaf = leaf;
+	it->i = leaf_lower_bound(bt, leaf, key);
+	it->bounded = 0;
+	it->hi = NULL;
+}
+
+void btree_iter_stop_at(struct btree_iter *it, void *hi)
+{
+	assert(it != NULL);
+
+	it->bounded = 1;
+	it->hi = hi;
+}
+
+int btree_iter_next(struct btree_iter *it, void **key, void **value)
+{
+	struct leaf *leaf;
+
+	assert(it != NULL);
+
+	leaf = it->leaf;
+	while (leaf != NULL && it->i >= leaf->n) {
+		leaf = leaf->next;
+		it->i = 0;
+	}
+	it->leaf = leaf;
+	if (leaf == NULL) {
+		return 0;
+	}
+	if (it->bounded && it->bt->cmp_key(leaf->keys[it->i], it->hi) >= 0) {
+		it->leaf = NULL;
+		return 0;
+	}
+
+	if (key != NULL) {
+		*key = leaf->keys[it->i];
+	}
+	if (value != NULL) {
+		*value = leaf->values[it->i];
+	}
+	it->i++;
+	return 1;
+}
+
+static int reserve(btree_t *bt, size_t n)
+{
+	struct chunk *c;
+
+	while (bt->n_free < n) {
+		c = malloc(sizeof(*c) + LINE + CHUNK_NODES * NODE_STRIDE);
+		if (c == NULL) {
+			return -1;
+		}
+		c->next = bt->chunks;
+		bt->chunks = c;
+		free_chunk_nodes(bt, c);
+	}
+	return 0;
+}
+
+static void free_chunk_nodes(btree_t *bt, struct chunk *c)
+{
+	char *base;
+	size_t i;
+
+	/* The first line after the chunk's header. */
+	base = (char *)(c + 1);
+	base += (LINE - (size_t)base % LINE) % LINE;
+	for (i = 0; i < CHUNK_NODES; i++) {
+		give_node(bt, (union node *)(base + i * NODE_STRIDE));
+	}
+}
+
+static union node *take_node(btree_t *bt)
+{
+	union node *node = bt->free;
+
+	assert(node != NULL && bt->n_free);
+	bt->free = node->next_free;
+	bt->n_free--;
+	return node;
+}
+
+static void give_node(btree_t *bt, union node *node)
+{
+	node->next_free = bt->free;
+	bt->free = node;
+	bt->n_free++;
+}
+
+static size_t leaf_lower_bound(btree_t *bt, struct leaf *leaf, void *key)
+{
+	size_t lo = 0, hi = leaf->n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (bt->cmp_key(leaf->keys[mid], key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static size_t inner_child_of(btree_t *bt, struct inner *inner, void *key)
+{
+	size_t lo = 0, hi = inner->n, mid;
+
+	/* The first key greater than key. */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (bt->cmp_key(inner->keys[mid], key) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static struct leaf *leaf_of(btree_t *bt, void *key)
+{
+	union node *node = bt->root;
+	size_t h;
+
+	for (h = bt->height; h; h--) {
+		node = node->inner.children[inner_child_of(bt, &node->inner,
+							   key)];
+	}
+	return &node->leaf;
+}
+
+static int insert(btree_t *bt, union node *node, size_t h, void **sep,
+		  void *key, void *value, void **up_key, union node **up_node)
+{
+	struct inner *inner;
+	union node *child;
+	void *child_key;
+	size_t i;
+	int r;
+
+	*up_node = NULL;
+
+	if (!h) {
+		struct leaf *leaf = &node->leaf;
+
+		i = leaf_lower_bound(bt, leaf, key);
+		if (i < leaf->n && !bt->cmp_key(key, leaf->keys[i])) {
+			if (bt->destroy_val != NULL) {
+				bt->destroy_val(leaf->values[i]);
+			}
+			/* The separator above, if the old key was it, must
+			 * not outlive it. */
+			if (!i && sep != NULL && *sep == leaf->keys[0]) {
+				*sep = key;
+			}
+			leaf->keys[i] = key;
+			leaf->values[i] = value;
+			return 1;
+		}
+
+		if (leaf->n < KEYS_MAX) {
+			memmove(&leaf->keys[i + 1], &leaf->keys[i],
+				(leaf->n - i) * sizeof(leaf->keys[0]));
+			memmove(&leaf->values[i + 1], &leaf->values[i],
+				(leaf->n - i) * sizeof(leaf->values[0]));
+			leaf->keys[i] = key;
+			leaf->values[i] = value;
+			leaf->n++;
+			return 0;
+		}
+
+		*up_node = (union node *)split_leaf(bt, leaf, i, key, value);
+		*up_key = (*up_node)->leaf.keys[0];
+		return 0;
+	}
+
+	inner = &node->inner;
+	i = inner_child_of(bt, inner, key);
+	r = insert(bt, inner->children[i], h - 1,
+		   i ? &inner->keys[i - 1] : sep, key, value, &child_key,
+		   &child);
+	if (child == NULL) {
+		return r;
+	}
+
+	if (inner->n < KEYS_MAX) {
+		memmove(&inner->keys[i + 1], &inner->keys[i],
+			(inner->n - i) * sizeof(inner->keys[0]));
+		memmove(&inner->children[i + 2], &inner->children[i + 1],
+			(inner->n - i) * sizeof(inner->children[0]));
+		inner->keys[i] = child_key;
+		inner->children[i + 1] = child;
+		inner->n++;
+		return r;
+	}
+
+	*up_node = (union node *)split_inner(bt, inner, i, child_key, child,
+					     up_key);
+	return r;
+}
+
+static struct leaf *split_leaf(btree_t *bt, struct leaf *leaf, size_t i,
+			       void *key, void *value)
+{
+	void *keys[KEYS_MAX + 1], *values[KEYS_MAX + 1];
+	struct leaf *right;
+	size_t left_n;
+
+	memcpy(keys, leaf->keys, i * sizeof(keys[0]));
+	memcpy(values, leaf->values, i * sizeof(values[0]));
+	keys[i] = key;
+	values[i] = value;
+	memcpy(&keys[i + 1], &leaf->keys[i], (KEYS_MAX - i) * sizeof(keys[0]));
+	memcpy(&values[i + 1], &leaf->values[i],
+	       (KEYS_MAX - i) * sizeof(values[0]));
+
+	right = &take_node(bt)->leaf;
+	left_n = (KEYS_MAX + 1) / 2;
+	leaf->n = left_n;
+	right->n = KEYS_MAX + 1 - left_n;
+	memcpy(leaf->keys, keys, left_n * sizeof(keys[0]));
+	memcpy(leaf->values, values, left_n * sizeof(values[0]));
+	memcpy(right->keys, &keys[left_n], right->n * sizeof(keys[0]));
+	memcpy(right->values, &values[left_n], right->n * sizeof(values[0]));
+
+	right->next = leaf->next;
+	leaf->next = right;
+	return right;
+}
+
+static struct inner *split_inner(btree_t *bt, struct inner *inner, size_t i,
+				 void *key, union node *child, void **up_key)
+{
+	void *keys[KEYS_MAX + 1];
+	union node *children[KEYS_MAX + 2];
+	struct inner *right;
+	size_t left_n;
+
+	memcpy(keys, inner->keys, i * sizeof(keys[0]));
+	keys[i] = key;
+	memcpy(&keys[i + 1], &inner->keys[i], (KEYS_MAX - i) * sizeof(keys[0]));
+	memcpy(children, inner->children, (i + 1) * sizeof(children[0]));
+	children[i + 1] = child;
+	memcpy(&children[i + 2], &inner->children[i + 1],
+	       (KEYS_MAX - i) * sizeof(children[0]));
+
+	/* The middle key moves up, between the halves. */
+	right = &take_node(bt)->inner;
+	left_n = (KEYS_MAX + 1) / 2;
+	inner->n = left_n;
+	right->n = KEYS_MAX - left_n;
+	*up_key = keys[left_n];
+	memcpy(inner->keys, keys, left_n * sizeof(keys[0]));
+	memcpy(inner->children, children, (left_n + 1) * sizeof(children[0]));
+	memcpy(right->keys, &keys[left_n + 1], right->n * sizeof(keys[0]));
+	memcpy(right->children, &children[left_n + 1],
+	       (right->n + 1) * sizeof(children[0]));
+
+	return right;
+}
+
+static int remove_key(btree_t *bt, union node *node, size_t h, void **sep,
+		      void *key, void **old_key, void **old_val)
+{
+	struct inner *inner;
+	size_t i;
+
+	if (!h) {
+		struct leaf *leaf = &node->leaf;
+
+		i = leaf_lower_bound(bt, leaf, key);
+		if (i == leaf->n || bt->cmp_key(key, leaf->keys[i])) {
+			return 0;
+		}
+		*old_key = leaf->keys[i];
+		*old_val = leaf->values[i];
+		leaf->n--;
+		memmove(&leaf->keys[i], &leaf->keys[i + 1],
+			(leaf->n - i) * sizeof(leaf->keys[0]));
+		memmove(&leaf->values[i], &leaf->values[i + 1],
+			(leaf->n - i) * sizeof(leaf->values[0]));
+
+		/* Leaves other than the root keep a key, the new least, to
+		 * take the old one's place as separator. */
+		if (!i && sep != NULL && *sep == *old_key) {
+			assert(leaf->n);
+			*sep = leaf->keys[0];
+		}
+		return 1;
+	}
+
+	inner = &node->inner;
+	i = inner_child_of(bt, inner, key);
+	if (!remove_key(bt, inner->children[i], h - 1,
+			i ? &inner->keys[i - 1] : sep, key, old_key, old_val)) {
+		return 0;
+	}
+	rebalance(bt, inner, i, h - 1);
+	return 1;
+}
+
+static void rebalance(btree_t *bt, struct inner *parent, size_t i, size_t h)
+{
+	union node *child = parent->children[i];
+	union node *left = i ? parent->children[i - 1] : NULL;
+	union node *right = i < parent->n ? parent->children[i + 1] : NULL;
+
+	if (!h) {
+		struct leaf *c = &child->leaf, *l, *r;
+
+		if (c->n >= KEYS_MIN) {
+			return;
+		}
+
+		if (left != NULL && left->leaf.n > KEYS_MIN) {
+			l = &left->leaf;
+			memmove(&c->keys[1], c->keys, c->n * sizeof(c->keys[0]));
+			memmove(&c->values[1], c->values,
+				c->n * sizeof(c->values[0]));
+			l->n--;
+			c->keys[0] = l->keys[l->n];
+			c->values[0] = l->values[l->n];
+			c->n++;
+			parent->keys[i - 1] = c->keys[0];
+		} else if (right != NULL && right->leaf.n > KEYS_MIN) {
+			r = &right->leaf;
+			c->keys[c->n] = r->keys[0];
+			c->values[c->n] = r->values[0];
+			c->n++;
+			r->n--;
+			memmove(r->keys, &r->keys[1], r->n * sizeof(r->keys[0]));
+			memmove(r->values, &r->values[1],
+				r->n * sizeof(r->values[0]));
+			parent->keys[i] = r->keys[0];
+		} else {
+			/* Merge the right of the pair into the left. */
+			if (left != NULL) {
+				l = &left->leaf;
+				r = c;
+				i--;
+			} else {
+				l = c;
+				r = &right->leaf;
+			}
+			memcpy(&l->keys[l->n], r->keys, r->n * sizeof(r->keys[0]));
+			memcpy(&l->values[l->n], r->values,
+			       r->n * sizeof(r->values[0]));
+			l->n += r->n;
+			l->next = r->next;
+			drop_inner_key(parent, i);
+			give_node(bt, (union node *)r);
+		}
+	} else {
+		struct inner *c = &child->inner, *l, *r;
+
+		if (c->n >= KEYS_MIN) {
+			return;
+		}
+
+		/* Borrowing rotates a key through the parent. */
+		if (left != NULL && left->inner.n > KEYS_MIN) {
+			l = &left->inner;
+			memmove(&c->keys[1], c->keys, c->n * sizeof(c->keys[0]));
+			memmove(&c->children[1], c->children,
+				(c->n + 1) * sizeof(c->children[0]));
+			c->keys[0] = parent->keys[i - 1];
+			c->children[0] = l->children[l->n];
+			c->n++;
+			parent->keys[i - 1] = l->keys[l->n - 1];
+			l->n--;
+		} else if (right != NULL && right->inner.n > KEYS_MIN) {
+			r = &right->inner;
+			c->keys[c->n] = parent->keys[i];
+			c->children[c->n + 1] = r->children[0];
+			c->n++;
+			parent->keys[i] = r->keys[0];
+			r->n--;
+			memmove(r->keys, &r->keys[1], r->n * sizeof(r->keys[0]));
+			memmove(r->children, &r->children[1],
+				(r->n + 1) * sizeof(r->children[0]));
+		} else {
+			/* Merging brings the parent's key between them down. */
+			if (left != NULL) {
+				l = &left->inner;
+				r = c;
+				i--;
+			} else {
+				l = c;
+				r = &right->inner;
+			}
+			l->keys[l->n] = parent->keys[i];
+			memcpy(&l->keys[l->n + 1], r->keys,
+			       r->n * sizeof(r->keys[0]));
+			memcpy(&l->children[l->n + 1], r->children,
+			       (r->n + 1) * sizeof(r->children[0]));
+			l->n += 1 + r->n;
+			drop_inner_key(parent, i);
+			give_node(bt, (union node *)r);
+		}
+	}
+}
+
+static void drop_inner_key(struct inner *inner, size_t i)
+{
+	inner->n--;
+	memmove(&inner->keys[i], &inner->keys[i + 1],
+		(inner->n - i) * sizeof(inner->keys[0]));
+	memmove(&inner->children[i + 1], &inner->children[i + 2],
+		(inner->n - i) * sizeof(inner->children[0]));
+}
+
+static struct leaf *first_leaf(btree_t *bt)
+{
+	union node *node = bt->root;
+	size_t h;
+
+	for (h = bt->height; h; h--) {
+		node = node->inner.children[0];
+	}
+	return &node->leaf;
+}
+
+static void reset(btree_t *bt)
+{
+	struct leaf *leaf;
+	struct chunk *c, *next;
+	size_t i;
+
+	for (leaf = first_leaf(bt); leaf != NULL; leaf = leaf->next) {
+		for (i = 0; i < leaf->n; i++) {
+			if (bt->destroy_val != NULL) {
+				bt->destroy_val(leaf->values[i]);
+			}
+			if (bt->destroy_key != NULL) {
+				bt->destroy_key(leaf->keys[i]);
+			}
+		}
+	}
+
+	/* Keep the oldest chunk, which holds at least the root. */
+	for (c = bt->chunks; c->next != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	bt->chunks = c;
+	bt->free = NULL;
+	bt->n_free = 0;
+	free_chunk_nodes(bt, c);
+
+	bt->root = take_node(bt);
+	bt->root->leaf.n = 0;
+	bt->root->leaf.next = NULL;
+	bt->height = 0;
+	bt->len = 0;
+}
+
+static size_t nodes_for(size_t n, size_t per_node)
+{
+	return n / per_node + !!(n % per_node);
+}
@@ -0,0 +1,74 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+/*
+ * An ordered map, as a B+tree: keys and values in leaves chained in order, and
+ * wide interior nodes above them. Nodes are BTREE_NODE_BYTES, aligned to
+ * cache lines, so that a point lookup costs a few misses per level - of
+ * which a tree of a million keys has about six - plus those its comparisons
+ * take to reach the keys.
+ *
+ * Takes the destroy callbacks of htable.h, but a three-way comparator. As in
+ * htable_t, setting a key already there replaces its key and value, destroying
+ * only the old value.
+ */
+
+#include <stddef.h>
+
+#include "htable.h" /* for htable_destroy_fn */
+
+/* Bytes per node, a multiple of 64 of at least 128. The default of four
+ * lines holds 15 keys per node on LP64 systems. */
+#ifndef BTREE_NODE_BYTES
+#define BTREE_NODE_BYTES 256
+#endif
+
+typedef struct btree_t btree_t;
+
+/* Negative, zero or positive, as a is less than, equal to or greater than b. */
+typedef int (*btree_cmp_fn)(void *a, void *b);
+
+/*
+ * A position in a tree, for walking it in order. Its members are private.
+ * Changing the tree invalidates its iterators.
+ */
+struct btree_iter {
+	btree_t *bt;
+	void *leaf;
+	size_t i;
+	int bounded;
+	void *hi;
+};
+
+btree_t *btree_create(btree_cmp_fn cmp_key, htable_destroy_fn destroy_key,
+		      htable_destroy_fn destroy_val);
+void btree_destroy(btree_t *bt);
+
+size_t btree_len(btree_t *bt);
+
+int btree_clear(btree_t *bt);
+int btree_contains(btree_t *bt, void *key);
+void *btree_get(btree_t *bt, void *key);
+int btree_remove(btree_t *bt, void *key);
+int btree_set(btree_t *bt, void *key, void *value);
+
+/*
+ * Fill an empty tree with n keys in strictly ascending order, and their values
+ * (NULL for all NULL), packing nodes full. Returns 0, or -1 if the tree isn't
+ * empty, the keys aren't in order, or on allocation failure, in which case
+ * the tree is left empty.
+ */
+int btree_bulk_load(btree_t *bt, void **keys, void **values, size_t n);
+
+/* Start at the least key, or at the least key not less than key. */
+void btree_iter_first(btree_t *bt, struct btree_iter *it);
+void btree_iter_lower_bound(btree_t *bt, struct btree_iter *it, void *key);
+
+/* End before the first key not less than hi, for iterating over a range. */
+void btree_iter_stop_at(struct btree_iter *it, void *hi);
+
+/* Get the key and value (either may be NULL) at the iterator and move past
+ * them. Returns 1, or 0 once past the end. */
+int btree_iter_next(struct btree_iter *it, void **key, void **value);
+
+#endif /* BTREE_H */
@@ -0,0 +1,346 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmsketch.h"
+
+/* Hashes cmsketch_add_many takes at a time. */
+#define BLOCK 64
+
+/*
+ * Counters are row-major, width (a power of two) per row. A key's column in
+ * row r is h1 + r * h2, of two hashes from its own, as in Kirsch and
+ * Mitzenmacher's "Less Hashing, Same Performance".
+ *
+ * The heavy hitters are a min-heap on count, so the lightest is the one a
+ * heavier key replaces.
+ */
+struct cmsketch_t {
+	unsigned long *counters;
+	size_t mask; /* width - 1 */
+	size_t depth;
+	unsigned long total;
+
+	size_t *top_hash;
+	unsigned long *top_count;
+	size_t n_top, k;
+};
+
+/* The finalizer of hash_int_multiandxor, as in hll.c, inlined into the loops
+ * of cmsketch_add_many. */
+static size_t mix(size_t hash);
+
+/* The two column hashes of a key's mixed hash. */
+static size_t hash2_of(size_t h1);
+
+/* The estimate of a key by its column hashes. */
+static unsigned long estimate(cmsketch_t *cms, size_t h1, size_t h2);
+
+/* Record count as the estimate of hash among the heavy hitters, if it is one
+ * of the k heaviest. */
+static void offer(cmsketch_t *cms, size_t hash, unsigned long count);
+
+/* Restore the heap below entry i, whose count may have grown. */
+static void sift_down(cmsketch_t *cms, size_t i, size_t n);
+static void sift_up(cmsketch_t *cms, size_t i);
+static void swap_top(cmsketch_t *cms, size_t i, size_t j);
+
+cmsketch_t *cmsketch_create(size_t width, size_t depth, size_t k)
+{
+	cmsketch_t *cms;
+	size_t w;
+
+	assert(depth > 0);
+
+	for (w = 1; w < width; w <<= 1) {
+		if (w > (size_t)-1 / 2 / depth / sizeof(unsigned long)) {
+			return NULL;
+		}
+	}
+	if (k > (size_t)-1 / sizeof(size_t)) {
+		return NULL;
+	}
+
+	cms = malloc(sizeof(*cms));
+	if (cms == NULL) {
+		return NULL;
+	}
+	cms->counters = malloc(w * depth * sizeof(unsigned long));
+	cms->top_hash = malloc((k ? k : 1) * sizeof(size_t));
+	cms->top_count = malloc((k ? k : 1) * sizeof(unsigned long));
+	if (cms->counters == NULL || cms->top_hash == NULL ||
+	    cms->top_count == NULL) {
+		free(cms->counters);
+		free(cms->top_hash);
+		free(cms->top_count);
+		free(cms);
+		return NULL;
+	}
+	cms->mask = w - 1;
+	cms->depth = depth;
+	cms->k = k;
+
+	cmsketch_clear(cms);
+	return cms;
+}
+
+void cmsketch_destroy(cmsketch_t *cms)
+{
+	assert(cms != NULL);
+
+	free(cms->counters);
+	free(cms->top_hash);
+	free(cms->top_count);
+	free(cms);
+}
+
+unsigned long cmsketch_total(cmsketch_t *cms)
+{
+	assert(cms != NULL);
+
+	return cms->total;
+}
+
+void cmsketch_add(cmsketch_t *cms, size_t hash, unsigned long count)
+{
+	size_t h1, h2, r;
+
+	assert(cms != NULL);
+
+	h1 = mix(hash);
+	h2 = hash2_of(h1);
+	for (r = 0; r < cms->depth; r++) {
+		cms->counters[r * (cms->mask + 1) + ((h1 + r * h2) & cms->mask)] +=
+			count;
+	}
+	cms->total += count;
+
+	if (cms->k) {
+		offer(cms, hash, estimate(cms, h1, h2));
+	}
+}
+
+void cmsketch_add_many(cmsketch_t *cms, const size_t *hashes, size_t n)
+{
+	size_t h1[BLOCK], h2[BLOCK], col[BLOCK], i, k, r;
+
+	assert(cms != NULL);
+	assert(hashes != NULL || !n);
+
+	for (; n; hashes += k, n -= k) {
+		k = n < BLOCK ? n : BLOCK;
+
+		for (i = 0; i < k; i++) {
+			h1[i] = mix(hashes[i]);
+			h2[i] = hash2_of(h1[i]);
+		}
+
+		/* A row's columns all at once; then their increments, which
+		 * may collide, one by one. */
+		for (r = 0; r < cms->depth; r++) {
+			unsigned long *row = &cms->counters[r * (cms->mask + 1)];
+
+			for (i = 0; i < k; i++) {
+				col[i] = (h1[i] + r * h2[i]) & cms->mask;
+			}
+			for (i = 0; i < k; i++) {
+				row[col[i]]++;
+			}
+		}
+		cms->total += k;
+
+		if (cms->k) {
+			for (i = 0; i < k; i++) {
+				offer(cms, hashes[i], estimate(cms, h1[i], h2[i]));
+			}
+		}
+	}
+}
+
+unsigned long cmsketch_estimate(cmsketch_t *cms, size_t hash)
+{
+	size_t h1;
+
+	assert(cms != NULL);
+
+	h1 = mix(hash);
+	return estimate(cms, h1, hash2_of(h1));
+}
+
+size_t cmsketch_top(cmsketch_t *cms, size_t *hashes, unsigned long *counts,
+		    size_t n)
+{
+	size_t i, j;
+
+	assert(cms != NULL);
+
+	/* Heapsort the heap, which leaves it heaviest first; then reverse it,
+	 * which, sorted lightest first, is a heap again. */
+	for (i = cms->n_top; i > 1; i--) {
+		swap_top(cms, 0, i - 1);
+		sift_down(cms, 0, i - 1);
+	}
+
+	if (n > cms->n_top) {
+		n = cms->n_top;
+	}
+	for (i = 0; i < n; i++) {
+		if (hashes != NULL) {
+			hashes[i] = cms->top_hash[i];
+		}
+		if (counts != NULL) {
+			counts[i] = cms->top_count[i];
+		}
+	}
+
+	for (i = 0, j = cms->n_top; i + 1 < j; i++, j--) {
+		swap_top(cms, i, j - 1);
+	}
+
+	return n;
+}
+
+int cmsketch_merge(cmsketch_t *dst, cmsketch_t *src)
+{
+	size_t i, n;
+
+	assert(dst != NULL);
+	assert(src != NULL);
+
+	if (dst->mask != src->mask || dst->depth != src->depth) {
+		return -1;
+	}
+
+	n = (dst->mask + 1) * dst->depth;
+	for (i = 0; i < n; i++) {
+		dst->counters[i] += src->counters[i];
+	}
+	dst->total += src->total;
+
+	if (!dst->k) {
+		return 0;
+	}
+
+	/* Re-estimate dst's hitters, which may only have grown, and offer
+	 * src's. */
+	for (i = 0; i < dst->n_top; i++) {
+		dst->top_count[i] = cmsketch_estimate(dst, dst->top_hash[i]);
+	}
+	for (i = dst->n_top / 2; i > 0; i--) {
+		sift_down(dst, i - 1, dst->n_top);
+	}
+	for (i = 0; i < src->n_top; i++) {
+		offer(dst, src->top_hash[i],
+		      cmsketch_estimate(dst, src->top_hash[i]));
+	}
+
+	return 0;
+}
+
+void cmsketch_clear(cmsketch_t *cms)
+{
+	assert(cms != NULL);
+
+	memset(cms->counters, 0,
+	       (cms->mask + 1) * cms->depth * sizeof(unsigned long));
+	cms->total = 0;
+	cms->n_top = 0;
+}
+
+static size_t mix(size_t hash)
+{
+	hash ^= (hash >> 16) >> 16;
+	hash *= 0x85ebca6bUL;
+	hash ^= (hash >> 13);
+	hash *= 0xc2b2ae35UL;
+	hash ^= (hash >> 16);
+
+	return hash;
+}
+
+static size_t hash2_of(size_t h1)
+{
+	/* The high half, odd so that rows differ. */
+	return (h1 >> (sizeof(size_t) * CHAR_BIT / 2)) | 1;
+}
+
+static unsigned long estimate(cmsketch_t *cms, size_t h1, size_t h2)
+{
+	unsigned long min, c;
+	size_t r;
+
+	min = cms->counters[h1 & cms->mask];
+	for (r = 1; r < cms->depth; r++) {
+		c = cms->counters[r * (cms->mask + 1) +
+				  ((h1 + r * h2) & cms->mask)];
+		if (c < min) {
+			min = c;
+		}
+	}
+	return min;
+}
+
+static void offer(cmsketch_t *cms, size_t hash, unsigned long count)
+{
+	size_t i;
+
+	for (i = 0; i < cms->n_top; i++) {
+		if (cms->top_hash[i] == hash) {
+			cms->top_count[i] = count;
+			sift_down(cms, i, cms->n_top);
+			return;
+		}
+	}
+
+	if (cms->n_top < cms->k) {
+		cms->top_hash[cms->n_top] = hash;
+		cms->top_count[cms->n_top] = count;
+		sift_up(cms, cms->n_top++);
+	} else if (count > cms->top_count[0]) {
+		cms->top_hash[0] = hash;
+		cms->top_count[0] = count;
+		sift_down(cms, 0, cms->n_top);
+	}
+}
+
+static void sift_down(cmsketch_t *cms, size_t i, size_t n)
+{
+	size_t least;
+
+	for (;;) {
+		least = i;
+		if (2 * i + 1 < n &&
+		    cms->top_count[2 * i + 1] < cms->top_count[least]) {
+			least = 2 * i + 1;
+		}
+		if (2 * i + 2 < n &&
+		    cms->top_count[2 * i + 2] < cms->top_count[least]) {
+			least = 2 * i + 2;
+		}
+		if (least == i) {
+			return;
+		}
+		swap_top(cms, i, least);
+		i = least;
+	}
+}
+
+static void sift_up(cmsketch_t *cms, size_t i)
+{
+	while (i > 0 && cms->top_count[i] < cms->top_count[(i - 1) / 2]) {
+		swap_top(cms, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void swap_top(cmsketch_t *cms, size_t i, size_t j)
+{
+	size_t hash = cms->top_hash[i];
+	unsigned long count = cms->top_count[i];
+
+	cms->top_hash[i] = cms->top_hash[j];
+	cms->top_count[i] = cms->top_count[j];
+	cms->top_hash[j] = hash;
+	cms->top_count[j] = count;
+}
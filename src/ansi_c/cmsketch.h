@@ -0,0 +1,53 @@
+#ifndef CMSKETCH_H
+#define CMSKETCH_H
+
+/*
+ * A Count-Min sketch of key frequencies over key hashes (e.g. from hash.h), in
+ * bounded memory: depth rows of width counters, however long the stream. A
+ * key's estimate is the least of its counter in each row, and never below its
+ * true count; with probability 1 - e^-depth, it is above by no more than
+ * e * total / width.
+ *
+ * A sketch can also track its k heaviest hitters, as a heap of the hashes
+ * with the highest estimates seen. Tracking is a linear scan of the heap per
+ * key added, so meant for k in the tens.
+ *
+ * Counts wrap past ULONG_MAX.
+ */
+
+#include <stddef.h>
+
+typedef struct cmsketch_t cmsketch_t;
+
+/* Create an empty sketch of at least width counters per row over depth rows,
+ * tracking the k heaviest hitters (none if k is 0), or return NULL on
+ * allocation failure. */
+cmsketch_t *cmsketch_create(size_t width, size_t depth, size_t k);
+void cmsketch_destroy(cmsketch_t *cms);
+
+/* Sum of the counts added. */
+unsigned long cmsketch_total(cmsketch_t *cms);
+
+/* Add count occurrences of a key by its hash. */
+void cmsketch_add(cmsketch_t *cms, size_t hash, unsigned long count);
+
+/* Add one occurrence of each of n keys by their hashes. Counters are updated
+ * in blocks, the columns of each row computed in a loop that compilers
+ * vectorize. */
+void cmsketch_add_many(cmsketch_t *cms, const size_t *hashes, size_t n);
+
+/* Estimated occurrences of a key by its hash. */
+unsigned long cmsketch_estimate(cmsketch_t *cms, size_t hash);
+
+/* Copy up to n of the heaviest hitters' hashes and estimates, heaviest first,
+ * into hashes and counts (which may be NULL), returning how many. */
+size_t cmsketch_top(cmsketch_t *cms, size_t *hashes, unsigned long *counts,
+		    size_t n);
+
+/* Add every count added to src to dst, and merge their heavy hitters. Returns
+ * 0, or -1 if their widths or depths differ. */
+int cmsketch_merge(cmsketch_t *dst, cmsketch_t *src);
+
+void cmsketch_clear(cmsketch_t *cms);
+
+#endif /* CMSKETCH_H */
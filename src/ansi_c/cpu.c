@@ -0,0 +1,20 @@
+#include "cpu.h"
+
+int cpu_has(enum cpu_feature f)
+{
+#ifdef CPU_X86
+	switch (f) {
+	case CPU_FEATURE_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case CPU_FEATURE_SSE42:
+		return __builtin_cpu_supports("sse4.2");
+	case CPU_FEATURE_AVX2:
+		return __builtin_cpu_supports("avx2");
+	default:
+		return 0;
+	}
+#else
+	(void)f;
+	return 0;
+#endif
+}
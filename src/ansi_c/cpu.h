@@ -0,0 +1,27 @@
+#ifndef CPU_H
+#define CPU_H
+
+/* Runtime CPU feature detection, for choosing between instruction-level and
+ * portable implementations of the same routine.
+ *
+ * CPU_X86 is defined when instruction-level x86 paths can be compiled at all
+ * (a GCC-compatible compiler targeting x86). Define CPU_NO_SIMD to force the
+ * portable paths everywhere.
+ */
+
+#if !defined(CPU_NO_SIMD) && defined(__GNUC__) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define CPU_X86 1
+#endif
+
+enum cpu_feature {
+	CPU_FEATURE_SSE2,
+	CPU_FEATURE_SSE42,
+	CPU_FEATURE_AVX2
+};
+
+/* Return non-zero if the running CPU supports the given feature. Always 0 for
+ * features of other architectures, or where detection is unsupported. */
+int cpu_has(enum cpu_feature f);
+
+#endif /* CPU_H */
@@ -0,0 +1,344 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cuckoo_filter.h"
+#include "hash.h"
+#include "htable.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#define SLOTS 4
+
+/*
+ * When a fingerprint can't be placed after CUCKOO_FILTER_MAX_KICKS moves, the
+ * last one displaced is kept aside as the victim, so nothing added is lost;
+ * the filter then counts as full until a removal makes room for it.
+ */
+struct cuckoo_filter_t {
+	unsigned short *fps; /* SLOTS per bucket; 0 marks an empty slot */
+	size_t mask; /* number of buckets - 1, a power of two - 1 */
+	size_t len;
+	unsigned long rng;
+
+	int has_victim;
+	unsigned short victim_fp;
+	size_t victim_i; /* one of its buckets */
+};
+
+/* The fingerprint, never 0, and first bucket of hash. */
+static unsigned short fingerprint(size_t hash);
+static size_t bucket_of(cuckoo_filter_t *cf, size_t hash);
+
+/* The other bucket a fingerprint in bucket i may be in. */
+static size_t alt_bucket(cuckoo_filter_t *cf, size_t i, unsigned short fp);
+
+/* Put fp in a free slot of bucket i, returning 0, or -1 if there is none. */
+static int place(cuckoo_filter_t *cf, size_t i, unsigned short fp);
+
+/* Take fp out of bucket i, returning 1, or 0 if it isn't there. */
+static int take(cuckoo_filter_t *cf, size_t i, unsigned short fp);
+
+/* A pseudo-random number for choosing what to displace. */
+static unsigned long next_rand(cuckoo_filter_t *cf);
+
+/* Implementations of the lookup of fp in buckets a and b. */
+static int find_scalar(const unsigned short *a, const unsigned short *b,
+		       unsigned short fp);
+#ifdef CPU_X86
+static int find_sse2(const unsigned short *a, const unsigned short *b,
+		     unsigned short fp);
+#endif
+
+/* Pick the best implementation for the running CPU on first use. */
+static int find_resolve(const unsigned short *a, const unsigned short *b,
+			unsigned short fp);
+
+static int (*find_impl)(const unsigned short *a, const unsigned short *b,
+			unsigned short fp) = find_resolve;
+
+/* htable_filter callbacks. */
+static int filter_add(void *ctx, size_t hash);
+static int filter_may_contain(void *ctx, size_t hash);
+static void filter_remove(void *ctx, size_t hash);
+static void filter_clear(void *ctx);
+
+cuckoo_filter_t *cuckoo_filter_create(size_t n)
+{
+	cuckoo_filter_t *cf;
+	size_t buckets, want;
+
+	/* Cuckoo filters of four-slot buckets fill to about 95%. */
+	want = n / SLOTS + n / (SLOTS * 16) + 1;
+	for (buckets = 1; buckets < want; buckets <<= 1) {
+		if (buckets > (size_t)-1 / 2 / (SLOTS * sizeof(*cf->fps))) {
+			return NULL;
+		}
+	}
+
+	cf = malloc(sizeof(*cf));
+	if (cf == NULL) {
+		return NULL;
+	}
+	cf->fps = malloc(buckets * SLOTS * sizeof(*cf->fps));
+	if (cf->fps == NULL) {
+		free(cf);
+		return NULL;
+	}
+	cf->mask = buckets - 1;
+	cf->rng = 1;
+
+	cuckoo_filter_clear(cf);
+	return cf;
+}
+
+void cuckoo_filter_destroy(cuckoo_filter_t *cf)
+{
+	assert(cf != NULL);
+
+	free(cf->fps);
+	free(cf);
+}
+
+size_t cuckoo_filter_len(cuckoo_filter_t *cf)
+{
+	assert(cf != NULL);
+
+	return cf->len;
+}
+
+int cuckoo_filter_add(cuckoo_filter_t *cf, size_t hash)
+{
+	unsigned short fp;
+	size_t i, n;
+
+	assert(cf != NULL);
+
+	if (cf->has_victim) {
+		return -1;
+	}
+
+	fp = fingerprint(hash);
+	i = bucket_of(cf, hash);
+	cf->len++;
+
+	if (!place(cf, i, fp)) {
+		return 0;
+	}
+	i = alt_bucket(cf, i, fp);
+	if (!place(cf, i, fp)) {
+		return 0;
+	}
+
+	/* Displace a random fingerprint, and try to place it in its other
+	 * bucket, and so on. */
+	for (n = 0; n < CUCKOO_FILTER_MAX_KICKS; n++) {
+		unsigned short *slot = &cf->fps[i * SLOTS +
+						next_rand(cf) % SLOTS];
+		unsigned short displaced = *slot;
+
+		*slot = fp;
+		fp = displaced;
+		i = alt_bucket(cf, i, fp);
+		if (!place(cf, i, fp)) {
+			return 0;
+		}
+	}
+
+	cf->has_victim = 1;
+	cf->victim_fp = fp;
+	cf->victim_i = i;
+	return 0;
+}
+
+int cuckoo_filter_may_contain(cuckoo_filter_t *cf, size_t hash)
+{
+	unsigned short fp;
+	size_t i, j;
+
+	assert(cf != NULL);
+
+	fp = fingerprint(hash);
+	i = bucket_of(cf, hash);
+	j = alt_bucket(cf, i, fp);
+
+	if (cf->has_victim && cf->victim_fp == fp &&
+	    (cf->victim_i == i || cf->victim_i == j)) {
+		return 1;
+	}
+	return find_impl(&cf->fps[i * SLOTS], &cf->fps[j * SLOTS], fp);
+}
+
+int cuckoo_filter_remove(cuckoo_filter_t *cf, size_t hash)
+{
+	unsigned short fp;
+	size_t i, j;
+
+	assert(cf != NULL);
+
+	fp = fingerprint(hash);
+	i = bucket_of(cf, hash);
+	j = alt_bucket(cf, i, fp);
+
+	if (cf->has_victim && cf->victim_fp == fp &&
+	    (cf->victim_i == i || cf->victim_i == j)) {
+		cf->has_victim = 0;
+		cf->len--;
+		return 1;
+	}
+
+	if (!take(cf, i, fp) && !take(cf, j, fp)) {
+		return 0;
+	}
+	cf->len--;
+
+	/* There may be room for the victim now. */
+	if (cf->has_victim) {
+		i = cf->victim_i;
+		if (!place(cf, i, cf->victim_fp) ||
+		    !place(cf, alt_bucket(cf, i, cf->victim_fp),
+			   cf->victim_fp)) {
+			cf->has_victim = 0;
+		}
+	}
+	return 1;
+}
+
+void cuckoo_filter_clear(cuckoo_filter_t *cf)
+{
+	assert(cf != NULL);
+
+	memset(cf->fps, 0, (cf->mask + 1) * SLOTS * sizeof(*cf->fps));
+	cf->len = 0;
+	cf->has_victim = 0;
+}
+
+struct htable_filter cuckoo_filter_htable_filter(cuckoo_filter_t *cf)
+{
+	struct htable_filter f;
+
+	assert(cf != NULL);
+
+	f.add = filter_add;
+	f.may_contain = filter_may_contain;
+	f.remove = filter_remove;
+	f.clear = filter_clear;
+	f.ctx = cf;
+	return f;
+}
+
+static unsigned short fingerprint(size_t hash)
+{
+	unsigned short fp;
+
+	fp = (unsigned short)(hash_int_rjenkins_nomult((unsigned long)hash) &
+			      0xFFFFU);
+	return fp ? fp : 1;
+}
+
+static size_t bucket_of(cuckoo_filter_t *cf, size_t hash)
+{
+	return hash_int_multiandxor((unsigned long)hash) & cf->mask;
+}
+
+static size_t alt_bucket(cuckoo_filter_t *cf, size_t i, unsigned short fp)
+{
+	/* An involution: the alternate of the alternate is i again. */
+	return (i ^ hash_int_knuth(fp)) & cf->mask;
+}
+
+static int place(cuckoo_filter_t *cf, size_t i, unsigned short fp)
+{
+	unsigned short *b = &cf->fps[i * SLOTS];
+	size_t k;
+
+	for (k = 0; k < SLOTS; k++) {
+		if (!b[k]) {
+			b[k] = fp;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int take(cuckoo_filter_t *cf, size_t i, unsigned short fp)
+{
+	unsigned short *b = &cf->fps[i * SLOTS];
+	size_t k;
+
+	for (k = 0; k < SLOTS; k++) {
+		if (b[k] == fp) {
+			b[k] = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static unsigned long next_rand(cuckoo_filter_t *cf)
+{
+	cf->rng = (cf->rng * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+	return cf->rng >> 16;
+}
+
+static int find_scalar(const unsigned short *a, const unsigned short *b,
+		       unsigned short fp)
+{
+	size_t k;
+
+	for (k = 0; k < SLOTS; k++) {
+		if (a[k] == fp || b[k] == fp) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#ifdef CPU_X86
+/* Both buckets, as one vector of eight 16-bit slots. */
+__attribute__((target("sse2"))) static int
+find_sse2(const unsigned short *a, const unsigned short *b, unsigned short fp)
+{
+	__m128i slots;
+
+	slots = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)a),
+				   _mm_loadl_epi64((const __m128i *)b));
+	return _mm_movemask_epi8(
+		_mm_cmpeq_epi16(slots, _mm_set1_epi16((short)fp)));
+}
+#endif /* CPU_X86 */
+
+static int find_resolve(const unsigned short *a, const unsigned short *b,
+			unsigned short fp)
+{
+	find_impl = find_scalar;
+#ifdef CPU_X86
+	if (cpu_has(CPU_FEATURE_SSE2)) {
+		find_impl = find_sse2;
+	}
+#endif
+	return find_impl(a, b, fp);
+}
+
+static int filter_add(void *ctx, size_t hash)
+{
+	return cuckoo_filter_add(ctx, hash);
+}
+
+static int filter_may_contain(void *ctx, size_t hash)
+{
+	return cuckoo_filter_may_contain(ctx, hash);
+}
+
+static void filter_remove(void *ctx, size_t hash)
+{
+	cuckoo_filter_remove(ctx, hash);
+}
+
+static void filter_clear(void *ctx)
+{
+	cuckoo_filter_clear(ctx);
+}
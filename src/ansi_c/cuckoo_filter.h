@@ -0,0 +1,52 @@
+#ifndef CUCKOO_FILTER_H
+#define CUCKOO_FILTER_H
+
+/*
+ * A cuckoo filter over key hashes (e.g. from hash.h): a set of 16-bit key
+ * fingerprints, each in one of two buckets of four, that unlike a Bloom
+ * filter supports removal.
+ *
+ * A lookup compares the fingerprint against the eight slots of both buckets,
+ * with SSE2 in one comparison. False positives run to about 8 in 2^16.
+ *
+ * Adding a key already added adds it again, and it must be removed as many
+ * times; removing a key never added may remove another with the same
+ * fingerprint and buckets.
+ */
+
+#include <stddef.h>
+
+#include "htable.h"
+
+/* Most fingerprints moved to make room for one being added. */
+#ifndef CUCKOO_FILTER_MAX_KICKS
+#define CUCKOO_FILTER_MAX_KICKS 500
+#endif
+
+typedef struct cuckoo_filter_t cuckoo_filter_t;
+
+/* Create a filter with room for at least n keys, or return NULL on allocation
+ * failure. Filling it entirely may take slightly more room than that. */
+cuckoo_filter_t *cuckoo_filter_create(size_t n);
+void cuckoo_filter_destroy(cuckoo_filter_t *cf);
+
+size_t cuckoo_filter_len(cuckoo_filter_t *cf);
+
+/* Add a key by its hash. Returns 0 on success, or -1 if the filter is full,
+ * in which case it is unchanged. */
+int cuckoo_filter_add(cuckoo_filter_t *cf, size_t hash);
+
+/* Return 0 if no key with this hash is in the filter, or non-zero if one may
+ * be. */
+int cuckoo_filter_may_contain(cuckoo_filter_t *cf, size_t hash);
+
+/* Remove a key added by its hash. Returns 1 if it was found, 0 otherwise. */
+int cuckoo_filter_remove(cuckoo_filter_t *cf, size_t hash);
+
+void cuckoo_filter_clear(cuckoo_filter_t *cf);
+
+/* A filter for htable_set_filter backed by cf, kept exact under removals.
+ * Sets of new keys fail if cf is full. */
+struct htable_filter cuckoo_filter_htable_filter(cuckoo_filter_t *cf);
+
+#endif /* CUCKOO_FILTER_H */
@@ -0,0 +1,640 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cuckoo_table.h"
+#include "hash.h"
+#include "htable.h"
+
+#define WAYS 4
+
+/* Alignment of the buckets array, a cache line. */
+#define LINE 64
+
+/* Larger tables, each double the last, a set tries before giving up on
+ * placing a key. */
+#define GROW_TRIES 2
+
+/*
+ * A bucket's tags are its keys' hashes, with 0 remapped to 1 so that 0 can
+ * mark a free slot. Values live apart, in the same order, so that a bucket's
+ * tags and keys share a cache line.
+ */
+struct bucket {
+	size_t tags[WAYS];
+	void *keys[WAYS];
+};
+
+struct stash_entry {
+	size_t tag;
+	void *key, *value;
+};
+
+struct cuckoo_table_t {
+	size_t len, min_cap;
+	size_t mask; /* number of buckets - 1, a power of two - 1 */
+	struct bucket *buckets; /* aligned to LINE */
+	void *raw; /* buckets, as allocated */
+	void **values; /* WAYS per bucket */
+
+	struct stash_entry stash[CUCKOO_TABLE_STASH];
+	size_t n_stash;
+
+	htable_cmp_fn cmp_key; /* required */
+	htable_hash_fn hash_key; /* required */
+	htable_destroy_fn destroy_key, destroy_val; /* optional */
+};
+
+/* A bucket a set's search reached, by moving the entry in slot of parent's
+ * bucket. */
+struct bfs_node {
+	size_t bucket;
+	int parent; /* index in the search's queue, or -1 for a key's own */
+	unsigned slot;
+};
+
+/* The tag of the given key. */
+static size_t tag_of(cuckoo_table_t *ct, void *key);
+
+/* The two buckets a tag may be in, which always differ. */
+static void buckets_of(size_t mask, size_t tag, size_t *b1, size_t *b2);
+
+/* The other bucket than b a tag may be in. */
+static size_t other_bucket(size_t mask, size_t tag, size_t b);
+
+/*
+ * Find key, of the given tag. Returns 1 with its slot (bucket * WAYS + way)
+ * in *where if it is in a bucket, 2 with its stash index in *where if it is in
+ * the stash, or 0 if it is in neither.
+ */
+static int find(cuckoo_table_t *ct, void *key, size_t tag, size_t *where);
+
+/*
+ * Allocate buckets and values for nbuckets buckets, all free, into ct's
+ * buckets, raw and values, returning 0, or -1 on allocation failure.
+ */
+static int alloc_buckets(cuckoo_table_t *ct, size_t nbuckets);
+
+/* Place a new entry in a bucket, moving others along the shortest path the
+ * search finds to a free slot, or else in the stash. Returns 0, or -1 if
+ * there was no room. */
+static int place(cuckoo_table_t *ct, size_t tag, void *key, void *value);
+
+/* Move stash entries whose buckets include bucket b into its free slots. */
+static void unstash(cuckoo_table_t *ct, size_t b);
+
+/* Number of entries of the given tag, which are all in its buckets or the
+ * stash. */
+static size_t count_tag(cuckoo_table_t *ct, size_t tag);
+
+/*
+ * Number of entries, with a new one of the given tag, that a table of any
+ * size would have to stash: those of each tag past the 2 * WAYS slots of its
+ * buckets. Only the new entry's tag and those in the stash can have any.
+ */
+static size_t stash_needed(cuckoo_table_t *ct, size_t tag);
+
+/* Re-place every entry, and then the new one, in a table of nbuckets
+ * buckets. Returns 0, or -1 on allocation failure or if they don't fit,
+ * leaving ct as it was. */
+static int rebuild(cuckoo_table_t *ct, size_t nbuckets, size_t tag, void *key,
+		   void *value);
+
+/* Destroy every entry, leaving the table empty. */
+static void destroy_entries(cuckoo_table_t *ct);
+
+/* Number of buckets to start with for the given minimum capacity, or 0 if
+ * too large. */
+static size_t buckets_for_cap(size_t min_cap);
+
+static int is_valid_cuckoo_table(cuckoo_table_t *ct);
+
+cuckoo_table_t *cuckoo_table_create(size_t min_cap, htable_hash_fn hash_key,
+				    htable_cmp_fn cmp_key,
+				    htable_destroy_fn destroy_key,
+				    htable_destroy_fn destroy_val)
+{
+	cuckoo_table_t *ct;
+	size_t nbuckets;
+
+	assert(hash_key != NULL);
+	assert(cmp_key != NULL);
+
+	nbuckets = buckets_for_cap(min_cap);
+	if (!nbuckets) {
+		return NULL;
+	}
+
+	ct = malloc(sizeof(*ct));
+	if (ct == NULL) {
+		return NULL;
+	}
+	if (alloc_buckets(ct, nbuckets)) {
+		free(ct);
+		return NULL;
+	}
+
+	ct->len = 0;
+	ct->min_cap = min_cap;
+	ct->n_stash = 0;
+	ct->cmp_key = cmp_key;
+	ct->hash_key = hash_key;
+	ct->destroy_key = destroy_key;
+	ct->destroy_val = destroy_val;
+
+	return ct;
+}
+
+void cuckoo_table_destroy(cuckoo_table_t *ct)
+{
+	assert(is_valid_cuckoo_table(ct));
+
+	destroy_entries(ct);
+	free(ct->raw);
+	free(ct->values);
+	free(ct);
+}
+
+size_t cuckoo_table_cap(cuckoo_table_t *ct)
+{
+	assert(is_valid_cuckoo_table(ct));
+
+	return (ct->mask + 1) * WAYS + CUCKOO_TABLE_STASH;
+}
+
+size_t cuckoo_table_len(cuckoo_table_t *ct)
+{
+	assert(is_valid_cuckoo_table(ct));
+
+	return ct->len;
+}
+
+int cuckoo_table_clear(cuckoo_table_t *ct)
+{
+	cuckoo_table_t fresh;
+	size_t nbuckets;
+
+	assert(is_valid_cuckoo_table(ct));
+
+	destroy_entries(ct);
+
+	/* Back to the starting size, if that can be had. */
+	nbuckets = buckets_for_cap(ct->min_cap);
+	if (nbuckets < ct->mask + 1 && !alloc_buckets(&fresh, nbuckets)) {
+		free(ct->raw);
+		free(ct->values);
+		ct->raw = fresh.raw;
+		ct->buckets = fresh.buckets;
+		ct->values = fresh.values;
+		ct->mask = fresh.mask;
+	}
+
+	return 0;
+}
+
+int cuckoo_table_contains(cuckoo_table_t *ct, void *key)
+{
+	size_t where;
+
+	assert(is_valid_cuckoo_table(ct));
+
+	return !!find(ct, key, tag_of(ct, key), &where);
+}
+
+void *cuckoo_table_get(cuckoo_table_t *ct, void *key)
+{
+	size_t where;
+
+	assert(is_valid_cuckoo_table(ct));
+
+	switch (find(ct, key, tag_of(ct, key), &where)) {
+	case 1:
+		return ct->values[where];
+	case 2:
+		return ct->stash[where].value;
+	default:
+		return NULL;
+	}
+}
+
+int cuckoo_table_remove(cuckoo_table_t *ct, void *key)
+{
+	struct bucket *b;
+	size_t where;
+	void *k, *v;
+
+	assert(is_valid_cuckoo_table(ct));
+
+	switch (find(ct, key, tag_of(ct, key), &where)) {
+	case 1:
+		b = &ct->buckets[where / WAYS];
+		k = b->keys[where % WAYS];
+		v = ct->values[where];
+		b->tags[where % WAYS] = 0;
+		b->keys[where % WAYS] = NULL;
+		ct->values[where] = NULL;
+		unstash(ct, where / WAYS);
+		break;
+	case 2:
+		k = ct->stash[where].key;
+		v = ct->stash[where].value;
+		ct->stash[where] = ct->stash[--ct->n_stash];
+		break;
+	default:
+		return 0;
+	}
+
+	assert(ct->len);
+	ct->len--;
+	if (ct->destroy_val != NULL) {
+		ct->destroy_val(v);
+	}
+	if (ct->destroy_key != NULL) {
+		ct->destroy_key(k);
+	}
+
+	return 1;
+}
+
+int cuckoo_table_set(cuckoo_table_t *ct, void *key, void *value)
+{
+	size_t tag, where, nbuckets, i;
+
+	assert(is_valid_cuckoo_table(ct));
+
+	tag = tag_of(ct, key);
+	switch (find(ct, key, tag, &where)) {
+	case 1:
+		if (ct->destroy_val != NULL) {
+			ct->destroy_val(ct->values[where]);
+		}
+		ct->buckets[where / WAYS].keys[where % WAYS] = key;
+		ct->values[where] = value;
+		return 1;
+	case 2:
+		if (ct->destroy_val != NULL) {
+			ct->destroy_val(ct->stash[where].value);
+		}
+		ct->stash[where].key = key;
+		ct->stash[where].value = value;
+		return 1;
+	}
+
+	assert(ct->len < (size_t)-1);
+
+	if (!place(ct, tag, key, value)) {
+		ct->len++;
+		return 0;
+	}
+
+	/* Keys sharing a hash share their buckets at any size, so growing
+	 * can't help if those overflowing them don't fit in the stash. */
+	if (stash_needed(ct, tag) > CUCKOO_TABLE_STASH) {
+		return -1;
+	}
+
+	/* Each try rebuilds from the current table, which a failed set so
+	 * leaves as it was. */
+	nbuckets = ct->mask + 1;
+	for (i = 0; i < GROW_TRIES; i++) {
+		if (nbuckets > (size_t)-1 / 2 / WAYS) {
+			return -1;
+		}
+		nbuckets *= 2;
+		if (!rebuild(ct, nbuckets, tag, key, value)) {
+			ct->len++;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static size_t tag_of(cuckoo_table_t *ct, void *key)
+{
+	size_t hash = ct->hash_key(key);
+
+	return hash ? hash : 1;
+}
+
+static void buckets_of(size_t mask, size_t tag, size_t *b1, size_t *b2)
+{
+	*b1 = hash_int_multiandxor((unsigned long)tag) & mask;
+	*b2 = hash_int_rjenkins_nomult((unsigned long)tag) & mask;
+	if (*b2 == *b1) {
+		*b2 = *b1 ^ 1;
+	}
+}
+
+static size_t other_bucket(size_t mask, size_t tag, size_t b)
+{
+	size_t b1, b2;
+
+	buckets_of(mask, tag, &b1, &b2);
+	return b == b1 ? b2 : b1;
+}
+
+static int find(cuckoo_table_t *ct, void *key, size_t tag, size_t *where)
+{
+	size_t b[2], i, j;
+
+	buckets_of(ct->mask, tag, &b[0], &b[1]);
+
+	for (i = 0; i < 2; i++) {
+		struct bucket *bk = &ct->buckets[b[i]];
+
+		for (j = 0; j < WAYS; j++) {
+			if (bk->tags[j] == tag && ct->cmp_key(key, bk->keys[j])) {
+				*where = b[i] * WAYS + j;
+				return 1;
+			}
+		}
+	}
+
+	for (i = 0; i < ct->n_stash; i++) {
+		if (ct->stash[i].tag == tag &&
+		    ct->cmp_key(key, ct->stash[i].key)) {
+			*where = i;
+			return 2;
+		}
+	}
+
+	return 0;
+}
+
+static int alloc_buckets(cuckoo_table_t *ct, size_t nbuckets)
+{
+	assert(nbuckets >= 2 && !(nbuckets & (nbuckets - 1)));
+
+	if (nbuckets > ((size_t)-1 - LINE) / sizeof(struct bucket) ||
+	    nbuckets > (size_t)-1 / WAYS / sizeof(void *)) {
+		return -1;
+	}
+
+	ct->raw = calloc(nbuckets * sizeof(struct bucket) + LINE, 1);
+	if (ct->raw == NULL) {
+		return -1;
+	}
+	ct->values = calloc(nbuckets * WAYS, sizeof(void *));
+	if (ct->values == NULL) {
+		free(ct->raw);
+		return -1;
+	}
+
+	ct->buckets = (struct bucket *)((char *)ct->raw +
+					(LINE - (size_t)ct->raw % LINE));
+	ct->mask = nbuckets - 1;
+	return 0;
+}
+
+static int place(cuckoo_table_t *ct, size_t tag, void *key, void *value)
+{
+	struct bfs_node q[CUCKOO_TABLE_BFS_MAX];
+	size_t head, tail, b1, b2, k, f = 0;
+	int n, p;
+
+	buckets_of(ct->mask, tag, &b1, &b2);
+	q[0].bucket = b1;
+	q[0].parent = -1;
+	q[1].bucket = b2;
+	q[1].parent = -1;
+
+	for (head = 0, tail = 2; head < tail; head++) {
+		struct bucket *b = &ct->buckets[q[head].bucket];
+
+		for (f = 0; f < WAYS && b->tags[f]; f++) {
+		}
+		if (f < WAYS) {
+			break;
+		}
+
+		/* Each entry here could move to its other bucket, unless that
+		 * is already on the path, which moving along would break. */
+		for (k = 0; k < WAYS && tail < CUCKOO_TABLE_BFS_MAX; k++) {
+			size_t alt = other_bucket(ct->mask, b->tags[k],
+						  q[head].bucket);
+
+			for (p = (int)head; p >= 0; p = q[p].parent) {
+				if (q[p].bucket == alt) {
+					break;
+				}
+			}
+			if (p >= 0) {
+				continue;
+			}
+
+			q[tail].bucket = alt;
+			q[tail].parent = (int)head;
+			q[tail].slot = (unsigned)k;
+			tail++;
+		}
+	}
+
+	if (head == tail) {
+		if (ct->n_stash == CUCKOO_TABLE_STASH) {
+			return -1;
+		}
+		ct->stash[ct->n_stash].tag = tag;
+		ct->stash[ct->n_stash].key = key;
+		ct->stash[ct->n_stash].value = value;
+		ct->n_stash++;
+		return 0;
+	}
+
+	/* Free slot f of the last bucket on the path: move each entry along,
+	 * from the end, into the slot freed by the one after it. */
+	for (n = (int)head; q[n].parent >= 0; n = q[n].parent) {
+		struct bucket *dst = &ct->buckets[q[n].bucket];
+		struct bucket *src = &ct->buckets[q[q[n].parent].bucket];
+		size_t s = q[n].slot;
+
+		dst->tags[f] = src->tags[s];
+		dst->keys[f] = src->keys[s];
+		ct->values[q[n].bucket * WAYS + f] =
+			ct->values[q[q[n].parent].bucket * WAYS + s];
+		f = s;
+	}
+
+	ct->buckets[q[n].bucket].tags[f] = tag;
+	ct->buckets[q[n].bucket].keys[f] = key;
+	ct->values[q[n].bucket * WAYS + f] = value;
+	return 0;
+}
+
+static void unstash(cuckoo_table_t *ct, size_t b)
+{
+	struct bucket *bk = &ct->buckets[b];
+	size_t i, j, b1, b2;
+
+	for (i = 0; i < ct->n_stash;) {
+		buckets_of(ct->mask, ct->stash[i].tag, &b1, &b2);
+		if (b1 != b && b2 != b) {
+			i++;
+			continue;
+		}
+
+		for (j = 0; j < WAYS && bk->tags[j]; j++) {
+		}
+		if (j == WAYS) {
+			return;
+		}
+		bk->tags[j] = ct->stash[i].tag;
+		bk->keys[j] = ct->stash[i].key;
+		ct->values[b * WAYS + j] = ct->stash[i].value;
+		ct->stash[i] = ct->stash[--ct->n_stash];
+	}
+}
+
+static size_t count_tag(cuckoo_table_t *ct, size_t tag)
+{
+	size_t b[2], i, j, n = 0;
+
+	buckets_of(ct->mask, tag, &b[0], &b[1]);
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < WAYS; j++) {
+			n += ct->buckets[b[i]].tags[j] == tag;
+		}
+	}
+	for (i = 0; i < ct->n_stash; i++) {
+		n += ct->stash[i].tag == tag;
+	}
+
+	return n;
+}
+
+static size_t stash_needed(cuckoo_table_t *ct, size_t tag)
+{
+	size_t i, j, n, need;
+
+	n = count_tag(ct, tag) + 1;
+	need = n > 2 * WAYS ? n - 2 * WAYS : 0;
+
+	for (i = 0; i < ct->n_stash; i++) {
+		size_t t = ct->stash[i].tag;
+
+		/* each tag once, the new entry's already */
+		for (j = 0; j < i && ct->stash[j].tag != t; j++) {
+		}
+		if (j < i || t == tag) {
+			continue;
+		}
+
+		n = count_tag(ct, t);
+		need += n > 2 * WAYS ? n - 2 * WAYS : 0;
+	}
+
+	return need;
+}
+
+static int rebuild(cuckoo_table_t *ct, size_t nbuckets, size_t tag, void *key,
+		   void *value)
+{
+	cuckoo_table_t new_ct;
+	size_t i;
+
+	new_ct = *ct;
+	if (alloc_buckets(&new_ct, nbuckets)) {
+		return -1;
+	}
+	new_ct.n_stash = 0;
+
+	for (i = 0; i <= ct->mask * WAYS + WAYS - 1; i++) {
+		struct bucket *b = &ct->buckets[i / WAYS];
+
+		if (b->tags[i % WAYS] &&
+		    place(&new_ct, b->tags[i % WAYS], b->keys[i % WAYS],
+			  ct->values[i])) {
+			goto fail;
+		}
+	}
+	for (i = 0; i < ct->n_stash; i++) {
+		if (place(&new_ct, ct->stash[i].tag, ct->stash[i].key,
+			  ct->stash[i].value)) {
+			goto fail;
+		}
+	}
+	if (place(&new_ct, tag, key, value)) {
+		goto fail;
+	}
+
+	free(ct->raw);
+	free(ct->values);
+	*ct = new_ct;
+	return 0;
+fail:
+	free(new_ct.raw);
+	free(new_ct.values);
+	return -1;
+}
+
+static void destroy_entries(cuckoo_table_t *ct)
+{
+	size_t i;
+
+	for (i = 0; ct->len && i <= ct->mask * WAYS + WAYS - 1; i++) {
+		struct bucket *b = &ct->buckets[i / WAYS];
+
+		if (!b->tags[i % WAYS]) {
+			continue;
+		}
+		if (ct->destroy_val != NULL) {
+			ct->destroy_val(ct->values[i]);
+		}
+		if (ct->destroy_key != NULL) {
+			ct->destroy_key(b->keys[i % WAYS]);
+		}
+		b->tags[i % WAYS] = 0;
+		b->keys[i % WAYS] = NULL;
+		ct->values[i] = NULL;
+		ct->len--;
+	}
+	for (i = 0; i < ct->n_stash; i++) {
+		if (ct->destroy_val != NULL) {
+			ct->destroy_val(ct->stash[i].value);
+		}
+		if (ct->destroy_key != NULL) {
+			ct->destroy_key(ct->stash[i].key);
+		}
+		ct->len--;
+	}
+	ct->n_stash = 0;
+	assert(!ct->len);
+}
+
+static size_t buckets_for_cap(size_t min_cap)
+{
+	size_t nbuckets;
+
+	for (nbuckets = 2; nbuckets * WAYS < min_cap; nbuckets <<= 1) {
+		if (nbuckets > (size_t)-1 / 2 / WAYS) {
+			return 0;
+		}
+	}
+	return nbuckets;
+}
+
+static int is_valid_cuckoo_table(cuckoo_table_t *ct)
+{
+	if (ct == NULL) {
+		return 0;
+	}
+
+	if (ct->buckets == NULL || ct->values == NULL) {
+		return 0;
+	}
+
+	if (ct->n_stash > CUCKOO_TABLE_STASH) {
+		return 0;
+	}
+
+	if (ct->len > (ct->mask + 1) * WAYS + ct->n_stash) {
+		return 0;
+	}
+
+	if (ct->hash_key == NULL || ct->cmp_key == NULL) {
+		return 0;
+	}
+
+	return 1;
+}
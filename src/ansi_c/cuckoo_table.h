@@ -0,0 +1,53 @@
+#ifndef CUCKOO_TABLE_H
+#define CUCKOO_TABLE_H
+
+/*
+ * A bucketized cuckoo hash table, shaped like htable_t but with a hard bound
+ * on lookups: a key is in one of two 4-way buckets, chosen by two hashes
+ * (from hash.h) of the key's hash, or in a small stash. A lookup checks both
+ * buckets, whose hashes and keys fill one 64-byte line each (on LP64 systems),
+ * and the stash.
+ *
+ * Sets make room by moving keys to their other bucket along the shortest path
+ * found by a breadth-first search, using the stash when there is none, and
+ * grow the table only when neither works - so tables fill to load factors
+ * above 0.9. A table doesn't shrink, except when cleared.
+ *
+ * Up to 8 + CUCKOO_TABLE_STASH keys may share a hash, fewer when other hashes
+ * are shared by more than 8, as the stash takes those past 8 of each; sets of
+ * more fail without growing the table. A failed set leaves the table as it
+ * was.
+ */
+
+#include <stddef.h>
+
+#include "htable.h" /* for the callback types */
+
+/* Entries kept aside when no bucket can take them. */
+#ifndef CUCKOO_TABLE_STASH
+#define CUCKOO_TABLE_STASH 4
+#endif
+
+/* Most buckets a set's breadth-first search visits. */
+#ifndef CUCKOO_TABLE_BFS_MAX
+#define CUCKOO_TABLE_BFS_MAX 256
+#endif
+
+typedef struct cuckoo_table_t cuckoo_table_t;
+
+cuckoo_table_t *cuckoo_table_create(size_t min_cap, htable_hash_fn hash_key,
+				    htable_cmp_fn cmp_key,
+				    htable_destroy_fn destroy_key,
+				    htable_destroy_fn destroy_val);
+void cuckoo_table_destroy(cuckoo_table_t *ct);
+
+size_t cuckoo_table_cap(cuckoo_table_t *ct);
+size_t cuckoo_table_len(cuckoo_table_t *ct);
+
+int cuckoo_table_clear(cuckoo_table_t *ct);
+int cuckoo_table_contains(cuckoo_table_t *ct, void *key);
+void *cuckoo_table_get(cuckoo_table_t *ct, void *key);
+int cuckoo_table_remove(cuckoo_table_t *ct, void *key);
+int cuckoo_table_set(cuckoo_table_t *ct, void *key, void *value);
+
+#endif /* CUCKOO_TABLE_H */
@@ -1,7 +1,78 @@
+#include <limits.h>
 #include <stddef.h>
+#include <string.h>
 
+#include "cpu.h"
 #include "hash.h"
 
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#if !defined(CPU_NO_SIMD) && defined(__GNUC__) && \
+	defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+/* CRC32C's polynomial, bit-reflected. */
+#define CRC32C_POLY 0x82f63b78UL
+
+/* CRC words hold 32 bits each, whatever their size. */
+#if UINT_MAX >= 0xFFFFFFFFUL
+typedef unsigned int crc_t;
+#else
+typedef unsigned long crc_t;
+#endif
+
+/* Slicing-by-8 tables: crc_tables[0] is the bytewise table, and
+ * crc_tables[k] that of a byte followed by k zero bytes. */
+static crc_t crc_tables[8][256];
+
+static void crc_tables_init(void);
+
+/* Implementations of the CRC32C update of crc by len bytes at p, pre- and
+ * post-conditioning left to the caller. */
+static crc_t crc32c_slice8(crc_t crc, const unsigned char *p, size_t len);
+#ifdef CPU_X86
+static crc_t crc32c_sse42(crc_t crc, const unsigned char *p, size_t len);
+#endif
+#ifdef CRC32C_ARM
+static crc_t crc32c_arm(crc_t crc, const unsigned char *p, size_t len);
+#endif
+
+/* Pick the best implementation for the running CPU on first use. */
+static crc_t crc32c_resolve(crc_t crc, const unsigned char *p, size_t len);
+
+static crc_t (*crc32c_impl)(crc_t crc, const unsigned char *p,
+			    size_t len) = crc32c_resolve;
+
+#ifdef HASH_HAVE_XXH64
+#define XXH_P1 0x9E3779B185EBCA87UL
+#define XXH_P2 0xC2B2AE3D27D4EB4FUL
+#define XXH_P3 0x165667B19E3779F9UL
+#define XXH_P4 0x85EBCA77C2B2AE63UL
+#define XXH_P5 0x27D4EB2F165667C5UL
+
+#define ROTL64(x, r) ((x) << (r) | (x) >> (64 - (r)))
+
+/* Read a little-endian word of 64 or 32 bits. */
+static unsigned long read64(const unsigned char *p);
+static unsigned long read32(const unsigned char *p);
+
+static unsigned long xxh64_round(unsigned long acc, unsigned long input);
+
+/* Take the nblocks 32-byte blocks at p into the accumulators. */
+static void xxh64_blocks(unsigned long acc[4], const unsigned char *p,
+			 size_t nblocks);
+
+/* The hash of total bytes, from the accumulators (unused if total is under a
+ * block) and the len (under a block) at p left after the blocks. */
+static unsigned long xxh64_finish(const unsigned long acc[4],
+				  unsigned long total, const unsigned char *p,
+				  size_t len);
+#endif /* HASH_HAVE_XXH64 */
+
 size_t hash_int_rjenkins_nomult(unsigned long key)
 {
 	size_t hash = key;
@@ -64,3 +135,345 @@ size_t hash_cstring_fnv_1a(const char *s)
 	}
 	return hash;
 }
+
+size_t hash_bytes_djb2(const void *p, size_t len)
+{
+	const char *s = p;
+	size_t hash, i;
+
+	hash = 5381;
+	for (i = 0; i < len; i++) {
+		/* same (possibly sign-extending) conversion as the cstring
+		 * version, so the two agree */
+		hash = ((hash << 5) + hash) + (unsigned)s[i];
+	}
+	return hash;
+}
+
+size_t hash_bytes_fnv_1a(const void *p, size_t len)
+{
+	const unsigned char *s = p;
+	size_t hash, i;
+
+	hash = 2166136261UL;
+	for (i = 0; i < len; i++) {
+		hash ^= s[i];
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+size_t hash_bytes_crc32c(const void *p, size_t len)
+{
+	return (size_t)(~crc32c_impl(~(crc_t)0, p, len) & 0xFFFFFFFFUL);
+}
+
+size_t hash_cstring_crc32c(const char *s)
+{
+	return hash_bytes_crc32c(s, strlen(s));
+}
+
+#ifdef HASH_HAVE_XXH64
+size_t hash_bytes_xxh64(const void *p, size_t len)
+{
+	unsigned long acc[4];
+	size_t nblocks = len / 32;
+
+	acc[0] = XXH_P1 + XXH_P2;
+	acc[1] = XXH_P2;
+	acc[2] = 0;
+	acc[3] = 0 - XXH_P1;
+	xxh64_blocks(acc, p, nblocks);
+
+	return (size_t)xxh64_finish(acc, (unsigned long)len,
+				    (const unsigned char *)p + nblocks * 32,
+				    len % 32);
+}
+
+size_t hash_cstring_xxh64(const char *s)
+{
+	return hash_bytes_xxh64(s, strlen(s));
+}
+#endif /* HASH_HAVE_XXH64 */
+
+void hash_state_init(struct hash_state *st, enum hash_algo algo)
+{
+	st->algo = algo;
+	switch (algo) {
+	case HASH_ALGO_DJB2:
+		st->hash = 5381;
+		break;
+	case HASH_ALGO_FNV_1A:
+		st->hash = 2166136261UL;
+		break;
+	case HASH_ALGO_CRC32C:
+		st->hash = 0xFFFFFFFFUL;
+		break;
+#ifdef HASH_HAVE_XXH64
+	case HASH_ALGO_XXH64:
+		st->acc[0] = XXH_P1 + XXH_P2;
+		st->acc[1] = XXH_P2;
+		st->acc[2] = 0;
+		st->acc[3] = 0 - XXH_P1;
+		st->total = 0;
+		st->buffered = 0;
+		break;
+#endif
+	}
+}
+
+void hash_state_update(struct hash_state *st, const void *p, size_t len)
+{
+	const unsigned char *s = p;
+	const char *c = p;
+	size_t hash, i;
+
+	switch (st->algo) {
+	case HASH_ALGO_DJB2:
+		hash = st->hash;
+		for (i = 0; i < len; i++) {
+			/* as hash_bytes_djb2 */
+			hash = ((hash << 5) + hash) + (unsigned)c[i];
+		}
+		st->hash = hash;
+		break;
+	case HASH_ALGO_FNV_1A:
+		hash = st->hash;
+		for (i = 0; i < len; i++) {
+			hash ^= s[i];
+			hash *= 16777619UL;
+		}
+		st->hash = hash;
+		break;
+	case HASH_ALGO_CRC32C:
+		st->hash = (size_t)crc32c_impl((crc_t)st->hash, s, len);
+		break;
+#ifdef HASH_HAVE_XXH64
+	case HASH_ALGO_XXH64:
+		st->total += (unsigned long)len;
+
+		/* Finish a block begun by the last update first. */
+		if (st->buffered) {
+			i = 32 - st->buffered;
+			if (len < i) {
+				memcpy(st->buf + st->buffered, s, len);
+				st->buffered += len;
+				break;
+			}
+			memcpy(st->buf + st->buffered, s, i);
+			xxh64_blocks(st->acc, st->buf, 1);
+			st->buffered = 0;
+			s += i;
+			len -= i;
+		}
+
+		xxh64_blocks(st->acc, s, len / 32);
+		memcpy(st->buf, s + len / 32 * 32, len % 32);
+		st->buffered = len % 32;
+		break;
+#endif
+	}
+}
+
+size_t hash_state_final(const struct hash_state *st)
+{
+	switch (st->algo) {
+	case HASH_ALGO_DJB2:
+	case HASH_ALGO_FNV_1A:
+		return st->hash;
+	case HASH_ALGO_CRC32C:
+		return (size_t)(~(crc_t)st->hash & 0xFFFFFFFFUL);
+#ifdef HASH_HAVE_XXH64
+	case HASH_ALGO_XXH64:
+		return (size_t)xxh64_finish(st->acc, st->total, st->buf,
+					    st->buffered);
+#endif
+	}
+	return 0;
+}
+
+static void crc_tables_init(void)
+{
+	crc_t c;
+	size_t i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = (crc_t)i;
+		for (j = 0; j < 8; j++) {
+			c = (c >> 1) ^ (c & 1 ? CRC32C_POLY : 0);
+		}
+		crc_tables[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		c = crc_tables[0][i];
+		for (j = 1; j < 8; j++) {
+			c = (c >> 8) ^ crc_tables[0][c & 0xFF];
+			crc_tables[j][i] = c;
+		}
+	}
+}
+
+static crc_t crc32c_slice8(crc_t crc, const unsigned char *p, size_t len)
+{
+	crc &= 0xFFFFFFFFUL;
+
+	/* Eight bytes at a time: the four XORed into the CRC, and the four
+	 * after them, each through the table for its distance from the end. */
+	for (; len >= 8; p += 8, len -= 8) {
+		crc ^= (crc_t)p[0] | (crc_t)p[1] << 8 | (crc_t)p[2] << 16 |
+		       (crc_t)p[3] << 24;
+		crc = crc_tables[7][crc & 0xFF] ^
+		      crc_tables[6][(crc >> 8) & 0xFF] ^
+		      crc_tables[5][(crc >> 16) & 0xFF] ^
+		      crc_tables[4][crc >> 24] ^ crc_tables[3][p[4]] ^
+		      crc_tables[2][p[5]] ^ crc_tables[1][p[6]] ^
+		      crc_tables[0][p[7]];
+	}
+	for (; len; p++, len--) {
+		crc = (crc >> 8) ^ crc_tables[0][(crc ^ *p) & 0xFF];
+	}
+	return crc;
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse4.2"))) static crc_t
+crc32c_sse42(crc_t crc, const unsigned char *p, size_t len)
+{
+	unsigned int c = (unsigned int)crc;
+
+#if defined(__x86_64__) && !defined(_WIN32)
+	unsigned long w; /* 64 bits */
+
+	for (; len >= 8; p += 8, len -= 8) {
+		memcpy(&w, p, 8);
+		c = (unsigned int)_mm_crc32_u64(c, w);
+	}
+#endif
+	for (; len >= 4; p += 4, len -= 4) {
+		unsigned int w4;
+
+		memcpy(&w4, p, 4);
+		c = _mm_crc32_u32(c, w4);
+	}
+	for (; len; p++, len--) {
+		c = _mm_crc32_u8(c, *p);
+	}
+	return c;
+}
+#endif /* CPU_X86 */
+
+#ifdef CRC32C_ARM
+static crc_t crc32c_arm(crc_t crc, const unsigned char *p, size_t len)
+{
+	unsigned int c = (unsigned int)crc;
+	unsigned int w4;
+
+	for (; len >= 4; p += 4, len -= 4) {
+		memcpy(&w4, p, 4);
+		c = __crc32cw(c, w4);
+	}
+	for (; len; p++, len--) {
+		c = __crc32cb(c, *p);
+	}
+	return c;
+}
+#endif /* CRC32C_ARM */
+
+static crc_t crc32c_resolve(crc_t crc, const unsigned char *p, size_t len)
+{
+#if defined(CRC32C_ARM)
+	crc32c_impl = crc32c_arm;
+#else
+	crc_tables_init();
+	crc32c_impl = crc32c_slice8;
+#ifdef CPU_X86
+	if (cpu_has(CPU_FEATURE_SSE42)) {
+		crc32c_impl = crc32c_sse42;
+	}
+#endif
+#endif
+	return crc32c_impl(crc, p, len);
+}
+
+#ifdef HASH_HAVE_XXH64
+static unsigned long read64(const unsigned char *p)
+{
+	return (unsigned long)p[0] | (unsigned long)p[1] << 8 |
+	       (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24 |
+	       (unsigned long)p[4] << 32 | (unsigned long)p[5] << 40 |
+	       (unsigned long)p[6] << 48 | (unsigned long)p[7] << 56;
+}
+
+static unsigned long read32(const unsigned char *p)
+{
+	return (unsigned long)p[0] | (unsigned long)p[1] << 8 |
+	       (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned long xxh64_round(unsigned long acc, unsigned long input)
+{
+	acc += input * XXH_P2;
+	acc = ROTL64(acc, 31);
+	return acc * XXH_P1;
+}
+
+static void xxh64_blocks(unsigned long acc[4], const unsigned char *p,
+			 size_t nblocks)
+{
+	unsigned long a0 = acc[0], a1 = acc[1], a2 = acc[2], a3 = acc[3];
+
+	/* Four independent lanes, for the CPU to overlap. */
+	for (; nblocks; p += 32, nblocks--) {
+		a0 = xxh64_round(a0, read64(p));
+		a1 = xxh64_round(a1, read64(p + 8));
+		a2 = xxh64_round(a2, read64(p + 16));
+		a3 = xxh64_round(a3, read64(p + 24));
+	}
+	acc[0] = a0;
+	acc[1] = a1;
+	acc[2] = a2;
+	acc[3] = a3;
+}
+
+static unsigned long xxh64_finish(const unsigned long acc[4],
+				  unsigned long total, const unsigned char *p,
+				  size_t len)
+{
+	unsigned long h;
+	size_t i;
+
+	if (total >= 32) {
+		h = ROTL64(acc[0], 1) + ROTL64(acc[1], 7) + ROTL64(acc[2], 12) +
+		    ROTL64(acc[3], 18);
+		for (i = 0; i < 4; i++) {
+			h ^= xxh64_round(0, acc[i]);
+			h = h * XXH_P1 + XXH_P4;
+		}
+	} else {
+		h = XXH_P5;
+	}
+	h += total;
+
+	for (; len >= 8; p += 8, len -= 8) {
+		h ^= xxh64_round(0, read64(p));
+		h = ROTL64(h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (len >= 4) {
+		h ^= read32(p) * XXH_P1;
+		h = ROTL64(h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+		len -= 4;
+	}
+	for (; len; p++, len--) {
+		h ^= *p * XXH_P5;
+		h = ROTL64(h, 11) * XXH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+#endif /* HASH_HAVE_XXH64 */
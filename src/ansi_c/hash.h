@@ -3,8 +3,15 @@
 
 /* A collection of hashing functions for various cases. */
 
+#include <limits.h> /* for ULONG_MAX */
 #include <stddef.h> /* for size_t */
 
+/* XXH64 needs 64-bit arithmetic, which C90 only has if unsigned long is 64
+ * bits. */
+#if (ULONG_MAX >> 31 >> 31) == 3
+#define HASH_HAVE_XXH64 1
+#endif
+
 /*
 An integer hash method with good distribution consisting entirely of adds,
 shifts, and xors.
@@ -54,4 +61,68 @@ size_t hash_cstring_djb2(const char *s);
  */
 size_t hash_cstring_fnv_1a(const char *s);
 
+/*
+ * Length-taking counterparts of the string hashes above, for keys that are not
+ * NUL-terminated or may contain NULs. Hashing the bytes of a string (without
+ * its terminator) gives the same result as the cstring version.
+ */
+size_t hash_bytes_djb2(const void *p, size_t len);
+size_t hash_bytes_fnv_1a(const void *p, size_t len);
+
+/*
+ * CRC32C (Castagnoli), a 32-bit hash with good distribution for short keys
+ * that x86 CPUs with SSE4.2, and ARMv8 CPUs with the CRC extension, compute in
+ * hardware. The hardware path is chosen on first use (see cpu.h), or at
+ * compile time on ARM; elsewhere a table-driven slicing-by-8 version is used.
+ * Every path gives the same result, the standard CRC32C of the bytes.
+ */
+size_t hash_bytes_crc32c(const void *p, size_t len);
+size_t hash_cstring_crc32c(const char *s);
+
+#ifdef HASH_HAVE_XXH64
+/*
+ * XXH64 (with a seed of 0), a fast hash of good repute for keys of any
+ * length, taking 32-byte blocks four words at a time. Only where unsigned long
+ * has 64 bits; see HASH_HAVE_XXH64.
+ *
+ * Taken from the specification at
+ * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ */
+size_t hash_bytes_xxh64(const void *p, size_t len);
+size_t hash_cstring_xxh64(const char *s);
+#endif
+
+/* The hashes above that take bytes, for hash_state. */
+enum hash_algo {
+#ifdef HASH_HAVE_XXH64
+	HASH_ALGO_XXH64,
+#endif
+	HASH_ALGO_DJB2,
+	HASH_ALGO_FNV_1A,
+	HASH_ALGO_CRC32C
+};
+
+/*
+ * The state of a hash of bytes fed in pieces, for keys that arrive in chunks
+ * or are made of several fields: hashing the pieces in turn gives the same
+ * result as the hash_bytes_ function of the same algorithm does for them laid
+ * end to end, without having to lay them out.
+ */
+struct hash_state {
+	enum hash_algo algo;
+	size_t hash; /* djb2, FNV-1a, and CRC32C (not yet post-conditioned) */
+#ifdef HASH_HAVE_XXH64
+	unsigned long acc[4], total;
+	unsigned char buf[32]; /* less than a block, not yet taken */
+	size_t buffered;
+#endif
+};
+
+void hash_state_init(struct hash_state *st, enum hash_algo algo);
+void hash_state_update(struct hash_state *st, const void *p, size_t len);
+
+/* The hash of the bytes so far. The state is left as it was, so more can be
+ * fed to it after: a common prefix need only be hashed once. */
+size_t hash_state_final(const struct hash_state *st);
+
 #endif /* HASH_H */
@@ -0,0 +1,500 @@
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hll.h"
+
+/* Precision of the sparse list: its codes are a register at this precision,
+ * shifted up by RANK_BITS, ORed with its rank. */
+#define SPARSE_P 25
+#define RANK_BITS 6
+
+/* Codes the sparse list starts with room for. */
+#define SPARSE_MIN 16
+
+/* Hashes hll_add_many takes at a time. */
+#define BLOCK 64
+
+/* Bits of hash used, at most 64 so that ranks fit RANK_BITS. */
+#define HASH_BITS \
+	(sizeof(size_t) * CHAR_BIT < 64 ? sizeof(size_t) * CHAR_BIT : 64)
+
+struct hll_t {
+	unsigned p;
+	unsigned char *regs; /* 2^p, or NULL while sparse */
+
+	/* Sorted up to n_sorted, with one code per register up to there. */
+	unsigned long *sparse;
+	size_t n_sparse, n_sorted, cap_sparse;
+};
+
+/*
+ * The finalizer of hash_int_multiandxor, spreading a hash's entropy over all
+ * of its bits. Kept here, rather than called, so that it inlines into the
+ * loop of hll_add_many.
+ */
+static size_t mix(size_t hash);
+
+/* Number of set bits of x, without branches or lookups. */
+static unsigned popcount(size_t x);
+
+/* One more than the number of trailing zeros of w, at most max. */
+static unsigned rank_of(size_t w, unsigned max);
+
+/* The sparse code of a mixed hash. */
+static unsigned long code_of(size_t h);
+
+/* Raise the register a sparse code is for, among regs of precision p. */
+static void apply_code(unsigned char *regs, unsigned p, unsigned long code);
+
+/* Add a sparse code, compacting the list, growing it, or turning the sketch
+ * dense as needed. Returns 0, or -1 on allocation failure. */
+static int add_code(hll_t *hll, unsigned long code);
+
+/* Sort the sparse list and keep only the highest code of each register. */
+static void compact(hll_t *hll);
+
+/* Sort and dedup codes, returning the number left. */
+static size_t sort_codes(unsigned long *codes, size_t n);
+
+static int cmp_codes(const void *a, const void *b);
+
+/* Registers holding the sparse list's codes, or NULL on allocation
+ * failure. */
+static unsigned char *regs_of_sparse(hll_t *hll);
+
+/* Turn a sparse sketch dense. Returns 0, or -1 on allocation failure. */
+static int densify(hll_t *hll);
+
+/* Ertl's sigma and tau functions, over the fraction of registers that are
+ * 0, and that hold the highest rank. */
+static double sigma(double x);
+static double tau(double x);
+
+hll_t *hll_create(unsigned p)
+{
+	hll_t *hll;
+
+	if (p < HLL_P_MIN || p > HLL_P_MAX) {
+		return NULL;
+	}
+
+	hll = malloc(sizeof(*hll));
+	if (hll == NULL) {
+		return NULL;
+	}
+	hll->p = p;
+	hll->regs = NULL;
+	hll->sparse = NULL;
+	hll->n_sparse = hll->n_sorted = hll->cap_sparse = 0;
+
+	/* Sparse only while the list is smaller than the registers, and its
+	 * codes fit what the hashes give. */
+	if (HASH_BITS > SPARSE_P &&
+	    SPARSE_MIN * sizeof(unsigned long) < (size_t)1 << p) {
+		hll->sparse = malloc(SPARSE_MIN * sizeof(unsigned long));
+		hll->cap_sparse = SPARSE_MIN;
+	} else {
+		hll->regs = calloc((size_t)1 << p, 1);
+	}
+	if (hll->sparse == NULL && hll->regs == NULL) {
+		free(hll);
+		return NULL;
+	}
+
+	return hll;
+}
+
+void hll_destroy(hll_t *hll)
+{
+	assert(hll != NULL);
+
+	free(hll->regs);
+	free(hll->sparse);
+	free(hll);
+}
+
+size_t hll_size(hll_t *hll)
+{
+	assert(hll != NULL);
+
+	if (hll->regs != NULL) {
+		return (size_t)1 << hll->p;
+	}
+	return hll->cap_sparse * sizeof(unsigned long);
+}
+
+int hll_add(hll_t *hll, size_t hash)
+{
+	size_t h;
+
+	assert(hll != NULL);
+
+	h = mix(hash);
+	if (hll->regs == NULL) {
+		return add_code(hll, code_of(h));
+	}
+
+	apply_code(hll->regs, hll->p, code_of(h));
+	return 0;
+}
+
+int hll_add_many(hll_t *hll, const size_t *hashes, size_t n)
+{
+	size_t idx[BLOCK], mask, i, k;
+	unsigned char rank[BLOCK];
+	unsigned max;
+
+	assert(hll != NULL);
+	assert(hashes != NULL || !n);
+
+	for (; n && hll->regs == NULL; hashes++, n--) {
+		if (hll_add(hll, *hashes)) {
+			return -1;
+		}
+	}
+
+	mask = ((size_t)1 << hll->p) - 1;
+	max = HASH_BITS - hll->p + 1;
+	for (; n; hashes += k, n -= k) {
+		k = n < BLOCK ? n : BLOCK;
+
+		/* Registers and ranks, all at once; then their updates, which
+		 * may collide, one by one. */
+		for (i = 0; i < k; i++) {
+			size_t h = mix(hashes[i]);
+
+			idx[i] = h & mask;
+			rank[i] = (unsigned char)rank_of(h >> hll->p, max);
+		}
+		for (i = 0; i < k; i++) {
+			if (hll->regs[idx[i]] < rank[i]) {
+				hll->regs[idx[i]] = rank[i];
+			}
+		}
+	}
+
+	return 0;
+}
+
+double hll_count(hll_t *hll)
+{
+	size_t hist[64 + 2], m, i;
+	unsigned q;
+	double z;
+
+	assert(hll != NULL);
+
+	/* Linear counting, over the registers of the sparse precision. */
+	if (hll->regs == NULL) {
+		double mp = (double)((unsigned long)1 << SPARSE_P);
+
+		compact(hll);
+		return mp * log(mp / (mp - (double)hll->n_sparse));
+	}
+
+	m = (size_t)1 << hll->p;
+	q = HASH_BITS - hll->p;
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < m; i++) {
+		hist[hll->regs[i]]++;
+	}
+	if (hist[0] == m) {
+		return 0;
+	}
+
+	z = (double)m * tau(1 - (double)hist[q + 1] / (double)m);
+	for (i = q; i >= 1; i--) {
+		z = 0.5 * (z + (double)hist[i]);
+	}
+	z += (double)m * sigma((double)hist[0] / (double)m);
+
+	/* alpha_inf = 1 / (2 ln 2) */
+	return 0.72134752044448170368 * (double)m * (double)m / z;
+}
+
+int hll_merge(hll_t *dst, hll_t *src)
+{
+	unsigned long *codes;
+	unsigned char *regs;
+	size_t m, i, n;
+
+	assert(dst != NULL);
+	assert(src != NULL);
+
+	if (dst->p != src->p) {
+		return -1;
+	}
+	m = (size_t)1 << dst->p;
+
+	if (dst->regs != NULL && src->regs != NULL) {
+		for (i = 0; i < m; i++) {
+			if (dst->regs[i] < src->regs[i]) {
+				dst->regs[i] = src->regs[i];
+			}
+		}
+		return 0;
+	}
+
+	if (dst->regs != NULL) {
+		for (i = 0; i < src->n_sparse; i++) {
+			apply_code(dst->regs, dst->p, src->sparse[i]);
+		}
+		return 0;
+	}
+
+	if (src->regs != NULL) {
+		regs = regs_of_sparse(dst);
+		if (regs == NULL) {
+			return -1;
+		}
+		for (i = 0; i < m; i++) {
+			if (regs[i] < src->regs[i]) {
+				regs[i] = src->regs[i];
+			}
+		}
+		free(dst->sparse);
+		dst->sparse = NULL;
+		dst->n_sparse = dst->n_sorted = dst->cap_sparse = 0;
+		dst->regs = regs;
+		return 0;
+	}
+
+	/* Both sparse: the union of the lists, kept sparse if it is still
+	 * smaller than the registers. */
+	if (!src->n_sparse) {
+		return 0;
+	}
+	n = dst->n_sparse + src->n_sparse;
+	codes = malloc(n * sizeof(unsigned long));
+	if (codes == NULL) {
+		return -1;
+	}
+	memcpy(codes, dst->sparse, dst->n_sparse * sizeof(unsigned long));
+	memcpy(codes + dst->n_sparse, src->sparse,
+	       src->n_sparse * sizeof(unsigned long));
+	n = sort_codes(codes, n);
+
+	if (n * sizeof(unsigned long) < m) {
+		free(dst->sparse);
+		dst->sparse = codes;
+		dst->n_sparse = dst->n_sorted = dst->cap_sparse = n;
+		return 0;
+	}
+
+	regs = calloc(m, 1);
+	if (regs == NULL) {
+		free(codes);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		apply_code(regs, dst->p, codes[i]);
+	}
+	free(codes);
+	free(dst->sparse);
+	dst->sparse = NULL;
+	dst->n_sparse = dst->n_sorted = dst->cap_sparse = 0;
+	dst->regs = regs;
+	return 0;
+}
+
+void hll_clear(hll_t *hll)
+{
+	assert(hll != NULL);
+
+	if (hll->regs != NULL) {
+		memset(hll->regs, 0, (size_t)1 << hll->p);
+	}
+	hll->n_sparse = hll->n_sorted = 0;
+}
+
+static size_t mix(size_t hash)
+{
+	hash ^= (hash >> 16) >> 16;
+	hash *= 0x85ebca6bUL;
+	hash ^= (hash >> 13);
+	hash *= 0xc2b2ae35UL;
+	hash ^= (hash >> 16);
+
+	return hash;
+}
+
+static unsigned popcount(size_t x)
+{
+	const size_t ones = (size_t)-1;
+
+	x = x - ((x >> 1) & ones / 3);
+	x = (x & ones / 15 * 3) + ((x >> 2) & ones / 15 * 3);
+	x = (x + (x >> 4)) & ones / 255 * 15;
+	return (unsigned)((x * (ones / 255)) >>
+			  (sizeof(size_t) - 1) * CHAR_BIT);
+}
+
+static unsigned rank_of(size_t w, unsigned max)
+{
+	unsigned r;
+
+	/* The bits below w's lowest set bit; all of them when w is 0. */
+	r = popcount((w & (~w + 1)) - 1) + 1;
+	return r < max ? r : max;
+}
+
+static unsigned long code_of(size_t h)
+{
+	unsigned long reg, rank;
+
+	reg = (unsigned long)h & (((unsigned long)1 << SPARSE_P) - 1);
+	rank = rank_of(h >> SPARSE_P, HASH_BITS - SPARSE_P + 1);
+	return reg << RANK_BITS | rank;
+}
+
+static void apply_code(unsigned char *regs, unsigned p, unsigned long code)
+{
+	unsigned long reg = code >> RANK_BITS;
+	unsigned rank;
+
+	/* The bits between the precisions are the low bits of the rank's
+	 * word at p; if none are set, the rank continues from the code's. */
+	if (reg >> p) {
+		rank = rank_of((size_t)(reg >> p), SPARSE_P - p);
+	} else {
+		rank = (SPARSE_P - p) +
+		       (unsigned)(code & ((1UL << RANK_BITS) - 1));
+	}
+
+	reg &= ((unsigned long)1 << p) - 1;
+	if (regs[reg] < rank) {
+		regs[reg] = (unsigned char)rank;
+	}
+}
+
+static int add_code(hll_t *hll, unsigned long code)
+{
+	unsigned long *sparse;
+
+	if (hll->n_sparse == hll->cap_sparse) {
+		compact(hll);
+
+		/* Still over half full: grow, while smaller than the
+		 * registers. */
+		if (hll->n_sparse > hll->cap_sparse / 2) {
+			if (hll->cap_sparse * 2 * sizeof(unsigned long) >=
+			    (size_t)1 << hll->p) {
+				if (densify(hll)) {
+					return -1;
+				}
+				apply_code(hll->regs, hll->p, code);
+				return 0;
+			}
+
+			sparse = realloc(hll->sparse, hll->cap_sparse * 2 *
+							      sizeof(unsigned long));
+			if (sparse == NULL) {
+				return -1;
+			}
+			hll->sparse = sparse;
+			hll->cap_sparse *= 2;
+		}
+	}
+
+	hll->sparse[hll->n_sparse++] = code;
+	return 0;
+}
+
+static void compact(hll_t *hll)
+{
+	if (hll->n_sorted == hll->n_sparse) {
+		return;
+	}
+	hll->n_sparse = hll->n_sorted = sort_codes(hll->sparse, hll->n_sparse);
+}
+
+static size_t sort_codes(unsigned long *codes, size_t n)
+{
+	size_t i, j;
+
+	if (!n) {
+		return 0;
+	}
+	qsort(codes, n, sizeof(*codes), cmp_codes);
+
+	/* Codes of a register sort by rank, so the last is the highest. */
+	for (i = 1, j = 0; i < n; i++) {
+		if (codes[i] >> RANK_BITS != codes[j] >> RANK_BITS) {
+			j++;
+		}
+		codes[j] = codes[i];
+	}
+	return j + 1;
+}
+
+static int cmp_codes(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static unsigned char *regs_of_sparse(hll_t *hll)
+{
+	unsigned char *regs;
+	size_t i;
+
+	regs = calloc((size_t)1 << hll->p, 1);
+	if (regs == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < hll->n_sparse; i++) {
+		apply_code(regs, hll->p, hll->sparse[i]);
+	}
+	return regs;
+}
+
+static int densify(hll_t *hll)
+{
+	unsigned char *regs;
+
+	regs = regs_of_sparse(hll);
+	if (regs == NULL) {
+		return -1;
+	}
+	free(hll->sparse);
+	hll->sparse = NULL;
+	hll->n_sparse = hll->n_sorted = hll->cap_sparse = 0;
+	hll->regs = regs;
+	return 0;
+}
+
+static double sigma(double x)
+{
+	double y = 1, z = x, prev;
+
+	do {
+		x *= x;
+		prev = z;
+		z += x * y;
+		y += y;
+	} while (z != prev);
+	return z;
+}
+
+static double tau(double x)
+{
+	double y = 1, z, prev;
+
+	if (x == 0 || x == 1) {
+		return 0;
+	}
+
+	z = 1 - x;
+	do {
+		x = sqrt(x);
+		prev = z;
+		y *= 0.5;
+		z -= (1 - x) * (1 - x) * y;
+	} while (z != prev);
+	return z / 3;
+}
@@ -0,0 +1,53 @@
+#ifndef HLL_H
+#define HLL_H
+
+/*
+ * A HyperLogLog distinct-count sketch over key hashes (e.g. from hash.h),
+ * in bounded memory: 2^p one-byte registers, for a standard error of about
+ * 1.04 / sqrt(2^p) - 0.8% at p = 14, in 16 KiB - however long the stream.
+ *
+ * Sketches start sparse, as a list of the registers set at a finer precision,
+ * which both takes less memory and counts small sets almost exactly. They
+ * turn dense once the list would outgrow the registers.
+ *
+ * Sketches of the same precision merge into a sketch of the union of their
+ * streams. Estimates use Ertl's improved estimator, which needs no bias
+ * correction across the range. Best with 64-bit hashes: with 32-bit ones,
+ * counts much past 2^(32 - p) lose accuracy.
+ */
+
+#include <stddef.h>
+
+/* Range of precisions: the sketch has 2^p registers. */
+#define HLL_P_MIN 4
+#define HLL_P_MAX 16
+
+typedef struct hll_t hll_t;
+
+/* Create an empty sketch of precision p, or return NULL if p is out of range
+ * or on allocation failure. */
+hll_t *hll_create(unsigned p);
+void hll_destroy(hll_t *hll);
+
+/* Bytes of registers, or of sparse list, the sketch holds now. */
+size_t hll_size(hll_t *hll);
+
+/* Add a key by its hash. Returns 0, or -1 on allocation failure, in which
+ * case the key may not have been counted. */
+int hll_add(hll_t *hll, size_t hash);
+
+/* Add n keys by their hashes. Dense sketches take them in blocks, computing
+ * each's register and rank in a loop free of branches that compilers
+ * vectorize. Returns 0, or -1 as hll_add. */
+int hll_add_many(hll_t *hll, const size_t *hashes, size_t n);
+
+/* Estimated number of distinct keys added. */
+double hll_count(hll_t *hll);
+
+/* Add every key added to src to dst. Returns 0, or -1 if their precisions
+ * differ or on allocation failure, leaving dst as it was. */
+int hll_merge(hll_t *dst, hll_t *src);
+
+void hll_clear(hll_t *hll);
+
+#endif /* HLL_H */
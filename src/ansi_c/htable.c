@@ -1,9 +1,10 @@
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "htable.h"
-#include "prime_po2s.h"
+#include "prime_ladder.h"
 
 #ifndef HTABLE_ABSOLUTE_MINIMUM_CAP
 #define HTABLE_ABSOLUTE_MINIMUM_CAP 2U
@@ -17,6 +18,18 @@
 #define HTABLE_UPPER_LOAD_FACTOR_BOUND 0.75
 #endif
 
+/* Key of a removed entry, left as a hole until the entries are compacted. */
+static char removed_key;
+#define REMOVED ((void *)&removed_key)
+
+/* Types of index slot, narrowest first. */
+enum index_type { INDEX_CHAR, INDEX_SHORT, INDEX_INT, INDEX_SIZE };
+
+static const size_t index_sizes[] = {
+	sizeof(unsigned char), sizeof(unsigned short), sizeof(unsigned int),
+	sizeof(size_t)
+};
+
 static const struct load_factor_bounds {
 	double lower, upper;
 } load_factor_bounds = {
@@ -26,32 +39,71 @@ static const struct load_factor_bounds {
 
 struct htable_t {
 	size_t len, min_cap, cap;
-	struct htable_bucket {
-		short in_use;
+
+	/*
+	 * Entries in the order their keys were first set, with the removed
+	 * left as holes: used of them are taken, out of room for entries_cap
+	 * (at most cap).
+	 */
+	struct htable_entry {
 		size_t hash;
-		void *key, *value;
-	} *buckets;
+		void *key, *value; /* key is REMOVED for a hole */
+	} *entries;
+	size_t used, entries_cap;
+
+	/* cap slots probed linearly from hash % cap, each 0 if empty, or else
+	 * 1 + the number of an entry. */
+	void *index;
+	enum index_type index_type;
 
 	htable_cmp_fn cmp_key; /* required */
 	htable_hash_fn hash_key; /* required */
 	htable_destroy_fn destroy_key, destroy_val; /* optional */
+	struct htable_filter filter; /* none while filter.add is NULL */
 };
 
 /*
-* Destroy each stored key/value in the given hashtable's buckets array. ht->len
-* is updated accordingly, but no resizing or free is performed on ht->buckets
-* itself.
+* Destroy each stored key/value in the given hashtable's entries array. ht->len
+* and ht->used are updated accordingly, but the index is left as it is, and no
+* resizing or free is performed.
 */
 static void destroy_key_values(htable_t *ht);
 
-/* Locate the bucket for the provided hash and key.
+/* Get and set slot i of the index. */
+static size_t slot_get(const htable_t *ht, size_t i);
+static void slot_set(htable_t *ht, size_t i, size_t v);
 
-If the caller has already hashed the key, it may provide it.
+/* Locate the index slot for the provided hash and key: the one holding the
+ * key's entry, or else the empty slot ending its probe sequence. */
+static size_t find_slot(htable_t *ht, void *key, size_t hash);
 
-Only returns NULL if the buckets array is not allocated at all.
-*/
-static struct htable_bucket *find_bucket_by_key(htable_t *ht, void *key,
-						const size_t *precomputed_hash);
+/*
+ * Locate the index slot holding the provided key as find_slot does, storing
+ * it in *slot. Returns 0, without probing, if the filter rules the key out,
+ * or if the key isn't there; non-zero otherwise.
+ */
+static int lookup_slot(htable_t *ht, void *key, size_t *slot);
+
+/*
+ * Empty the given in-use slot, shifting any later members of its probe
+ * cluster back so that they stay reachable from their home slot. The slot's
+ * entry is left alone.
+ */
+static void clear_slot(htable_t *ht, size_t slot);
+
+/* Close up the holes in the entries, keeping their order, and rebuild the
+ * index for their new numbers. */
+static void compact(htable_t *ht);
+
+/* Clear the index and fill it from the entries, which have no holes. */
+static void reindex(htable_t *ht);
+
+/*
+ * Make room for one more entry at the end of the full entries array: grow it
+ * while that's cheaper than closing up its holes, and compact otherwise.
+ * Returns non-zero on reallocation failure with no holes to close up.
+ */
+static int make_room(htable_t *ht);
 
 /*
  * Inspect the given pointer and return non-zero if it points
@@ -60,13 +112,20 @@ static struct htable_bucket *find_bucket_by_key(htable_t *ht, void *key,
 static int is_valid_htable(htable_t *ht);
 
 /*
- * Inspect the given pointer and return non-zero if it points to a bucket
+ * Inspect the given pointer and return non-zero if it points to an entry
  * in a valid state.
  */
-static int is_valid_bucket(struct htable_bucket *b);
+static int is_valid_entry(struct htable_entry *e);
+
+/*
+ * Return non-zero if an index of the given candidate capacity can hold
+ * len entries while honoring the minimum capacity and load factor bounds.
+ */
+static int is_sufficient_cap(unsigned long candidate, size_t min_cap,
+			     size_t len, const struct load_factor_bounds *lfb);
 
 /*
-* Determine the optimal capacity for bucketing the given minimum
+* Determine the optimal capacity for indexing the given minimum
 * capacity and length, also considering the desired load factor bounds.
 * 
 * A return value of 0 indicates the platform cannot allocate enough to
@@ -76,18 +135,28 @@ static size_t optimal_cap(size_t min_cap, size_t len,
 			  const struct load_factor_bounds *lfb);
 
 /*
- * Resize the given hashtable's buckets array for the current optimal capacity
- * if the array's length were to be adjusted to the given new_len.
+ * Room for entries to give an index of the given capacity: as many as the
+ * load factor bounds let it hold, so that only churn grows the array further.
+ */
+static size_t entries_cap_for(size_t cap, const struct load_factor_bounds *lfb);
+
+/*
+ * Resize the given hashtable's index for the current optimal capacity if the
+ * hashtable's length were to be adjusted to the given new_len.
  * 
  * If the hashtable is already optimally allocated, no writes are performed.
  *
  * If new_len is 0 and the hashtable is found to not be optimally allocated, an
  * adjustment is still performed.
- * 
- * A non-zero return-value indicates reallocation failure.
+ *
+ * The entries are compacted and resized with realloc along with it, the index
+ * being rebuilt from them; as slots are a few bytes, peak memory stays near the
+ * larger of the old and new entries arrays. A non-zero return-value indicates
+ * allocation failure, in which case the hashtable is left untouched.
  */
-static int optimize_buckets_for_len(struct htable_t *ht, size_t new_len,
-				    const struct load_factor_bounds *lfb);
+static int optimize_index_for_len(struct htable_t *ht, size_t new_len,
+				  const struct load_factor_bounds *lfb);
+
 
 htable_t *htable_create(size_t min_cap, htable_hash_fn hash_key,
 			htable_cmp_fn cmp_key, htable_destroy_fn destroy_key,
@@ -106,22 +175,27 @@ htable_t *htable_create(size_t min_cap, htable_hash_fn hash_key,
 	ht->len = 0;
 	ht->min_cap = min_cap;
 	ht->cap = 0;
-	ht->buckets = NULL;
+	ht->entries = NULL;
+	ht->used = ht->entries_cap = 0;
+	ht->index = NULL;
+	ht->index_type = INDEX_CHAR;
 	ht->cmp_key = cmp_key;
 	ht->hash_key = hash_key;
 	ht->destroy_key = destroy_key;
 	ht->destroy_val = destroy_val;
+	ht->filter.add = NULL;
 
-	if (optimize_buckets_for_len(ht, 0, &load_factor_bounds)) {
+	if (optimize_index_for_len(ht, 0, &load_factor_bounds)) {
 		goto error;
 	}
 	assert(ht->cap);
-	assert(ht->buckets != NULL);
+	assert(ht->index != NULL);
 
 	return ht;
 error:
 	if (ht != NULL) {
-		free(ht->buckets);
+		free(ht->entries);
+		free(ht->index);
 		free(ht);
 	}
 	return NULL;
@@ -132,7 +206,8 @@ void htable_destroy(htable_t *ht)
 	assert(is_valid_htable(ht));
 
 	destroy_key_values(ht);
-	free(ht->buckets);
+	free(ht->entries);
+	free(ht->index);
 	free(ht);
 }
 
@@ -149,7 +224,7 @@ int htable_set_min_cap(htable_t *ht, size_t new_min_cap)
 
 	ht->min_cap = new_min_cap;
 
-	return optimize_buckets_for_len(ht, ht->len, &load_factor_bounds);
+	return optimize_index_for_len(ht, ht->len, &load_factor_bounds);
 }
 
 size_t htable_cap(htable_t *ht)
@@ -172,70 +247,74 @@ int htable_clear(htable_t *ht)
 
 	destroy_key_values(ht);
 	assert(!ht->len);
+	memset(ht->index, 0, ht->cap * index_sizes[ht->index_type]);
+	if (ht->filter.add != NULL && ht->filter.clear != NULL) {
+		ht->filter.clear(ht->filter.ctx);
+	}
 
-	return optimize_buckets_for_len(ht, ht->len, &load_factor_bounds);
+	return optimize_index_for_len(ht, ht->len, &load_factor_bounds);
 }
 
 int htable_contains(htable_t *ht, void *key)
 {
-	struct htable_bucket *b;
+	size_t slot;
 
 	assert(is_valid_htable(ht));
 
-	b = find_bucket_by_key(ht, key, NULL);
-	if (b == NULL) {
-		return 0;
-	}
-	assert(is_valid_bucket(b));
-	return !!b->in_use;
+	return lookup_slot(ht, key, &slot);
 }
 
 void *htable_get(htable_t *ht, void *key)
 {
-	struct htable_bucket *b;
+	struct htable_entry *e;
+	size_t slot;
 
 	assert(is_valid_htable(ht));
 
-	b = find_bucket_by_key(ht, key, NULL);
-	if (b == NULL) {
-		return NULL;
-	}
-
-	assert(is_valid_bucket(b));
-	if (!b->in_use) {
+	if (!lookup_slot(ht, key, &slot)) {
 		return NULL;
 	}
 
-	return b->value;
+	e = &ht->entries[slot_get(ht, slot) - 1];
+	assert(is_valid_entry(e));
+	return e->value;
 }
 
 int htable_remove(htable_t *ht, void *key)
 {
-	struct htable_bucket *b;
+	struct htable_entry *e;
+	size_t slot;
 
 	assert(is_valid_htable(ht));
 
-	b = find_bucket_by_key(ht, key, NULL);
-	if (b == NULL)
-		return 0;
-
-	assert(is_valid_bucket(b));
-	if (!b->in_use) {
+	if (!lookup_slot(ht, key, &slot)) {
 		return 0;
 	}
 
+	e = &ht->entries[slot_get(ht, slot) - 1];
+	assert(is_valid_entry(e));
 	assert(ht->len);
+	if (ht->filter.add != NULL && ht->filter.remove != NULL) {
+		ht->filter.remove(ht->filter.ctx, e->hash);
+	}
 	if (ht->destroy_val != NULL) {
-		ht->destroy_val(b->value);
+		ht->destroy_val(e->value);
 	}
-	b->value = NULL;
 	if (ht->destroy_key != NULL) {
-		ht->destroy_key(b->key);
+		ht->destroy_key(e->key);
+	}
+	clear_slot(ht, slot);
+
+	/* Leave a hole, unless the entry was the last, as when keys are
+	 * removed in the reverse order they were set. */
+	e->hash = 0;
+	e->key = REMOVED;
+	e->value = NULL;
+	while (ht->used && ht->entries[ht->used - 1].key == REMOVED) {
+		ht->used--;
 	}
-	b->key = NULL;
-	b->in_use = b->hash = 0;
 
-	if (optimize_buckets_for_len(ht, --ht->len, &load_factor_bounds)) {
+	if (optimize_index_for_len(ht, --ht->len, &load_factor_bounds)) {
 		return -1;
 	}
 
@@ -244,41 +323,109 @@ int htable_remove(htable_t *ht, void *key)
 
 int htable_set(htable_t *ht, void *key, void *value)
 {
-	struct htable_bucket *b;
-	short found_existing = 0;
-	size_t hash;
+	struct htable_entry *e;
+	size_t hash, slot;
 
 	assert(is_valid_htable(ht));
 	assert(ht->cap);
-	assert(ht->buckets);
+	assert(ht->index);
 
 	hash = ht->hash_key(key);
-	b = find_bucket_by_key(ht, key, &hash);
-	assert(b != NULL);
+	slot = find_slot(ht, key, hash);
 
-	if (b->in_use) {
+	if (slot_get(ht, slot)) {
+		e = &ht->entries[slot_get(ht, slot) - 1];
 		if (ht->destroy_val != NULL) {
-			ht->destroy_val(b->value);
+			ht->destroy_val(e->value);
 		}
-		found_existing = 1;
-	} else {
-		assert(ht->len < (size_t)-1);
+		e->key = key;
+		e->value = value;
+		return 1;
+	}
+
+	assert(ht->len < (size_t)-1);
+
+	/* Make room before inserting, so a failed resize leaves the hashtable
+	 * as it was. */
+	if (optimize_index_for_len(ht, ht->len + 1, &load_factor_bounds)) {
+		return -1;
+	}
+	if (ht->used == ht->entries_cap && make_room(ht)) {
+		return -1;
+	}
+	if (ht->filter.add != NULL && ht->filter.add(ht->filter.ctx, hash)) {
+		return -1;
+	}
+	slot = find_slot(ht, key, hash);
+	assert(!slot_get(ht, slot));
+
+	e = &ht->entries[ht->used++];
+	e->hash = hash;
+	e->key = key;
+	e->value = value;
+	slot_set(ht, slot, ht->used);
+	ht->len++;
+
+	return 0;
+}
+
+void htable_iter_first(htable_t *ht, struct htable_iter *it)
+{
+	assert(is_valid_htable(ht));
+	assert(it != NULL);
+
+	it->ht = ht;
+	it->i = 0;
+}
+
+int htable_iter_next(struct htable_iter *it, void **key, void **value)
+{
+	struct htable_entry *e;
+
+	assert(it != NULL);
+	assert(is_valid_htable(it->ht));
+
+	while (it->i < it->ht->used) {
+		e = &it->ht->entries[it->i++];
+		if (e->key == REMOVED) {
+			continue;
+		}
+		if (key != NULL) {
+			*key = e->key;
+		}
+		if (value != NULL) {
+			*value = e->value;
+		}
+		return 1;
 	}
+	return 0;
+}
+
+int htable_set_filter(htable_t *ht, const struct htable_filter *filter)
+{
+	size_t i;
+
+	assert(is_valid_htable(ht));
 
-	b->in_use = 1;
-	b->hash = hash;
-	b->key = key;
-	b->value = value;
+	ht->filter.add = NULL;
+	if (filter == NULL) {
+		return 0;
+	}
+	assert(filter->add != NULL);
+	assert(filter->may_contain != NULL);
 
-	if (!found_existing) {
-		if (optimize_buckets_for_len(ht, ht->len + 1,
-					     &load_factor_bounds)) {
+	if (filter->clear != NULL) {
+		filter->clear(filter->ctx);
+	}
+	for (i = 0; i < ht->used; i++) {
+		if (ht->entries[i].key != REMOVED &&
+		    filter->add(filter->ctx, ht->entries[i].hash)) {
 			return -1;
 		}
-		ht->len++;
 	}
 
-	return found_existing;
+	ht->filter = *filter;
+	return 0;
 }
 
 static void destroy_key_values(struct htable_t *ht)
@@ -287,84 +434,214 @@ static void destroy_key_values(struct htable_t *ht)
 
 	assert(is_valid_htable(ht));
 
-	for (i = 0; ht->len && i < ht->cap; i++) {
-		struct htable_bucket *b = &ht->buckets[i];
-		assert(is_valid_bucket(b));
+	for (i = 0; i < ht->used; i++) {
+		struct htable_entry *e = &ht->entries[i];
+		assert(is_valid_entry(e));
 
-		if (!b->in_use) {
+		if (e->key == REMOVED) {
 			continue;
 		}
 
 		if (ht->destroy_val != NULL) {
-			ht->destroy_val(b->value);
+			ht->destroy_val(e->value);
 		}
-		b->value = NULL;
 		if (ht->destroy_key != NULL) {
-			ht->destroy_key(b->key);
+			ht->destroy_key(e->key);
 		}
-		b->key = NULL;
-
-		b->hash = b->in_use = 0;
 		assert(ht->len);
 		ht->len--;
 	}
+	assert(!ht->len);
+	ht->used = 0;
+}
+
+static size_t slot_get(const htable_t *ht, size_t i)
+{
+	switch (ht->index_type) {
+	case INDEX_CHAR:
+		return ((const unsigned char *)ht->index)[i];
+	case INDEX_SHORT:
+		return ((const unsigned short *)ht->index)[i];
+	case INDEX_INT:
+		return ((const unsigned int *)ht->index)[i];
+	default:
+		return ((const size_t *)ht->index)[i];
+	}
+}
+
+static void slot_set(htable_t *ht, size_t i, size_t v)
+{
+	switch (ht->index_type) {
+	case INDEX_CHAR:
+		((unsigned char *)ht->index)[i] = (unsigned char)v;
+		break;
+	case INDEX_SHORT:
+		((unsigned short *)ht->index)[i] = (unsigned short)v;
+		break;
+	case INDEX_INT:
+		((unsigned int *)ht->index)[i] = (unsigned int)v;
+		break;
+	default:
+		((size_t *)ht->index)[i] = v;
+		break;
+	}
 }
 
-static struct htable_bucket *find_bucket_by_key(htable_t *ht, void *key,
-						const size_t *precomputed_hash)
+static size_t find_slot(htable_t *ht, void *key, size_t hash)
 {
 	/* Linear probe 
 	   TODO quadratic probe? */
 
-	struct htable_bucket *b;
-	size_t i0, i, hash;
+	size_t i0, i, v;
 
 	assert(is_valid_htable(ht));
+	assert(ht->cap && ht->index != NULL);
 
-	if (!ht->cap || ht->buckets == NULL) {
-		return NULL;
-	}
-
-	if (precomputed_hash == NULL) {
-		hash = ht->hash_key(key);
-	} else {
-		hash = *precomputed_hash;
-	}
-
-	b = NULL;
 	i0 = i = hash % ht->cap;
-	while (b == NULL || i0 != i) {
-		b = &ht->buckets[i];
+	do {
+		struct htable_entry *e;
 
-		/* no bucket with this key, and this is the first non-empty match.
+		/* no entry with this key, and this is the first empty slot.
 		return it so it can be used in a set operation
 		*/
-		if (!b->in_use) {
-			return b;
+		v = slot_get(ht, i);
+		if (!v) {
+			return i;
 		}
 
-		if (ht->cmp_key(key, b->key)) {
+		/* Only keys of the same hash can match, and comparing hashes
+		 * saves calling out for the rest. */
+		e = &ht->entries[v - 1];
+		if (e->hash == hash && ht->cmp_key(key, e->key)) {
 			/* found a matching key */
-			return b;
+			return i;
 		}
 
 		i++;
 		if (i >= ht->cap) {
 			i = 0;
 		}
-	}
-	/* Neither key nor an empty bucket found. Impossible, since we should
+	} while (i != i0);
+	/* Neither key nor an empty slot found. Impossible, since we should
 	 * always have space. Dump core for debugging. */
 	abort();
 }
 
+static int lookup_slot(htable_t *ht, void *key, size_t *slot)
+{
+	size_t hash;
+
+	hash = ht->hash_key(key);
+	if (ht->filter.add != NULL &&
+	    !ht->filter.may_contain(ht->filter.ctx, hash)) {
+		return 0;
+	}
+	*slot = find_slot(ht, key, hash);
+	return slot_get(ht, *slot) != 0;
+}
+
+static void clear_slot(htable_t *ht, size_t slot)
+{
+	size_t gap, i;
+
+	assert(is_valid_htable(ht));
+	assert(slot < ht->cap && slot_get(ht, slot));
+
+	/* Backward-shift deletion: walk the rest of the cluster and pull back
+	 * any entry whose home slot does not lie strictly between the gap and
+	 * its current position. */
+	gap = i = slot;
+	for (;;) {
+		size_t home, v;
+
+		if (++i >= ht->cap) {
+			i = 0;
+		}
+		v = slot_get(ht, i);
+		if (!v) {
+			break;
+		}
+
+		home = ht->entries[v - 1].hash % ht->cap;
+		if (gap <= i ? (home <= gap || home > i) :
+			       (home <= gap && home > i)) {
+			slot_set(ht, gap, v);
+			gap = i;
+		}
+	}
+
+	slot_set(ht, gap, 0);
+}
+
+static void compact(htable_t *ht)
+{
+	size_t i, j;
+
+	for (i = j = 0; i < ht->used; i++) {
+		if (ht->entries[i].key != REMOVED) {
+			ht->entries[j++] = ht->entries[i];
+		}
+	}
+	assert(j == ht->len);
+	ht->used = j;
+
+	reindex(ht);
+}
+
+static void reindex(htable_t *ht)
+{
+	size_t i, j;
+
+	assert(ht->used == ht->len);
+
+	memset(ht->index, 0, ht->cap * index_sizes[ht->index_type]);
+	for (i = 0; i < ht->used; i++) {
+		j = ht->entries[i].hash % ht->cap;
+		while (slot_get(ht, j)) {
+			if (++j >= ht->cap) {
+				j = 0;
+			}
+		}
+		slot_set(ht, j, i + 1);
+	}
+}
+
+static int make_room(htable_t *ht)
+{
+	struct htable_entry *entries;
+	size_t holes, new_cap;
+
+	assert(ht->used == ht->entries_cap);
+
+	/* Each compaction closes up at least a quarter of the array, so the
+	 * removals that made the holes pay for it. */
+	holes = ht->used - ht->len;
+	if (ht->entries_cap < ht->cap && holes < ht->used / 4) {
+		new_cap = ht->entries_cap < ht->cap / 2 ? ht->entries_cap * 2 :
+							  ht->cap;
+		entries = realloc(ht->entries, new_cap * sizeof(*entries));
+		if (entries != NULL) {
+			ht->entries = entries;
+			ht->entries_cap = new_cap;
+			return 0;
+		}
+	}
+
+	if (!holes) {
+		return -1;
+	}
+	compact(ht);
+	return 0;
+}
+
 static int is_valid_htable(htable_t *ht)
 {
 	if (ht == NULL) {
 		return 0;
 	}
 
-	if (ht->len > ht->cap) {
+	if (ht->len > ht->used || ht->used > ht->entries_cap ||
+	    ht->entries_cap > ht->cap) {
 		return 0;
 	}
 
@@ -372,7 +649,7 @@ static int is_valid_htable(htable_t *ht)
 		if (ht->cap < ht->min_cap) {
 			return 0;
 		}
-		if (ht->buckets == NULL) {
+		if (ht->index == NULL || ht->entries == NULL) {
 			return 0;
 		}
 	}
@@ -388,20 +665,17 @@ static int is_valid_htable(htable_t *ht)
 	return 1;
 }
 
-static int is_valid_bucket(struct htable_bucket *b)
+static int is_valid_entry(struct htable_entry *e)
 {
-	if (b == NULL) {
+	if (e == NULL) {
 		return 0;
 	}
 
-	if (!b->in_use) {
-		if (b->hash != 0) {
-			return 0;
-		}
-		if (b->key != NULL) {
+	if (e->key == REMOVED) {
+		if (e->hash != 0) {
 			return 0;
 		}
-		if (b->value != NULL) {
+		if (e->value != NULL) {
 			return 0;
 		}
 	}
@@ -409,63 +683,104 @@ static int is_valid_bucket(struct htable_bucket *b)
 	return 1;
 }
 
-static size_t optimal_cap(size_t min_cap, size_t len,
-			  const struct load_factor_bounds *lfb)
+static int is_sufficient_cap(unsigned long candidate, size_t min_cap,
+			     size_t len, const struct load_factor_bounds *lfb)
 {
-	size_t i;
+	if (candidate < HTABLE_ABSOLUTE_MINIMUM_CAP) {
+		return 0;
+	}
 
-	for (i = 0; i < prime_po2s_cap; i++) {
-		unsigned long candidate = prime_po2s[i];
+	if (candidate < len) {
+		return 0;
+	}
 
-		if (candidate < HTABLE_ABSOLUTE_MINIMUM_CAP) {
-			continue;
-		}
+	if (candidate < min_cap) {
+		return 0;
+	}
 
-		if (candidate > (unsigned long)((size_t)-1)) {
-			/* exceeded valid sizes we could allocate */
-			break;
-		}
+	if (len && lfb != NULL && lfb->upper) {
+		double load_factor;
 
-		if (candidate < len) {
-			continue;
+		assert(lfb->lower >= 0.0 && lfb->lower < 1.0);
+		assert(lfb->upper > 0.0 && lfb->lower < 1.0);
+		assert(lfb->lower <= lfb->upper);
+		assert((double)candidate > 0.0);
+
+		load_factor = (double)len / (double)candidate;
+
+		if (load_factor > lfb->upper) {
+			return 0;
 		}
+	}
 
-		if (candidate < min_cap) {
-			continue;
+	return 1;
+}
+
+static size_t optimal_cap(size_t min_cap, size_t len,
+			  const struct load_factor_bounds *lfb)
+{
+	size_t lo, hi;
+	unsigned long candidate;
+
+	/* Every condition in is_sufficient_cap only gets easier to meet as the
+	 * candidate grows, so binary search for the first ladder entry meeting
+	 * them all. */
+	lo = 0;
+	hi = prime_ladder_cap;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (is_sufficient_cap(prime_ladder[mid], min_cap, len, lfb)) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
 		}
+	}
 
-		if (len && lfb != NULL && lfb->upper) {
-			double load_factor;
+	if (lo >= prime_ladder_cap) {
+		/* no valid candidate found - system can't allocate enough
+		 * space. */
+		return 0;
+	}
 
-			assert(lfb->lower >= 0.0 && lfb->lower < 1.0);
-			assert(lfb->upper > 0.0 && lfb->lower < 1.0);
-			assert(lfb->lower <= lfb->upper);
-			assert((double)candidate > 0.0);
+	candidate = prime_ladder[lo];
+	if (candidate > (unsigned long)((size_t)-1)) {
+		/* exceeded valid sizes we could allocate */
+		return 0;
+	}
 
-			load_factor = (double)len / (double)candidate;
+	return (size_t)candidate;
+}
 
-			if (load_factor > lfb->upper) {
-				continue;
-			}
-		}
 
-		return (size_t)candidate;
+static size_t entries_cap_for(size_t cap, const struct load_factor_bounds *lfb)
+{
+	size_t n = cap;
+
+	if (lfb != NULL && lfb->upper) {
+		/* One over, against rounding down. */
+		n = (size_t)((double)cap * lfb->upper) + 1;
+		if (n > cap) {
+			n = cap;
+		}
 	}
-	/* no valid candidate found - system can't allocate enough space. */
-	return 0;
+
+	return n;
 }
 
-static int optimize_buckets_for_len(struct htable_t *ht, size_t new_len,
-				    const struct load_factor_bounds *lfb)
+static int optimize_index_for_len(struct htable_t *ht, size_t new_len,
+				  const struct load_factor_bounds *lfb)
 {
-	struct htable_t new;
+	struct htable_entry *entries;
+	enum index_type index_type;
+	void *index;
 	short may_need_realloc = 0;
-	size_t i, old_len;
+	size_t new_cap, new_entries_cap;
 
 	assert(is_valid_htable(ht));
 
 	/* discern if we need to do anything */
-	if (ht->buckets == NULL || ht->cap < HTABLE_ABSOLUTE_MINIMUM_CAP ||
+	if (ht->index == NULL || ht->cap < HTABLE_ABSOLUTE_MINIMUM_CAP ||
 	    ht->cap < ht->min_cap || ht->cap < new_len) {
 		may_need_realloc = 1;
 	} else if (lfb != NULL && ht->cap) {
@@ -487,42 +802,59 @@ static int optimize_buckets_for_len(struct htable_t *ht, size_t new_len,
 		return 0;
 	}
 
-	/* we do - make a new ht on the stack and copy all elements in.
-	 Then free the old bucket and apply that state to the given ht pointer.*/
-
-	memcpy(&new, ht, sizeof(new));
-
-	new.cap = optimal_cap(ht->min_cap, new_len, lfb);
-	if (!new.cap) {
+	new_cap = optimal_cap(ht->min_cap, new_len, lfb);
+	if (!new_cap || new_cap > (size_t)-1 / sizeof(*ht->entries)) {
 		return -1; /* ENOMEM */
 	}
-	assert(ht->cap != new.cap);
 
-	new.buckets = calloc(new.cap, sizeof(*ht->buckets));
-	if (new.buckets == NULL) {
-		return -1;
+	if (ht->index != NULL && new_cap == ht->cap) {
+		/* already as small as the bounds allow */
+		return 0;
 	}
 
-	old_len = ht->len;
-	for (i = 0; old_len && i < ht->cap; i++) {
-		struct htable_bucket *old_bucket = &ht->buckets[i], *new_bucket;
+	/* The narrowest slots that can number every entry. */
+	if (new_cap <= UCHAR_MAX) {
+		index_type = INDEX_CHAR;
+	} else if (new_cap <= USHRT_MAX) {
+		index_type = INDEX_SHORT;
+	} else if (new_cap <= UINT_MAX) {
+		index_type = INDEX_INT;
+	} else {
+		index_type = INDEX_SIZE;
+	}
+	index = calloc(new_cap, index_sizes[index_type]);
+	if (index == NULL) {
+		return -1;
+	}
 
-		if (!old_bucket->in_use) {
-			continue;
+	new_entries_cap = entries_cap_for(new_cap, lfb);
+	assert(new_entries_cap >= ht->len);
+	if (new_entries_cap > ht->entries_cap) {
+		entries = realloc(ht->entries,
+				  new_entries_cap * sizeof(*entries));
+		if (entries == NULL) {
+			free(index);
+			return -1;
 		}
-
-		new_bucket = &new.buckets[old_bucket->hash % new.cap];
-		new_bucket->in_use = 1;
-		new_bucket->hash = old_bucket->hash;
-		new_bucket->key = old_bucket->key;
-		new_bucket->value = old_bucket->value;
-		old_len--;
+		ht->entries = entries;
 	}
-	assert(!old_len);
 
-	free(ht->buckets);
-	ht->buckets = new.buckets;
-	ht->cap = new.cap;
+	free(ht->index);
+	ht->index = index;
+	ht->index_type = index_type;
+	ht->cap = new_cap;
+	compact(ht);
+
+	if (new_entries_cap < ht->entries_cap) {
+		/* Release the tail; on failure, the larger block remains
+		 * valid. */
+		entries = realloc(ht->entries,
+				  new_entries_cap * sizeof(*entries));
+		if (entries != NULL) {
+			ht->entries = entries;
+		}
+	}
+	ht->entries_cap = new_entries_cap;
 
 	return 0;
 }
@@ -1,7 +1,13 @@
 #ifndef HTABLE_H
 #define HTABLE_H
 
-/* A generic open-addressing, linear-probing hash table. */
+/*
+ * A generic open-addressing, linear-probing hash table, in the compact layout:
+ * entries are kept densely in the order their keys were first set, and the
+ * probed table holds only their numbers, in slots of 8, 16, 32 or more bits as
+ * its capacity needs. Empty slots cost that much rather than a whole entry,
+ * and iteration walks the entries in order without visiting empty slots.
+ */
 
 #include <stddef.h>
 
@@ -11,6 +17,35 @@ typedef int (*htable_cmp_fn)(void *a, void *b);
 typedef int (*htable_hash_fn)(void *p);
 typedef void (*htable_destroy_fn)(void *p);
 
+/*
+ * An iterator over the keys and values of a hashtable, in the order the keys
+ * were first set. Setting values of keys already there leaves iterators valid;
+ * setting new keys, removing or clearing invalidates them.
+ */
+struct htable_iter {
+	htable_t *ht;
+	size_t i;
+};
+
+/*
+ * A membership filter over key hashes (e.g. a bloom_t or cuckoo_filter_t),
+ * consulted before probing so that most misses never touch the buckets. It is
+ * kept in sync as keys are set, removed and cleared. The filter may report
+ * keys that aren't there, but must never miss one that is.
+ */
+typedef int (*htable_filter_add_fn)(void *ctx, size_t hash);
+typedef int (*htable_filter_test_fn)(void *ctx, size_t hash);
+typedef void (*htable_filter_remove_fn)(void *ctx, size_t hash);
+typedef void (*htable_filter_clear_fn)(void *ctx);
+
+struct htable_filter {
+	htable_filter_add_fn add; /* required; returns 0, or -1 if full */
+	htable_filter_test_fn may_contain; /* required */
+	htable_filter_remove_fn remove; /* optional */
+	htable_filter_clear_fn clear; /* optional */
+	void *ctx;
+};
+
 htable_t *htable_create(size_t min_cap, htable_hash_fn hash_key,
 			htable_cmp_fn cmp_key, htable_destroy_fn destroy_key,
 			htable_destroy_fn destroy_val);
@@ -27,4 +62,20 @@ void *htable_get(htable_t *ht, void *key);
 int htable_remove(htable_t *ht, void *key);
 int htable_set(htable_t *ht, void *key, void *value);
 
+void htable_iter_first(htable_t *ht, struct htable_iter *it);
+
+/* Get the key and value (either may be NULL) at the iterator and move past
+ * them. Returns 1, or 0 once past the end. */
+int htable_iter_next(struct htable_iter *it, void **key, void **value);
+
+/*
+ * Put the given filter (copied; NULL for none) in front of the hashtable,
+ * clearing it and adding every key already set. The filter must outlive its
+ * use. Sets of new keys fail while the filter can't take them.
+ *
+ * Returns 0 on success, or -1 if the filter couldn't take every key, in which
+ * case the hashtable is left without one.
+ */
+int htable_set_filter(htable_t *ht, const struct htable_filter *filter);
+
 #endif /* HTABLE_H */
@@ -3,10 +3,10 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "log.h"
-#include "str.h"
 
 #ifndef LOG_FILE_INITIAL
 #define LOG_FILE_INITIAL stderr
@@ -16,71 +16,107 @@
 #define LOG_LEVEL_INITIAL LOG_LEVEL_WARNING
 #endif
 
+/* Least severe level the default sink flushes as soon as it is logged. */
+#ifndef LOG_FLUSH_LEVEL
+#define LOG_FLUSH_LEVEL LOG_LEVEL_ERR
+#endif
+
 static FILE *current_file = NULL;
 static enum log_level current_lvl = LOG_LEVEL_INITIAL;
+static enum log_level capture_lvl = LOG_LEVEL_EMERG;
+
+/* Per-module levels, n_modules of them. */
+static struct {
+	char name[LOG_MODULE_NAME_MAX + 1];
+	enum log_level lvl;
+} modules[LOG_MODULES_MAX];
+static size_t n_modules = 0;
+
+/* Starts above the sites' 0, so each decides on first use. */
+unsigned long log_filter_gen_ = 1;
+
+/* The default sink, writing to log_file() with stdio. */
+static int stdio_emit(void *ctx, const struct log_record *rec, va_list ap);
+static int stdio_flush(void *ctx);
+static int stdio_write(void *ctx, enum log_level lvl, const char *line,
+		       size_t len);
+
+static const struct log_sink default_sink = { stdio_emit, stdio_flush, NULL,
+					      stdio_write };
+static struct log_sink current_sink = { stdio_emit, stdio_flush, NULL,
+					stdio_write };
+
+/*
+ * The current time as an ISO-8601 UTC timestamp, to the second. It is only
+ * re-rendered when the second changes. Returns NULL on failure.
+ */
+static const char *timestamp(void);
 
 static int is_valid_log_level(enum log_level lvl);
-static const char *log_level_s(enum log_level lvl);
+
+/* Hand a record to the current sink, whatever the levels. */
+static int emit_unfiltered(enum log_level lvl, const char *file,
+			   unsigned lineno, const char *fmt, ...);
+
+/* Return the index of module's entry in modules, or -1 if it has none. */
+static int find_module(const char *module);
+
+/* Return non-zero if the site module is covered by the entry name. */
+static int module_matches(const char *module, const char *name);
+
+/* Invalidate the sites' cached filtering. */
+static void filter_changed(void);
 
 int log_emit(enum log_level lvl, const char *file, unsigned lineno,
 	     const char *fmt, ...)
 {
-	int written = -1;
+	struct log_record rec;
 	va_list ap;
-	time_t now;
-	char *now_s;
-	const char *lvl_s;
+	int rc;
 
 	assert(is_valid_log_level(lvl));
 	assert(file != NULL);
 	assert(fmt != NULL);
 
-	if (lvl > current_lvl) {
+	if (lvl > current_lvl && lvl > capture_lvl) {
 		return 0;
 	}
 
-	now = time(NULL);
-	if (now == (time_t)-1) {
-		return -1;
-	}
-	now_s = ctime(&now);
-	if (now_s == NULL) {
-		return -1;
-	}
-	str_rstrip(now_s);
-
-	lvl_s = log_level_s(lvl);
-	assert(lvl_s != NULL);
-
-	written = fprintf(log_file(),
-			  ("[%s]" /* time */
-			   " "
-			   "%s" /* level */
-			   " "
-			   "%s:%d" /* file:lineno */
-			   " "),
-			  now_s, lvl_s, file, lineno);
-	if (written < 0) {
-		return -1;
-	}
+	rec.lvl = lvl;
+	rec.file = file;
+	rec.lineno = lineno;
+	rec.fmt = fmt;
+	rec.site = NULL;
 
 	va_start(ap, fmt);
-	written = vfprintf(stderr, fmt, ap);
+	rc = current_sink.emit(current_sink.ctx, &rec, ap);
 	va_end(ap);
-	if (written < 0) {
-		return -1;
-	}
 
-	written = fprintf(stderr, "\n");
-	if (written < 0) {
-		return -1;
-	}
+	return rc;
+}
 
-	if (fflush(stderr) == EOF) {
-		return -1;
-	}
+int log_emit_site(struct log_site *site, const char *fmt, ...)
+{
+	struct log_record rec;
+	va_list ap;
+	int rc;
 
-	return 0;
+	assert(site != NULL);
+	assert(is_valid_log_level(site->lvl));
+	assert(site->file != NULL);
+	assert(fmt != NULL);
+
+	rec.lvl = site->lvl;
+	rec.file = site->file;
+	rec.lineno = site->lineno;
+	rec.fmt = fmt;
+	rec.site = site;
+
+	va_start(ap, fmt);
+	rc = current_sink.emit(current_sink.ctx, &rec, ap);
+	va_end(ap);
+
+	return rc;
 }
 
 enum log_level log_level(void)
@@ -95,6 +131,90 @@ void log_level_set(enum log_level lvl)
 	assert(is_valid_log_level(lvl));
 
 	current_lvl = lvl;
+	filter_changed();
+}
+
+int log_level_set_module(const char *module, enum log_level lvl)
+{
+	int i;
+
+	assert(module != NULL);
+	assert(is_valid_log_level(lvl));
+
+	i = find_module(module);
+	if (i < 0) {
+		if (n_modules == LOG_MODULES_MAX ||
+		    strlen(module) > LOG_MODULE_NAME_MAX) {
+			return -1;
+		}
+		i = (int)n_modules++;
+		strcpy(modules[i].name, module);
+	}
+	modules[i].lvl = lvl;
+	filter_changed();
+
+	return 0;
+}
+
+void log_level_unset_module(const char *module)
+{
+	int i;
+
+	assert(module != NULL);
+
+	i = find_module(module);
+	if (i < 0) {
+		return;
+	}
+	modules[i] = modules[--n_modules];
+	filter_changed();
+}
+
+enum log_level log_level_module(const char *module)
+{
+	size_t i;
+
+	assert(module != NULL);
+
+	for (i = 0; i < n_modules; i++) {
+		if (module_matches(module, modules[i].name)) {
+			return modules[i].lvl;
+		}
+	}
+	return current_lvl;
+}
+
+enum log_level log_level_capture(void)
+{
+	return capture_lvl;
+}
+
+void log_level_set_capture(enum log_level lvl)
+{
+	assert(is_valid_log_level(lvl));
+
+	capture_lvl = lvl;
+	filter_changed();
+}
+
+int log_site_enabled_(struct log_site *site)
+{
+	assert(site != NULL);
+	assert(site->module != NULL);
+
+	site->enabled = site->lvl <= capture_lvl ||
+			site->lvl <= log_level_module(site->module);
+	site->gen = log_filter_gen_;
+	return site->enabled;
+}
+
+const char *log_level_name(enum log_level lvl)
+{
+	static const char *level_ss[] = { "EMERG",   "ALERT",  "CRIT", "ERR",
+					  "WARNING", "NOTICE", "INFO", "DEBUG" };
+
+	assert(is_valid_log_level(lvl));
+	return level_ss[lvl];
 }
 
 FILE *log_file(void)
@@ -111,6 +231,196 @@ void log_file_set(FILE *f)
 	current_file = f;
 }
 
+const struct log_sink *log_sink(void)
+{
+	return &current_sink;
+}
+
+void log_sink_set(const struct log_sink *sink)
+{
+	if (sink == NULL) {
+		sink = &default_sink;
+	}
+	assert(sink->emit != NULL);
+
+	current_sink = *sink;
+}
+
+int log_flush(void)
+{
+	if (current_sink.flush == NULL) {
+		return 0;
+	}
+	return current_sink.flush(current_sink.ctx);
+}
+
+int log_write(enum log_level lvl, const char *file, unsigned lineno,
+	      const char *line, size_t len)
+{
+	assert(is_valid_log_level(lvl));
+	assert(file != NULL);
+	assert(line != NULL);
+
+	if (current_sink.write == NULL) {
+		return emit_unfiltered(lvl, file, lineno, "%.*s", (int)len,
+				       line);
+	}
+	return current_sink.write(current_sink.ctx, lvl, line, len);
+}
+
+static int stdio_emit(void *ctx, const struct log_record *rec, va_list ap)
+{
+	FILE *f = log_file();
+	const char *now_s;
+	const char *lvl_s;
+
+	(void)ctx;
+
+	now_s = timestamp();
+	if (now_s == NULL) {
+		return -1;
+	}
+
+	lvl_s = log_level_name(rec->lvl);
+	assert(lvl_s != NULL);
+
+	/* Three calls, not one: C90 has no vsnprintf to render the record
+	 * into a buffer first. */
+	if (fprintf(f,
+		    ("[%s]" /* time */
+		     " "
+		     "%s" /* level */
+		     " "
+		     "%s:%u" /* file:lineno */
+		     " "),
+		    now_s, lvl_s, rec->file, rec->lineno) < 0) {
+		return -1;
+	}
+
+	if (vfprintf(f, rec->fmt, ap) < 0) {
+		return -1;
+	}
+
+	if (putc('\n', f) == EOF) {
+		return -1;
+	}
+
+	/* Otherwise left to the stream's buffering. */
+	if (rec->lvl <= LOG_FLUSH_LEVEL) {
+		return stdio_flush(ctx);
+	}
+	return 0;
+}
+
+static int stdio_write(void *ctx, enum log_level lvl, const char *line,
+		       size_t len)
+{
+	FILE *f = log_file();
+
+	(void)ctx;
+
+	if (fwrite(line, 1, len, f) != len || putc('\n', f) == EOF) {
+		return -1;
+	}
+
+	if (lvl <= LOG_FLUSH_LEVEL) {
+		return stdio_flush(ctx);
+	}
+	return 0;
+}
+
+static int stdio_flush(void *ctx)
+{
+	(void)ctx;
+
+	if (fflush(log_file()) == EOF) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static const char *timestamp(void)
+{
+	static char cached[sizeof("YYYY-MM-DDTHH:MM:SSZ")];
+	static time_t cached_now = (time_t)-1;
+	time_t now;
+	struct tm *tm;
+
+	now = time(NULL);
+	if (now == (time_t)-1) {
+		return NULL;
+	}
+
+	if (now != cached_now) {
+		tm = gmtime(&now);
+		if (tm == NULL) {
+			return NULL;
+		}
+		if (!strftime(cached, sizeof(cached), "%Y-%m-%dT%H:%M:%SZ",
+			      tm)) {
+			return NULL;
+		}
+		cached_now = now;
+	}
+
+	return cached;
+}
+
+static int emit_unfiltered(enum log_level lvl, const char *file,
+			   unsigned lineno, const char *fmt, ...)
+{
+	struct log_record rec;
+	va_list ap;
+	int rc;
+
+	rec.lvl = lvl;
+	rec.file = file;
+	rec.lineno = lineno;
+	rec.fmt = fmt;
+	rec.site = NULL;
+
+	va_start(ap, fmt);
+	rc = current_sink.emit(current_sink.ctx, &rec, ap);
+	va_end(ap);
+
+	return rc;
+}
+
+static int find_module(const char *module)
+{
+	size_t i;
+
+	for (i = 0; i < n_modules; i++) {
+		if (!strcmp(modules[i].name, module)) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+static int module_matches(const char *module, const char *name)
+{
+	size_t module_len = strlen(module);
+	size_t name_len = strlen(name);
+
+	if (module_len < name_len) {
+		return 0;
+	}
+	if (module_len > name_len && module[module_len - name_len - 1] != '/') {
+		return 0;
+	}
+	return !strcmp(module + module_len - name_len, name);
+}
+
+static void filter_changed(void)
+{
+	/* skip 0, which sites start at */
+	if (++log_filter_gen_ == 0) {
+		log_filter_gen_ = 1;
+	}
+}
+
 static int is_valid_log_level(enum log_level lvl)
 {
 	switch (lvl) {
@@ -127,12 +437,3 @@ static int is_valid_log_level(enum log_level lvl)
 		return 0;
 	}
 }
-
-static const char *log_level_s(enum log_level lvl)
-{
-	static const char *level_ss[] = { "EMERG",   "ALERT",  "CRIT", "ERR",
-					  "WARNING", "NOTICE", "INFO", "DEBUG" };
-
-	assert(is_valid_log_level(lvl));
-	return level_ss[lvl];
-}
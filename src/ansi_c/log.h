@@ -1,6 +1,8 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdarg.h> /* for va_list */
+#include <stddef.h> /* for size_t */
 #include <stdio.h> /* for FILE */
 
 enum log_level {
@@ -21,153 +23,345 @@ enum log_level {
 int log_emit(enum log_level lvl, const char *file, unsigned lineno,
 	     const char *fmt, ...);
 
+/*
+ * Levels less severe than LOG_LEVEL_COMPILED_MIN are compiled out: their log_*
+ * macros expand to nothing that survives optimization, and don't evaluate
+ * their arguments.
+ */
+#ifndef LOG_LEVEL_COMPILED_MIN
+#define LOG_LEVEL_COMPILED_MIN LOG_LEVEL_DEBUG
+#endif
+
+/*
+ * The module the log_* macros attribute call sites to, for per-module levels
+ * (see log_level_set_module). Define it before including log.h to group
+ * several files under one name.
+ */
+#ifndef LOG_MODULE
+#define LOG_MODULE __FILE__
+#endif
+
+/*
+ * A log call site. The log_* macros give each one a static log_site, so that
+ * filtering is decided once per change of levels rather than on every call,
+ * and sinks can do per-site work (e.g. registering its format string) once.
+ */
+struct log_site {
+	enum log_level lvl;
+	const char *file;
+	unsigned lineno;
+	const char *module;
+
+	/* Whether lvl passes the levels, as of log_filter_gen_ == gen. Threads
+	 * may refresh these concurrently - with the same values, so the race is
+	 * benign short of a level changing at the same time. */
+	unsigned long gen;
+	int enabled;
+
+	/* Zero until a sink needing it registers the site. Sinks serialize
+	 * access to these between themselves. */
+	unsigned long id;
+	const char *fmt;
+};
+
+/* Bumped whenever a level changes, invalidating the sites' cached filtering.
+ * For the log_* macros only. */
+extern unsigned long log_filter_gen_;
+
+/* Decide and cache whether the site passes the current levels, returning
+ * non-zero if so. For the log_* macros only. */
+int log_site_enabled_(struct log_site *site);
+
+/* log_emit for a call site, which the caller has already filtered. fmt must
+ * be the same string literal on every call from the site, as sinks may key
+ * what they learn from it on its address. */
+int log_emit_site(struct log_site *site, const char *fmt, ...);
+
 enum log_level log_level(void);
 void log_level_set(enum log_level lvl);
 
+/*
+ * Per-module levels, overriding log_level() for call sites in the given
+ * module (LOG_MODULE, which is the file name by default). A module matches
+ * if it is the same string, or ends in '/' followed by it, so "htable.c"
+ * covers "src/ansi_c/htable.c". Only the first LOG_MODULES_MAX are kept.
+ *
+ * log_level_set_module returns 0 on success, or -1 if the table is full or
+ * the name too long. Setting levels isn't thread-safe.
+ */
+#ifndef LOG_MODULES_MAX
+#define LOG_MODULES_MAX 16
+#endif
+#define LOG_MODULE_NAME_MAX 63
+
+int log_level_set_module(const char *module, enum log_level lvl);
+void log_level_unset_module(const char *module);
+
+/* The level in effect for call sites in module: its own, or log_level(). */
+enum log_level log_level_module(const char *module);
+
+/*
+ * The capture level: records at it or more severe reach the sink whatever
+ * the levels above, for sinks that keep more than they write out (e.g.
+ * log_ring); such a sink filters what it writes out itself, with
+ * log_level_module. LOG_LEVEL_EMERG, the initial level, captures nothing
+ * extra.
+ */
+enum log_level log_level_capture(void);
+void log_level_set_capture(enum log_level lvl);
+
+/* The level's name as it appears in records, e.g. "WARNING". */
+const char *log_level_name(enum log_level lvl);
+
 FILE *log_file(void);
 void log_file_set(FILE *f);
 
-#define log_emerg(FMT) log_emit(LOG_LEVEL_EMERG, __FILE__, __LINE__, FMT)
+/*
+ * Sinks
+ *
+ * Records passing the level filter are handed to the current sink, which
+ * formats and writes them. The default sink writes to log_file() with stdio,
+ * flushing after records at LOG_FLUSH_LEVEL (LOG_LEVEL_ERR unless defined when
+ * building log.c) or more severe, and otherwise leaving it to the stream's
+ * buffering. It writes a record in several stdio calls, as C90 has no bounded
+ * way to render one into a buffer, so records logged by different threads at
+ * once may interleave; log_fd in src/posix writes each whole. Other sinks
+ * (e.g. those in src/posix) are installed with log_sink_set.
+ */
+
+struct log_record {
+	enum log_level lvl;
+	const char *file;
+	unsigned lineno;
+	const char *fmt;
+	struct log_site *site; /* NULL if not logged through a call site */
+};
+
+/* Format and write the given record, its arguments in ap. Return 0 on success
+ * and -1 on failure, which log_emit passes on. */
+typedef int (*log_sink_emit_fn)(void *ctx, const struct log_record *rec,
+				va_list ap);
+
+/* Write out anything the sink has buffered, returning 0 on success and -1 on
+ * failure. */
+typedef int (*log_sink_flush_fn)(void *ctx);
+
+/* Write a line the caller has rendered in full (e.g. a structured record),
+ * which excludes its newline, as is. Return 0 on success and -1 on failure. */
+typedef int (*log_sink_write_fn)(void *ctx, enum log_level lvl,
+				 const char *line, size_t len);
+
+struct log_sink {
+	log_sink_emit_fn emit; /* required */
+	log_sink_flush_fn flush; /* optional */
+	void *ctx;
+	log_sink_write_fn write; /* optional; see log_write */
+};
+
+/* The current sink. Wrapping sinks may keep a copy to pass records on to. */
+const struct log_sink *log_sink(void);
+
+/* Replace the current sink with a copy of the given one, or restore the
+ * default if NULL. Not thread-safe: do this while nothing is logging. */
+void log_sink_set(const struct log_sink *sink);
+
+/* Flush the current sink. */
+int log_flush(void);
+
+/*
+ * Hand a fully rendered line (excluding its newline) to the current sink, for
+ * callers doing their own formatting. Sinks without a write function get it as
+ * a record from file:lineno with the line as its message. Levels are left to
+ * the caller.
+ */
+int log_write(enum log_level lvl, const char *file, unsigned lineno,
+	      const char *line, size_t len);
+
+/*
+ * Each use of the macros below is a call site with its own static log_site.
+ * A site compiled out by LOG_LEVEL_COMPILED_MIN costs nothing; otherwise,
+ * while no level changes, a disabled site costs a comparison and a branch,
+ * before its arguments are evaluated. They are statements, not expressions.
+ *
+ * LOG_SITE_ expands to such a call site; ARGS is the parenthesized argument
+ * list for log_emit_site, beginning with &log_site_. LOG_FMT_ makes a format
+ * that isn't a string literal a compile error.
+ */
+#define LOG_SITE_(LVL, ARGS)                                                  \
+	do {                                                                  \
+		static struct log_site log_site_ = {                          \
+			LVL, __FILE__, __LINE__, LOG_MODULE, 0, 0, 0, NULL    \
+		};                                                            \
+		if ((LVL) <= LOG_LEVEL_COMPILED_MIN &&                        \
+		    (log_site_.gen == log_filter_gen_ ?                       \
+			     log_site_.enabled :                              \
+			     log_site_enabled_(&log_site_))) {                \
+			log_emit_site ARGS;                                   \
+		}                                                             \
+	} while (0)
+
+#define LOG_FMT_(FMT) "" FMT
+
+#define log_emerg(FMT) LOG_SITE_(LOG_LEVEL_EMERG, (&log_site_, LOG_FMT_(FMT)))
 #define log_emerg1(FMT, A1) \
-	log_emit(LOG_LEVEL_EMERG, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_EMERG, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_emerg2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_EMERG, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_EMERG, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_emerg3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_EMERG, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_EMERG, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_emerg4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_EMERG, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_EMERG, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_emerg5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_EMERG, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_EMERG, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_alert(FMT) log_emit(LOG_LEVEL_ALERT, __FILE__, __LINE__, FMT)
+#define log_alert(FMT) LOG_SITE_(LOG_LEVEL_ALERT, (&log_site_, LOG_FMT_(FMT)))
 #define log_alert1(FMT, A1) \
-	log_emit(LOG_LEVEL_ALERT, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_ALERT, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_alert2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_ALERT, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_ALERT, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_alert3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_ALERT, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_ALERT, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_alert4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_ALERT, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_ALERT, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_alert5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_ALERT, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_ALERT, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_crit(FMT) log_emit(LOG_LEVEL_CRIT, __FILE__, __LINE__, FMT)
-#define log_crit1(FMT, A1) log_emit(LOG_LEVEL_CRIT, __FILE__, __LINE__, FMT, A1)
+#define log_crit(FMT) LOG_SITE_(LOG_LEVEL_CRIT, (&log_site_, LOG_FMT_(FMT)))
+#define log_crit1(FMT, A1) \
+	LOG_SITE_(LOG_LEVEL_CRIT, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_crit2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_CRIT, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_CRIT, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_crit3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_CRIT, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_CRIT, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_crit4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_CRIT, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_CRIT, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_crit5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_CRIT, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_CRIT, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_err(FMT) log_emit(LOG_LEVEL_ERR, __FILE__, __LINE__, FMT)
-#define log_err1(FMT, A1) log_emit(LOG_LEVEL_ERR, __FILE__, __LINE__, FMT, A1)
+#define log_err(FMT) LOG_SITE_(LOG_LEVEL_ERR, (&log_site_, LOG_FMT_(FMT)))
+#define log_err1(FMT, A1) \
+	LOG_SITE_(LOG_LEVEL_ERR, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_err2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_ERR, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_ERR, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_err3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_ERR, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_ERR, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_err4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_ERR, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_ERR, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_err5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_ERR, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_ERR, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_warning(FMT) log_emit(LOG_LEVEL_WARNING, __FILE__, __LINE__, FMT)
+#define log_warning(FMT) \
+	LOG_SITE_(LOG_LEVEL_WARNING, (&log_site_, LOG_FMT_(FMT)))
 #define log_warning1(FMT, A1) \
-	log_emit(LOG_LEVEL_WARNING, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_WARNING, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_warning2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_WARNING, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_WARNING, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_warning3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_WARNING, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_WARNING, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_warning4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_WARNING, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_WARNING, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_warning5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_WARNING, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_WARNING, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_notice(FMT) log_emit(LOG_LEVEL_NOTICE, __FILE__, __LINE__, FMT)
+#define log_notice(FMT) LOG_SITE_(LOG_LEVEL_NOTICE, (&log_site_, LOG_FMT_(FMT)))
 #define log_notice1(FMT, A1) \
-	log_emit(LOG_LEVEL_NOTICE, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_NOTICE, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_notice2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_NOTICE, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_NOTICE, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_notice3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_NOTICE, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_NOTICE, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_notice4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_NOTICE, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_NOTICE, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_notice5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_NOTICE, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_NOTICE, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_info(FMT) log_emit(LOG_LEVEL_INFO, __FILE__, __LINE__, FMT)
-#define log_info1(FMT, A1) log_emit(LOG_LEVEL_INFO, __FILE__, __LINE__, FMT, A1)
+#define log_info(FMT) LOG_SITE_(LOG_LEVEL_INFO, (&log_site_, LOG_FMT_(FMT)))
+#define log_info1(FMT, A1) \
+	LOG_SITE_(LOG_LEVEL_INFO, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_info2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_INFO, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_INFO, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_info3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_INFO, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_INFO, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_info4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_INFO, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_INFO, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_info5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_INFO, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_INFO, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_debug(FMT) log_emit(LOG_LEVEL_DEBUG, __FILE__, __LINE__, FMT)
+#define log_debug(FMT) LOG_SITE_(LOG_LEVEL_DEBUG, (&log_site_, LOG_FMT_(FMT)))
 #define log_debug1(FMT, A1) \
-	log_emit(LOG_LEVEL_DEBUG, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_DEBUG, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_debug2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_DEBUG, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_DEBUG, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_debug3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_DEBUG, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_DEBUG, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_debug4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_DEBUG, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_DEBUG, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_debug5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_DEBUG, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_DEBUG, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
 #define log_emergency(FMT) \
-	log_emit(LOG_LEVEL_EMERGENCY, __FILE__, __LINE__, FMT)
+	LOG_SITE_(LOG_LEVEL_EMERGENCY, (&log_site_, LOG_FMT_(FMT)))
 #define log_emergency1(FMT, A1) \
-	log_emit(LOG_LEVEL_EMERGENCY, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_EMERGENCY, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_emergency2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_EMERGENCY, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_EMERGENCY, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_emergency3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_EMERGENCY, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_EMERGENCY, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_emergency4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_EMERGENCY, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
-#define log_emergency5(FMT, A1, A2, A3, A4, A5)                                \
-	log_emit(LOG_LEVEL_EMERGENCY, __FILE__, __LINE__, FMT, A1, A2, A3, A4, \
-		 A5)
+	LOG_SITE_(LOG_LEVEL_EMERGENCY, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
+#define log_emergency5(FMT, A1, A2, A3, A4, A5) \
+	LOG_SITE_(LOG_LEVEL_EMERGENCY, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_critical(FMT) log_emit(LOG_LEVEL_CRITICAL, __FILE__, __LINE__, FMT)
+#define log_critical(FMT) \
+	LOG_SITE_(LOG_LEVEL_CRITICAL, (&log_site_, LOG_FMT_(FMT)))
 #define log_critical1(FMT, A1) \
-	log_emit(LOG_LEVEL_CRITICAL, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_CRITICAL, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_critical2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_CRITICAL, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_CRITICAL, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_critical3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_CRITICAL, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_CRITICAL, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_critical4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_CRITICAL, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
-#define log_critical5(FMT, A1, A2, A3, A4, A5)                                \
-	log_emit(LOG_LEVEL_CRITICAL, __FILE__, __LINE__, FMT, A1, A2, A3, A4, \
-		 A5)
+	LOG_SITE_(LOG_LEVEL_CRITICAL, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
+#define log_critical5(FMT, A1, A2, A3, A4, A5) \
+	LOG_SITE_(LOG_LEVEL_CRITICAL, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_error(FMT) log_emit(LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT)
+#define log_error(FMT) LOG_SITE_(LOG_LEVEL_ERROR, (&log_site_, LOG_FMT_(FMT)))
 #define log_error1(FMT, A1) \
-	log_emit(LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT, A1)
+	LOG_SITE_(LOG_LEVEL_ERROR, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_error2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_ERROR, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_error3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_ERROR, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_error4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_ERROR, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_error5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_ERROR, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_ERROR, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
-#define log_warn(FMT) log_emit(LOG_LEVEL_WARN, __FILE__, __LINE__, FMT)
-#define log_warn1(FMT, A1) log_emit(LOG_LEVEL_WARN, __FILE__, __LINE__, FMT, A1)
+#define log_warn(FMT) LOG_SITE_(LOG_LEVEL_WARN, (&log_site_, LOG_FMT_(FMT)))
+#define log_warn1(FMT, A1) \
+	LOG_SITE_(LOG_LEVEL_WARN, (&log_site_, LOG_FMT_(FMT), A1))
 #define log_warn2(FMT, A1, A2) \
-	log_emit(LOG_LEVEL_WARN, __FILE__, __LINE__, FMT, A1, A2)
+	LOG_SITE_(LOG_LEVEL_WARN, (&log_site_, LOG_FMT_(FMT), A1, A2))
 #define log_warn3(FMT, A1, A2, A3) \
-	log_emit(LOG_LEVEL_WARN, __FILE__, __LINE__, FMT, A1, A2, A3)
+	LOG_SITE_(LOG_LEVEL_WARN, (&log_site_, LOG_FMT_(FMT), A1, A2, A3))
 #define log_warn4(FMT, A1, A2, A3, A4) \
-	log_emit(LOG_LEVEL_WARN, __FILE__, __LINE__, FMT, A1, A2, A3, A4)
+	LOG_SITE_(LOG_LEVEL_WARN, (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4))
 #define log_warn5(FMT, A1, A2, A3, A4, A5) \
-	log_emit(LOG_LEVEL_WARN, __FILE__, __LINE__, FMT, A1, A2, A3, A4, A5)
+	LOG_SITE_(LOG_LEVEL_WARN, \
+		  (&log_site_, LOG_FMT_(FMT), A1, A2, A3, A4, A5))
 
 #endif /* LOG_H */
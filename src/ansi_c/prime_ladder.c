@@ -0,0 +1,279 @@
+/* Generated by prime_ladder_gen.c - do not edit by hand.
+ * Regenerate with `make regen`. */
+
+#include <limits.h>
+#include <stddef.h>
+
+#include "prime_ladder.h"
+
+#define MAX_16BIT_UNSIGNED 65535UL
+#define MAX_32BIT_UNSIGNED 4294967295UL
+#define MAX_64BIT_UNSIGNED 18446744073709551615UL
+#if (ULONG_MAX != MAX_16BIT_UNSIGNED && ULONG_MAX != MAX_32BIT_UNSIGNED && \
+     ULONG_MAX != MAX_64BIT_UNSIGNED)
+#error Platform unsupported: ULONG_MAX not in (2^16-1, 2^32-1, 2^64-1)
+#endif
+
+const unsigned long prime_ladder[] = {
+	/* at least a 16-bit system - required by all ISO C standards */
+	2UL,
+	3UL,
+	5UL,
+	7UL,
+	11UL,
+	13UL,
+	19UL,
+	23UL,
+	31UL,
+	37UL,
+	43UL,
+	53UL,
+	61UL,
+	73UL,
+	89UL,
+	107UL,
+	127UL,
+	151UL,
+	181UL,
+	211UL,
+	251UL,
+	293UL,
+	359UL,
+	421UL,
+	509UL,
+	607UL,
+	719UL,
+	859UL,
+	1021UL,
+	1217UL,
+	1447UL,
+	1721UL,
+	2039UL,
+	2423UL,
+	2887UL,
+	3433UL,
+	4093UL,
+	4861UL,
+	5791UL,
+	6883UL,
+	8191UL,
+	9739UL,
+	11579UL,
+	13763UL,
+	16381UL,
+	19483UL,
+	23167UL,
+	27551UL,
+	32749UL,
+	38959UL,
+	46337UL,
+	55103UL,
+	65521UL
+
+#if ULONG_MAX > MAX_16BIT_UNSIGNED
+	/* at least a 32-bit system */
+
+	,
+	77933UL,
+	92681UL,
+	110183UL,
+	131071UL,
+	155863UL,
+	185363UL,
+	220421UL,
+	262139UL,
+	311743UL,
+	370723UL,
+	440863UL,
+	524287UL,
+	623477UL,
+	741431UL,
+	881743UL,
+	1048573UL,
+	1246963UL,
+	1482907UL,
+	1763477UL,
+	2097143UL,
+	2493947UL,
+	2965819UL,
+	3526949UL,
+	4194301UL,
+	4987891UL,
+	5931641UL,
+	7053911UL,
+	8388593UL,
+	9975773UL,
+	11863279UL,
+	14107889UL,
+	16777213UL,
+	19951579UL,
+	23726561UL,
+	28215799UL,
+	33554393UL,
+	39903161UL,
+	47453111UL,
+	56431601UL,
+	67108859UL,
+	79806317UL,
+	94906249UL,
+	112863197UL,
+	134217689UL,
+	159612653UL,
+	189812507UL,
+	225726379UL,
+	268435399UL,
+	319225331UL,
+	379625047UL,
+	451452823UL,
+	536870909UL,
+	638450677UL,
+	759250111UL,
+	902905643UL,
+	1073741789UL,
+	1276901389UL,
+	1518500213UL,
+	1805811263UL,
+	2147483647UL,
+	2553802819UL,
+	3037000493UL,
+	3611622593UL,
+	4294967291UL
+#endif
+
+#if ULONG_MAX > MAX_32BIT_UNSIGNED
+	/* at least a 64-bit system */
+
+	,
+	5107605623UL,
+	6074000981UL,
+	7223245193UL,
+	8589934583UL,
+	10215211333UL,
+	12148001963UL,
+	14446490407UL,
+	17179869143UL,
+	20430422659UL,
+	24296003933UL,
+	28892980777UL,
+	34359738337UL,
+	40860845323UL,
+	48592007969UL,
+	57785961617UL,
+	68719476731UL,
+	81721690669UL,
+	97184015963UL,
+	115571923283UL,
+	137438953447UL,
+	163443381347UL,
+	194368031953UL,
+	231143846573UL,
+	274877906899UL,
+	326886762677UL,
+	388736063993UL,
+	462287693117UL,
+	549755813881UL,
+	653773525333UL,
+	777472127983UL,
+	924575386247UL,
+	1099511627689UL,
+	1307547050737UL,
+	1554944255959UL,
+	1849150772647UL,
+	2199023255531UL,
+	2615094101531UL,
+	3109888511969UL,
+	3698301545273UL,
+	4398046511093UL,
+	5230188203083UL,
+	6219777023923UL,
+	7396603090601UL,
+	8796093022151UL,
+	10460376406211UL,
+	12439554047897UL,
+	14793206181211UL,
+	17592186044399UL,
+	20920752812471UL,
+	24879108095749UL,
+	29586412362443UL,
+	35184372088777UL,
+	41841505624913UL,
+	49758216191603UL,
+	59172824724859UL,
+	70368744177643UL,
+	83683011249863UL,
+	99516432383209UL,
+	118345649449801UL,
+	140737488355213UL,
+	167366022499763UL,
+	199032864766429UL,
+	236691298899611UL,
+	281474976710597UL,
+	334732044999523UL,
+	398065729532851UL,
+	473382597799219UL,
+	562949953421231UL,
+	669464089999057UL,
+	796131459065699UL,
+	946765195598449UL,
+	1125899906842597UL,
+	1338928179998131UL,
+	1592262918131383UL,
+	1893530391196903UL,
+	2251799813685119UL,
+	2677856359996211UL,
+	3184525836262811UL,
+	3787060782393809UL,
+	4503599627370449UL,
+	5355712719992567UL,
+	6369051672525769UL,
+	7574121564787573UL,
+	9007199254740881UL,
+	10711425439985191UL,
+	12738103345051531UL,
+	15148243129575239UL,
+	18014398509481951UL,
+	21422850879970333UL,
+	25476206690103077UL,
+	30296486259150427UL,
+	36028797018963913UL,
+	42845701759940687UL,
+	50952413380206119UL,
+	60592972518301031UL,
+	72057594037927931UL,
+	85691403519881507UL,
+	101904826760412233UL,
+	121185945036602063UL,
+	144115188075855859UL,
+	171382807039763093UL,
+	203809653520824713UL,
+	242371890073204097UL,
+	288230376151711717UL,
+	342765614079526163UL,
+	407619307041649457UL,
+	484743780146408207UL,
+	576460752303423433UL,
+	685531228159052309UL,
+	815238614083298939UL,
+	969487560292816501UL,
+	1152921504606846883UL,
+	1371062456318104831UL,
+	1630477228166597869UL,
+	1938975120585633019UL,
+	2305843009213693951UL,
+	2742124912636209641UL,
+	3260954456333195767UL,
+	3877950241171266041UL,
+	4611686018427387847UL,
+	5484249825272419297UL,
+	6521908912666391539UL,
+	7755900482342532011UL,
+	9223372036854775783UL,
+	10968499650544838639UL,
+	13043817825332783101UL,
+	15511800964685064181UL,
+	18446744073709551557UL
+#endif
+};
+
+const size_t prime_ladder_cap =
+	(sizeof(prime_ladder) / sizeof(*prime_ladder));
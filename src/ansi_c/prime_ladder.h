@@ -0,0 +1,19 @@
+#ifndef PRIME_LADDER_H
+#define PRIME_LADDER_H
+/* Ascending array of primes spaced roughly 2^(1/4) apart, from 2 up to the
+ * largest prime the system's unsigned long can hold. Each entry is the largest
+ * prime not exceeding its power of 2^(1/4).
+ *
+ * A denser alternative to prime_po2s for hashtable/hashset bucketing: picking
+ * the smallest sufficient entry overshoots the needed capacity by at most ~19%
+ * rather than ~100%.
+ *
+ * prime_ladder.c is generated by prime_ladder_gen.c.
+ */
+
+#include <stddef.h> /* for size_t */
+
+extern const unsigned long prime_ladder[];
+extern const size_t prime_ladder_cap;
+
+#endif /* PRIME_LADDER_H */
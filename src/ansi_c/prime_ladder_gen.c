@@ -0,0 +1,223 @@
+/* Generator for prime_ladder.c.
+ *
+ * Prints a C source file defining prime_ladder[]: for every k in [1, 256], the
+ * largest prime not exceeding 2^(k/4), deduplicated and ascending. Entries are
+ * grouped under the same 16/32/64-bit ULONG_MAX guards as prime_po2s.c so the
+ * table only contains what the target platform can represent.
+ *
+ * Must be run on a platform with a 64-bit unsigned long, as it needs to
+ * produce the 64-bit section as well.
+ *
+ * Usage: ./prime_ladder_gen > prime_ladder.c
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_16BIT_UNSIGNED 65535UL
+#define MAX_32BIT_UNSIGNED 4294967295UL
+#define MAX_64BIT_UNSIGNED 18446744073709551615UL
+#if ULONG_MAX != MAX_64BIT_UNSIGNED
+#error prime_ladder_gen must be built where unsigned long is 64 bits wide
+#endif
+
+/* Ladder steps per doubling. */
+#define STEPS_PER_PO2 4
+#define MAX_PO2 64
+
+/* (a + b) % m without overflowing, for a, b < m. */
+static unsigned long addmod(unsigned long a, unsigned long b, unsigned long m);
+
+/* (a * b) % m without overflowing, for a, b < m. */
+static unsigned long mulmod(unsigned long a, unsigned long b, unsigned long m);
+
+/* (b ^ e) % m without overflowing, for b < m. */
+static unsigned long powmod(unsigned long b, unsigned long e, unsigned long m);
+
+/* Deterministic Miller-Rabin for all 64-bit n. */
+static int is_prime(unsigned long n);
+
+/* Largest prime <= n, or 0 if there is none. */
+static unsigned long prime_at_most(unsigned long n);
+
+/* floor(2^(k / STEPS_PER_PO2)), saturating at ULONG_MAX. */
+static unsigned long ladder_target(unsigned k);
+
+int main(void)
+{
+	unsigned k;
+	unsigned long prev = 0;
+	int section = 16, first = 1;
+
+	printf("/* Generated by prime_ladder_gen.c - do not edit by hand.\n"
+	       " * Regenerate with `make regen`. */\n"
+	       "\n"
+	       "#include <limits.h>\n"
+	       "#include <stddef.h>\n"
+	       "\n"
+	       "#include \"prime_ladder.h\"\n"
+	       "\n");
+	printf("#define MAX_16BIT_UNSIGNED 65535UL\n"
+	       "#define MAX_32BIT_UNSIGNED 4294967295UL\n"
+	       "#define MAX_64BIT_UNSIGNED 18446744073709551615UL\n"
+	       "#if (ULONG_MAX != MAX_16BIT_UNSIGNED && "
+	       "ULONG_MAX != MAX_32BIT_UNSIGNED && \\\n"
+	       "     ULONG_MAX != MAX_64BIT_UNSIGNED)\n"
+	       "#error Platform unsupported: ULONG_MAX not in "
+	       "(2^16-1, 2^32-1, 2^64-1)\n"
+	       "#endif\n"
+	       "\n");
+	printf("const unsigned long prime_ladder[] = {\n"
+	       "\t/* at least a 16-bit system - required by all ISO C "
+	       "standards */\n");
+
+	for (k = 1; k <= STEPS_PER_PO2 * MAX_PO2; k++) {
+		unsigned long p = prime_at_most(ladder_target(k));
+
+		if (!p || p <= prev) {
+			continue;
+		}
+
+		if (section == 16 && p > MAX_16BIT_UNSIGNED) {
+			printf("\n\n#if ULONG_MAX > MAX_16BIT_UNSIGNED\n"
+			       "\t/* at least a 32-bit system */\n\n\t,\n");
+			section = 32;
+			first = 1;
+		}
+		if (section == 32 && p > MAX_32BIT_UNSIGNED) {
+			printf("\n#endif\n"
+			       "\n#if ULONG_MAX > MAX_32BIT_UNSIGNED\n"
+			       "\t/* at least a 64-bit system */\n\n\t,\n");
+			section = 64;
+			first = 1;
+		}
+
+		printf("%s\t%luUL", first ? "" : ",\n", p);
+		first = 0;
+		prev = p;
+	}
+
+	printf("\n#endif\n"
+	       "};\n"
+	       "\n"
+	       "const size_t prime_ladder_cap =\n"
+	       "\t(sizeof(prime_ladder) / sizeof(*prime_ladder));\n");
+
+	return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static unsigned long addmod(unsigned long a, unsigned long b, unsigned long m)
+{
+	if (a >= m - b) {
+		return a - (m - b);
+	}
+	return a + b;
+}
+
+static unsigned long mulmod(unsigned long a, unsigned long b, unsigned long m)
+{
+	unsigned long r = 0;
+
+	while (b) {
+		if (b & 1UL) {
+			r = addmod(r, a, m);
+		}
+		a = addmod(a, a, m);
+		b >>= 1;
+	}
+	return r;
+}
+
+static unsigned long powmod(unsigned long b, unsigned long e, unsigned long m)
+{
+	unsigned long r = 1UL % m;
+
+	while (e) {
+		if (e & 1UL) {
+			r = mulmod(r, b, m);
+		}
+		b = mulmod(b, b, m);
+		e >>= 1;
+	}
+	return r;
+}
+
+static int is_prime(unsigned long n)
+{
+	/* These bases are sufficient for a deterministic answer below 2^64. */
+	static const unsigned long bases[] = { 2,  3,  5,  7,  11, 13,
+					       17, 19, 23, 29, 31, 37 };
+	unsigned long d;
+	unsigned i, r, s;
+
+	if (n < 2) {
+		return 0;
+	}
+	for (i = 0; i < sizeof(bases) / sizeof(*bases); i++) {
+		if (n == bases[i]) {
+			return 1;
+		}
+		if (n % bases[i] == 0) {
+			return 0;
+		}
+	}
+
+	d = n - 1;
+	s = 0;
+	while (!(d & 1UL)) {
+		d >>= 1;
+		s++;
+	}
+
+	for (i = 0; i < sizeof(bases) / sizeof(*bases); i++) {
+		unsigned long x = powmod(bases[i], d, n);
+
+		if (x == 1 || x == n - 1) {
+			continue;
+		}
+		for (r = 1; r < s; r++) {
+			x = mulmod(x, x, n);
+			if (x == n - 1) {
+				break;
+			}
+		}
+		if (r == s) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static unsigned long prime_at_most(unsigned long n)
+{
+	for (; n >= 2; n--) {
+		if (is_prime(n)) {
+			return n;
+		}
+	}
+	return 0;
+}
+
+static unsigned long ladder_target(unsigned k)
+{
+	/* 2^(r/4) for r in [0, 4) */
+	static const double roots[STEPS_PER_PO2] = { 1.0, 1.18920711500272106,
+						     1.41421356237309505,
+						     1.68179283050742909 };
+	double target;
+	unsigned q = k / STEPS_PER_PO2, i;
+
+	if (q >= MAX_PO2) {
+		return ULONG_MAX;
+	}
+
+	target = roots[k % STEPS_PER_PO2];
+	for (i = 0; i < q; i++) {
+		target *= 2.0;
+	}
+	if (target >= (double)ULONG_MAX) {
+		return ULONG_MAX;
+	}
+	return (unsigned long)target;
+}
@@ -1,14 +1,52 @@
 #include <assert.h>
-#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "cpu.h"
+#include "hash.h"
 #include "str.h"
 
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
 #ifndef SIZE_MAX
 #define SIZE_MAX ((size_t)-1)
 #endif
 
+/* ASCII whitespace: what isspace() matches in the "C" locale. */
+#define IS_SPACE(c) \
+	((c) == ' ' || (unsigned)((unsigned char)(c) - '\t') < 5U)
+
+/* Portable implementations of str_lspace and str_rspace. */
+static size_t lspace_scalar(const char *s, size_t len);
+static size_t rspace_scalar(const char *s, size_t len);
+
+#ifdef CPU_X86
+/* Implementations scanning 16 or 32 bytes at a time. */
+static size_t lspace_sse2(const char *s, size_t len);
+static size_t rspace_sse2(const char *s, size_t len);
+static size_t lspace_avx2(const char *s, size_t len);
+static size_t rspace_avx2(const char *s, size_t len);
+#endif
+
+/* Start of the buffer currently holding the str_t's contents. */
+#define STR_T_BUF(s) ((s)->cap ? (s)->u.heap : (s)->u.inline_buf)
+
+/* Size of that buffer, including room for the terminator. */
+#define STR_T_BUF_CAP(s) ((s)->cap ? (s)->cap : sizeof((s)->u.inline_buf))
+
+/* Make room in the given str_t for extra more bytes plus a terminator,
+ * returning 0 on success or -1 on allocation failure. */
+static int str_t_reserve(str_t *s, size_t extra);
+
+/* Pick the best implementations for the running CPU on first use. */
+static size_t lspace_resolve(const char *s, size_t len);
+static size_t rspace_resolve(const char *s, size_t len);
+
+static size_t (*lspace_impl)(const char *s, size_t len) = lspace_resolve;
+static size_t (*rspace_impl)(const char *s, size_t len) = rspace_resolve;
+
 char *str_dup(const char *s)
 {
 	char *dup;
@@ -30,121 +68,447 @@ char *str_dup(const char *s)
 	return strcpy(dup, s);
 }
 
+size_t str_lspace(const char *s, size_t len)
+{
+	assert(s != NULL || !len);
+
+	return lspace_impl(s, len);
+}
+
+size_t str_rspace(const char *s, size_t len)
+{
+	assert(s != NULL || !len);
+
+	return rspace_impl(s, len);
+}
+
 size_t str_lstrip(char *s)
 {
-	char *cur, *first_nonspace;
+	assert(s != NULL);
+
+	return str_lstrip_len(s, strlen(s));
+}
+
+size_t str_lstrip_len(char *s, size_t len)
+{
+	size_t lead;
 
 	assert(s != NULL);
+	assert(s[len] == '\0');
 
-	/* Edge cases: we can tell from the first char there isn't whitespace to
-	 * strip. */
-	if (*s == '\0') {
-		return 0;
-	}
-	if (!isspace(*s)) {
-		return strlen(s);
+	lead = str_lspace(s, len);
+	if (lead) {
+		memmove(s, s + lead, len - lead + 1);
 	}
+	return len - lead;
+}
 
-	first_nonspace = NULL;
-	cur = s;
-	while (*cur != '\0') {
-		if (first_nonspace == NULL && !isspace(*cur)) {
-			first_nonspace = cur;
-		}
-		cur++;
+size_t str_rstrip(char *s)
+{
+	assert(s != NULL);
+
+	return str_rstrip_len(s, strlen(s));
+}
+
+size_t str_rstrip_len(char *s, size_t len)
+{
+	assert(s != NULL);
+	assert(s[len] == '\0');
+
+	len -= str_rspace(s, len);
+	s[len] = '\0';
+	return len;
+}
+
+size_t str_strip(char *s)
+{
+	assert(s != NULL);
+
+	return str_strip_len(s, strlen(s));
+}
+
+size_t str_strip_len(char *s, size_t len)
+{
+	size_t lead;
+
+	assert(s != NULL);
+	assert(s[len] == '\0');
+
+	lead = str_lspace(s, len);
+	len -= lead;
+	len -= str_rspace(s + lead, len);
+
+	if (lead) {
+		memmove(s, s + lead, len);
 	}
+	s[len] = '\0';
+	return len;
+}
 
-	if (first_nonspace == NULL) {
-		/* String is all whitespace. */
-		*s = '\0';
-		return 0;
+void str_t_init(str_t *s)
+{
+	assert(s != NULL);
+
+	s->len = s->off = s->cap = 0;
+	s->u.inline_buf[0] = '\0';
+}
+
+int str_t_init_cstring(str_t *s, const char *cs)
+{
+	assert(cs != NULL);
+
+	return str_t_init_len(s, cs, strlen(cs));
+}
+
+int str_t_init_len(str_t *s, const char *p, size_t len)
+{
+	str_t_init(s);
+
+	return str_t_append_len(s, p, len);
+}
+
+int str_t_dup(str_t *dst, const str_t *src)
+{
+	assert(src != NULL);
+
+	return str_t_init_len(dst, str_t_cstring(src), src->len);
+}
+
+void str_t_destroy(str_t *s)
+{
+	assert(s != NULL);
+
+	if (s->cap) {
+		free(s->u.heap);
 	}
+	str_t_init(s);
+}
+
+size_t str_t_len(const str_t *s)
+{
+	assert(s != NULL);
 
-	memmove(s, first_nonspace, cur - first_nonspace + 1);
-	return cur - first_nonspace;
+	return s->len;
 }
 
-size_t str_rstrip(char *s)
+const char *str_t_cstring(const str_t *s)
+{
+	assert(s != NULL);
+
+	return STR_T_BUF(s) + s->off;
+}
+
+char *str_t_to_cstring(const str_t *s)
 {
-	char *cur, *first_trailing_space;
+	char *cs;
 
 	assert(s != NULL);
 
-	first_trailing_space = NULL;
-	cur = s;
+	if (s->len >= SIZE_MAX) {
+		return NULL;
+	}
+	cs = malloc(s->len + 1);
+	if (cs == NULL) {
+		return NULL;
+	}
+
+	return memcpy(cs, str_t_cstring(s), s->len + 1);
+}
 
-	while (*cur != '\0') {
-		if (isspace(*cur)) {
-			if (first_trailing_space == NULL) {
-				first_trailing_space = cur;
-			}
-		} else {
-			first_trailing_space = NULL;
-		}
+int str_t_append(str_t *s, const str_t *other)
+{
+	char *dst;
+	size_t len;
 
-		cur++;
+	assert(s != NULL);
+	assert(other != NULL);
+
+	if (other != s) {
+		return str_t_append_len(s, str_t_cstring(other), other->len);
 	}
 
-	if (first_trailing_space == NULL) {
-		return cur - s;
+	/* Appending to itself: its contents may move while making room. */
+	len = s->len;
+	if (str_t_reserve(s, len)) {
+		return -1;
 	}
+	dst = STR_T_BUF(s) + s->off;
+	memcpy(dst + len, dst, len);
+	s->len += len;
+	dst[s->len] = '\0';
 
-	*first_trailing_space = '\0';
-	return first_trailing_space - s;
+	return 0;
 }
 
-size_t str_strip(char *s)
+int str_t_append_cstring(str_t *s, const char *cs)
 {
-	char *cur, *term, *lstrip_up_to, *rstrip_from;
+	assert(cs != NULL);
 
+	return str_t_append_len(s, cs, strlen(cs));
+}
+
+int str_t_append_len(str_t *s, const char *p, size_t len)
+{
+	char *dst;
+
+	assert(s != NULL);
+	assert(p != NULL || !len);
+
+	if (str_t_reserve(s, len)) {
+		return -1;
+	}
+
+	dst = STR_T_BUF(s) + s->off;
+	memcpy(dst + s->len, p, len);
+	s->len += len;
+	dst[s->len] = '\0';
+
+	return 0;
+}
+
+size_t str_t_lstrip(str_t *s)
+{
+	size_t lead;
+
+	assert(s != NULL);
+
+	lead = str_lspace(str_t_cstring(s), s->len);
+	s->off += lead;
+	s->len -= lead;
+
+	return s->len;
+}
+
+size_t str_t_rstrip(str_t *s)
+{
+	char *p;
+
+	assert(s != NULL);
+
+	p = STR_T_BUF(s) + s->off;
+	s->len -= str_rspace(p, s->len);
+	p[s->len] = '\0';
+
+	return s->len;
+}
+
+size_t str_t_strip(str_t *s)
+{
+	str_t_rstrip(s);
+	return str_t_lstrip(s);
+}
+
+int str_t_cmp(const str_t *a, const str_t *b)
+{
+	int cmp;
+
+	assert(a != NULL);
+	assert(b != NULL);
+
+	cmp = memcmp(str_t_cstring(a), str_t_cstring(b),
+		     a->len < b->len ? a->len : b->len);
+	if (cmp) {
+		return cmp;
+	}
+	if (a->len != b->len) {
+		return a->len < b->len ? -1 : 1;
+	}
+	return 0;
+}
+
+int str_t_eq(const str_t *a, const str_t *b)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+
+	return a->len == b->len &&
+	       !memcmp(str_t_cstring(a), str_t_cstring(b), a->len);
+}
+
+size_t str_t_hash(const str_t *s)
+{
 	assert(s != NULL);
 
-	if (*s == '\0') {
+	return hash_bytes_fnv_1a(str_t_cstring(s), s->len);
+}
+
+static int str_t_reserve(str_t *s, size_t extra)
+{
+	size_t need, new_cap;
+	char *buf;
+
+	/* s->len < SIZE_MAX, so neither side wraps */
+	if (extra >= SIZE_MAX - 1 - s->len) {
+		return -1;
+	}
+	need = s->len + extra + 1;
+
+	if (need <= STR_T_BUF_CAP(s) - s->off) {
 		return 0;
 	}
 
-	lstrip_up_to = NULL;
-	rstrip_from = NULL;
-	cur = s;
-	while (*cur != '\0') {
-		if (isspace(*cur)) {
-			/* If we haven't seen a space yet, this may be the start
-			 * of the trailing whitespace. */
-			if (rstrip_from == NULL) {
-				rstrip_from = cur;
-			}
-		} else {
-			/* If we're looking at a non-space, we were not in
-			 * trailing whitespace. */
-			rstrip_from = NULL;
-
-			/* Record the first nonspace character we see to lstrip
-			 * later. */
-			if (lstrip_up_to == NULL) {
-				lstrip_up_to = cur;
-			}
+	if (need > STR_T_BUF_CAP(s)) {
+		new_cap = need;
+		if (s->cap <= SIZE_MAX / 2 && s->cap * 2 > need) {
+			new_cap = s->cap * 2;
 		}
 
-		cur++;
-	}
-	if (lstrip_up_to == NULL) {
-		/* String is entirely whitespace - make it emptystring. */
-		*s = '\0';
+		buf = malloc(new_cap);
+		if (buf == NULL) {
+			return -1;
+		}
+		memcpy(buf, STR_T_BUF(s) + s->off, s->len + 1);
+
+		if (s->cap) {
+			free(s->u.heap);
+		}
+		s->u.heap = buf;
+		s->cap = new_cap;
+		s->off = 0;
 		return 0;
 	}
 
-	term = cur;
+	/* Enough room if we reclaim what lstrip skipped over. */
+	buf = STR_T_BUF(s);
+	memmove(buf, buf + s->off, s->len + 1);
+	s->off = 0;
+	return 0;
+}
 
-	if (rstrip_from != NULL) {
-		/* Trailing whitespace was found. Trim it. */
-		*rstrip_from = '\0';
-		term = rstrip_from;
+static size_t lspace_scalar(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len && IS_SPACE(s[i]); i++) {
+	}
+	return i;
+}
+
+static size_t rspace_scalar(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = len; i > 0 && IS_SPACE(s[i - 1]); i--) {
+	}
+	return len - i;
+}
+
+#ifdef CPU_X86
+/*
+ * The vector paths compute a mask of non-whitespace bytes: a byte b is
+ * whitespace if b == ' ' or (b - '\t') is at most 4 when taken unsigned, the
+ * latter tested as min(b - '\t', 4) == b - '\t'.
+ *
+ * They only load whole blocks within [s, s + len), leaving what remains at the
+ * ends to the scalar scans, so they never read outside the string.
+ */
+
+__attribute__((target("sse2"))) static unsigned
+nonspace_mask_sse2(__m128i v)
+{
+	__m128i sp, ctl;
+
+	sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	ctl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+	ctl = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(4)), ctl);
+	return ~(unsigned)_mm_movemask_epi8(_mm_or_si128(sp, ctl)) & 0xFFFFU;
+}
+
+__attribute__((target("sse2"))) static size_t lspace_sse2(const char *s,
+							    size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		unsigned mask = nonspace_mask_sse2(
+			_mm_loadu_si128((const __m128i *)(s + i)));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
 	}
+	return i + lspace_scalar(s + i, len - i);
+}
+
+__attribute__((target("sse2"))) static size_t rspace_sse2(const char *s,
+							    size_t len)
+{
+	size_t i;
 
-	if (lstrip_up_to != s) {
-		/* leading whitespace was found. Shift the string left. */
-		memmove(s, lstrip_up_to, term - lstrip_up_to + 1);
+	for (i = len; i >= 16; i -= 16) {
+		unsigned mask = nonspace_mask_sse2(
+			_mm_loadu_si128((const __m128i *)(s + i - 16)));
+		if (mask) {
+			return len - (i - 16 + 32 - __builtin_clz(mask));
+		}
 	}
+	return len - i + rspace_scalar(s, i);
+}
 
-	return term - lstrip_up_to;
+__attribute__((target("avx2"))) static unsigned
+nonspace_mask_avx2(__m256i v)
+{
+	__m256i sp, ctl;
+
+	sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+	ctl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+	ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, _mm256_set1_epi8(4)),
+				ctl);
+	return ~(unsigned)_mm256_movemask_epi8(_mm256_or_si256(sp, ctl));
+}
+
+__attribute__((target("avx2"))) static size_t lspace_avx2(const char *s,
+							    size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		unsigned mask = nonspace_mask_avx2(
+			_mm256_loadu_si256((const __m256i *)(s + i)));
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + lspace_scalar(s + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t rspace_avx2(const char *s,
+							    size_t len)
+{
+	size_t i;
+
+	for (i = len; i >= 32; i -= 32) {
+		unsigned mask = nonspace_mask_avx2(
+			_mm256_loadu_si256((const __m256i *)(s + i - 32)));
+		if (mask) {
+			return len - (i - 32 + 32 - __builtin_clz(mask));
+		}
+	}
+	return len - i + rspace_scalar(s, i);
+}
+#endif /* CPU_X86 */
+
+static size_t lspace_resolve(const char *s, size_t len)
+{
+	lspace_impl = lspace_scalar;
+#ifdef CPU_X86
+	if (cpu_has(CPU_FEATURE_AVX2)) {
+		lspace_impl = lspace_avx2;
+	} else if (cpu_has(CPU_FEATURE_SSE2)) {
+		lspace_impl = lspace_sse2;
+	}
+#endif
+	return lspace_impl(s, len);
+}
+
+static size_t rspace_resolve(const char *s, size_t len)
+{
+	rspace_impl = rspace_scalar;
+#ifdef CPU_X86
+	if (cpu_has(CPU_FEATURE_AVX2)) {
+		rspace_impl = rspace_avx2;
+	} else if (cpu_has(CPU_FEATURE_SSE2)) {
+		rspace_impl = rspace_sse2;
+	}
+#endif
+	return rspace_impl(s, len);
 }
@@ -3,17 +3,107 @@
 
 #include <stddef.h>
 
+/*
+ * Whitespace here is ASCII whitespace (what isspace() matches in the "C"
+ * locale), regardless of the current locale. Scanning for it uses SSE2/AVX2
+ * where the running CPU supports them.
+ *
+ * The _len variants take the string's known length (which must be its
+ * strlen), sparing a scan for the terminator.
+ */
+
 /* Duplicate the given string. */
 char *str_dup(const char *s);
 
+/* Count the whitespace characters at the start of the given len bytes. */
+size_t str_lspace(const char *s, size_t len);
+
+/* Count the whitespace characters at the end of the given len bytes. */
+size_t str_rspace(const char *s, size_t len);
+
 /* Remove leading whitespace from the given string, returning its new length. */
 size_t str_lstrip(char *s);
+size_t str_lstrip_len(char *s, size_t len);
 
-/* Remove leading whitespace from the given string, returning its new length. */
+/* Remove trailing whitespace from the given string, returning its new length. */
 size_t str_rstrip(char *s);
+size_t str_rstrip_len(char *s, size_t len);
 
 /* Remove leading and trailing whitespace from the given string, returning its
  * new length. */
 size_t str_strip(char *s);
+size_t str_strip_len(char *s, size_t len);
+
+/*
+ * A length-carrying string. Short contents live inline in the struct itself;
+ * longer ones on the heap. Contents are always NUL-terminated, so they can be
+ * handed to anything wanting a C string, but may also contain NULs.
+ *
+ * The struct is exposed so it can live on the stack or inside other structs,
+ * but its fields are private - use the str_t_* functions.
+ *
+ * Functions returning int return 0 on success, or -1 if allocation failed (in
+ * which case the str_t is left unchanged).
+ */
+
+#ifndef STR_T_INLINE_CAP
+#define STR_T_INLINE_CAP 23
+#endif
+
+typedef struct str_t {
+	size_t len; /* excluding terminator */
+	size_t off; /* start of contents in the buffer - lstrip advances it */
+	size_t cap; /* heap buffer size, or 0 while contents are inline */
+	union {
+		char *heap;
+		char inline_buf[STR_T_INLINE_CAP + 1];
+	} u;
+} str_t;
+
+/* Initialize the given str_t to the empty string. */
+void str_t_init(str_t *s);
+
+/* Initialize the given str_t to a copy of the given C string, or of the given
+ * len bytes. */
+int str_t_init_cstring(str_t *s, const char *cs);
+int str_t_init_len(str_t *s, const char *p, size_t len);
+
+/* Initialize dst to a copy of src. */
+int str_t_dup(str_t *dst, const str_t *src);
+
+/* Release any memory held by the given str_t. It may be re-initialized. */
+void str_t_destroy(str_t *s);
+
+size_t str_t_len(const str_t *s);
+
+/* Borrow the contents as a C string. Valid until the str_t is next modified. */
+const char *str_t_cstring(const str_t *s);
+
+/* Return a malloc'd copy of the contents as a C string, or NULL if allocation
+ * failed. */
+char *str_t_to_cstring(const str_t *s);
+
+/* Append to the given str_t. other may be s itself, but the bytes given to the
+ * _cstring and _len variants must not come from s. */
+int str_t_append(str_t *s, const str_t *other);
+int str_t_append_cstring(str_t *s, const char *cs);
+int str_t_append_len(str_t *s, const char *p, size_t len);
+
+/* Strip whitespace, returning the new length. No bytes are moved: leading
+ * whitespace is skipped over, and trailing whitespace is cut off. */
+size_t str_t_lstrip(str_t *s);
+size_t str_t_rstrip(str_t *s);
+size_t str_t_strip(str_t *s);
+
+/* Compare bytewise, returning <0, 0, or >0 like memcmp. A proper prefix sorts
+ * first. */
+int str_t_cmp(const str_t *a, const str_t *b);
+
+/* Return non-zero if the two hold the same bytes. */
+int str_t_eq(const str_t *a, const str_t *b);
+
+/* Hash the contents with hash_bytes_fnv_1a. Equal to hash_cstring_fnv_1a of
+ * str_t_cstring() when there are no embedded NULs. */
+size_t str_t_hash(const str_t *s);
 
 #endif /* STR_H */
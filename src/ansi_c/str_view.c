@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "hash.h"
+#include "str.h"
+#include "str_view.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#define DELIM_SET_HAS(it, c)                              \
+	((it)->delim_set[(unsigned char)(c) / CHAR_BIT] & \
+	 (1U << ((unsigned char)(c) % CHAR_BIT)))
+
+/* Point the given iterator at the start of v, with no delimiters. */
+static void split_reset(str_view_split_t *it, str_view_t v);
+
+/* Add delim to the given iterator's delimiter set. */
+static void split_add_delim(str_view_split_t *it, char delim);
+
+/*
+ * Return a pointer to the first delimiter in [p, end), or end if there is
+ * none.
+ */
+static const char *find_delim(const str_view_split_t *it, const char *p,
+			      const char *end);
+
+/* Portable implementation of find_delim for delimiter sets. */
+static const char *find_any_scalar(const str_view_split_t *it, const char *p,
+				   const char *end);
+
+#ifdef CPU_X86
+/* Implementation of find_delim for delimiter sets of up to
+ * STR_VIEW_SPLIT_VEC_MAX, comparing against each 16 bytes at a time. */
+static const char *find_any_sse2(const str_view_split_t *it, const char *p,
+				 const char *end);
+#endif
+
+/* Pick the best implementation for the running CPU on first use. */
+static const char *find_any_resolve(const str_view_split_t *it, const char *p,
+				    const char *end);
+
+static const char *(*find_any_impl)(const str_view_split_t *it, const char *p,
+				    const char *end) = find_any_resolve;
+
+str_view_t str_view_make(const char *p, size_t len)
+{
+	str_view_t v;
+
+	assert(p != NULL || !len);
+
+	v.ptr = p;
+	v.len = len;
+	return v;
+}
+
+str_view_t str_view_from_cstring(const char *cs)
+{
+	assert(cs != NULL);
+
+	return str_view_make(cs, strlen(cs));
+}
+
+str_view_t str_view_from_str_t(const str_t *s)
+{
+	return str_view_make(str_t_cstring(s), str_t_len(s));
+}
+
+str_view_t str_view_lstrip(str_view_t v)
+{
+	size_t lead = str_lspace(v.ptr, v.len);
+
+	return str_view_make(v.ptr + lead, v.len - lead);
+}
+
+str_view_t str_view_rstrip(str_view_t v)
+{
+	return str_view_make(v.ptr, v.len - str_rspace(v.ptr, v.len));
+}
+
+str_view_t str_view_strip(str_view_t v)
+{
+	return str_view_lstrip(str_view_rstrip(v));
+}
+
+int str_view_cmp(str_view_t a, str_view_t b)
+{
+	int cmp;
+
+	cmp = memcmp(a.ptr, b.ptr, a.len < b.len ? a.len : b.len);
+	if (cmp) {
+		return cmp;
+	}
+	if (a.len != b.len) {
+		return a.len < b.len ? -1 : 1;
+	}
+	return 0;
+}
+
+int str_view_eq(str_view_t a, str_view_t b)
+{
+	return a.len == b.len && !memcmp(a.ptr, b.ptr, a.len);
+}
+
+size_t str_view_hash(str_view_t v)
+{
+	return hash_bytes_fnv_1a(v.ptr, v.len);
+}
+
+int str_view_htable_hash(void *p)
+{
+	assert(p != NULL);
+
+	return (int)str_view_hash(*(str_view_t *)p);
+}
+
+int str_view_htable_eq(void *a, void *b)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+
+	return str_view_eq(*(str_view_t *)a, *(str_view_t *)b);
+}
+
+void str_view_split_init(str_view_split_t *it, str_view_t v, char delim)
+{
+	split_reset(it, v);
+	split_add_delim(it, delim);
+}
+
+void str_view_split_init_any(str_view_split_t *it, str_view_t v,
+			     const char *delims)
+{
+	assert(delims != NULL);
+
+	split_reset(it, v);
+	for (; *delims != '\0'; delims++) {
+		split_add_delim(it, *delims);
+	}
+}
+
+int str_view_split_next(str_view_split_t *it, str_view_t *field)
+{
+	const char *delim;
+
+	assert(it != NULL);
+	assert(field != NULL);
+
+	if (it->done) {
+		return 0;
+	}
+
+	delim = find_delim(it, it->cur, it->end);
+	*field = str_view_make(it->cur, (size_t)(delim - it->cur));
+
+	if (delim == it->end) {
+		it->done = 1;
+	} else {
+		it->cur = delim + 1;
+	}
+	return 1;
+}
+
+static void split_reset(str_view_split_t *it, str_view_t v)
+{
+	assert(it != NULL);
+
+	it->cur = v.ptr;
+	it->end = v.ptr + v.len;
+	it->done = 0;
+	it->n_delims = 0;
+	memset(it->delim_set, 0, sizeof(it->delim_set));
+}
+
+static void split_add_delim(str_view_split_t *it, char delim)
+{
+	if (DELIM_SET_HAS(it, delim)) {
+		return;
+	}
+
+	it->delim_set[(unsigned char)delim / CHAR_BIT] |=
+		1U << ((unsigned char)delim % CHAR_BIT);
+	if (it->n_delims < STR_VIEW_SPLIT_VEC_MAX) {
+		it->delims[it->n_delims] = delim;
+	}
+	it->n_delims++;
+}
+
+static const char *find_delim(const str_view_split_t *it, const char *p,
+			      const char *end)
+{
+	const char *found;
+
+	switch (it->n_delims) {
+	case 0:
+		return end;
+	case 1:
+		/* libc's memchr is already vectorized */
+		found = memchr(p, it->delims[0], (size_t)(end - p));
+		return found != NULL ? found : end;
+	default:
+		return find_any_impl(it, p, end);
+	}
+}
+
+static const char *find_any_scalar(const str_view_split_t *it, const char *p,
+				   const char *end)
+{
+	while (p < end && !DELIM_SET_HAS(it, *p)) {
+		p++;
+	}
+	return p;
+}
+
+#ifdef CPU_X86
+__attribute__((target("sse2"))) static const char *
+find_any_sse2(const str_view_split_t *it, const char *p, const char *end)
+{
+	__m128i delims[STR_VIEW_SPLIT_VEC_MAX];
+	size_t i;
+
+	if (it->n_delims > STR_VIEW_SPLIT_VEC_MAX) {
+		return find_any_scalar(it, p, end);
+	}
+
+	for (i = 0; i < it->n_delims; i++) {
+		delims[i] = _mm_set1_epi8(it->delims[i]);
+	}
+
+	for (; end - p >= 16; p += 16) {
+		__m128i v, hits;
+		unsigned mask;
+
+		v = _mm_loadu_si128((const __m128i *)p);
+		hits = _mm_cmpeq_epi8(v, delims[0]);
+		for (i = 1; i < it->n_delims; i++) {
+			hits = _mm_or_si128(hits, _mm_cmpeq_epi8(v, delims[i]));
+		}
+
+		mask = (unsigned)_mm_movemask_epi8(hits);
+		if (mask) {
+			return p + __builtin_ctz(mask);
+		}
+	}
+
+	return find_any_scalar(it, p, end);
+}
+#endif /* CPU_X86 */
+
+static const char *find_any_resolve(const str_view_split_t *it, const char *p,
+				    const char *end)
+{
+	find_any_impl = find_any_scalar;
+#ifdef CPU_X86
+	if (cpu_has(CPU_FEATURE_SSE2)) {
+		find_any_impl = find_any_sse2;
+	}
+#endif
+	return find_any_impl(it, p, end);
+}
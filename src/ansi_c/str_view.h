@@ -0,0 +1,82 @@
+#ifndef STR_VIEW_H
+#define STR_VIEW_H
+
+/* Non-owning, non-mutating views into strings: a pointer and a length. The
+ * viewed bytes need not be NUL-terminated, and must outlive the view. */
+
+#include <limits.h> /* for UCHAR_MAX, CHAR_BIT */
+#include <stddef.h>
+
+#include "str.h"
+
+typedef struct str_view_t {
+	const char *ptr;
+	size_t len;
+} str_view_t;
+
+str_view_t str_view_make(const char *p, size_t len);
+str_view_t str_view_from_cstring(const char *cs);
+str_view_t str_view_from_str_t(const str_t *s);
+
+/* Return the view with leading/trailing/both whitespace (as in str.h) left
+ * out. */
+str_view_t str_view_lstrip(str_view_t v);
+str_view_t str_view_rstrip(str_view_t v);
+str_view_t str_view_strip(str_view_t v);
+
+/* Compare bytewise, returning <0, 0, or >0 like memcmp. A proper prefix sorts
+ * first. */
+int str_view_cmp(str_view_t a, str_view_t b);
+
+/* Return non-zero if the two views hold the same bytes. */
+int str_view_eq(str_view_t a, str_view_t b);
+
+/* Hash the viewed bytes with hash_bytes_fnv_1a - the same as str_t_hash, and as
+ * hash_cstring_fnv_1a of the same string. */
+size_t str_view_hash(str_view_t v);
+
+/* htable_hash_fn/htable_cmp_fn for htable_t keys that are str_view_t pointers,
+ * so a table can be looked up with a view on the stack rather than an
+ * allocated copy. */
+int str_view_htable_hash(void *p);
+int str_view_htable_eq(void *a, void *b);
+
+/*
+ * Iterator over the fields of a view separated by a delimiter, or any of a set
+ * of delimiters. Adjacent delimiters produce empty fields (unlike strtok), and
+ * a view with no delimiters is a single field.
+ *
+ * Usage:
+ *
+ *     str_view_split_t it;
+ *     str_view_t field;
+ *
+ *     str_view_split_init(&it, line, ',');
+ *     while (str_view_split_next(&it, &field)) {
+ *             ...
+ *     }
+ */
+
+#define STR_VIEW_SPLIT_VEC_MAX 8
+
+typedef struct str_view_split_t {
+	const char *cur, *end;
+	int done;
+
+	/* delimiter set, as a list (for vector scanning) and as a bitmap */
+	size_t n_delims;
+	char delims[STR_VIEW_SPLIT_VEC_MAX];
+	unsigned char delim_set[(UCHAR_MAX + 1) / CHAR_BIT];
+} str_view_split_t;
+
+void str_view_split_init(str_view_split_t *it, str_view_t v, char delim);
+
+/* Split on any of the characters in the given NUL-terminated set. */
+void str_view_split_init_any(str_view_split_t *it, str_view_t v,
+			     const char *delims);
+
+/* Store the next field in *field and return non-zero, or return 0 if there
+ * are no more fields. */
+int str_view_split_next(str_view_split_t *it, str_view_t *field);
+
+#endif /* STR_VIEW_H */
@@ -0,0 +1,388 @@
+/* Benchmark of logging cost, as seen by the threads logging.
+ *
+ * For each sink (the default stdio one, log_fd, log_async and log_binary),
+ * target (/dev/null, a temporary file, and a pipe drained by another thread)
+ * and number of threads (1, 2, 4, ... up to -t), each thread logs -n records
+ * at a level that is enabled, then at one that is filtered out. Reported are:
+ *
+ *	ns/rec     mean caller-side time per record
+ *	Mrec/s     records per second overall, until flushed
+ *	p50 ...    caller-side latency percentiles, in ns
+ *	wr/rec     write system calls per record, from /proc/self/io
+ *
+ * Latencies include reading the clock, whose cost is printed first. Filtered
+ * records are timed in bulk, as they cost less than that; they get no
+ * percentiles.
+ *
+ * Usage: ./bench_log [-n records] [-t threads] [-d dir for the file]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "log_async.h"
+#include "log_binary.h"
+#include "log_fd.h"
+
+#define ASYNC_SLOTS 4096
+
+enum sink { SINK_STDIO, SINK_FD, SINK_ASYNC, SINK_BINARY, N_SINKS };
+enum target { TARGET_NULL, TARGET_FILE, TARGET_PIPE, N_TARGETS };
+
+static const char *const sink_names[N_SINKS] = { "stdio", "fd", "async",
+						 "binary" };
+static const char *const target_names[N_TARGETS] = { "/dev/null", "file",
+						     "pipe" };
+
+struct worker {
+	pthread_t thread;
+	size_t n;
+	int filtered;
+	long *lat; /* per record, ns; NULL when filtered */
+	long total; /* ns */
+};
+
+static const char *prog = "bench_log";
+static const char *dir = ".";
+static FILE *saved_file;
+
+/* Print an error and exit. */
+static void die(const char *what);
+
+static long now_ns(void);
+
+/* Write system calls made by the process so far, or -1 if unknown. */
+static long write_syscalls(void);
+
+/* Open the target, returning a file descriptor to log to. A pipe gets a
+ * thread draining it into *drainer. */
+static int open_target(enum target target, pthread_t *drainer);
+static void close_target(enum target target, int fd, pthread_t drainer);
+static void *drain_main(void *arg);
+
+static void start_sink(enum sink sink, int fd);
+static void stop_sink(enum sink sink);
+
+/* Time one configuration, and print its line. */
+static void run(enum sink sink, enum target target, size_t threads,
+		size_t n, int filtered);
+static void *worker_main(void *arg);
+
+static int cmp_long(const void *a, const void *b);
+
+int main(int argc, char **argv)
+{
+	size_t n = 100000, max_threads = 4, threads;
+	long t0, t1;
+	int sink, target, opt, i;
+
+	while ((opt = getopt(argc, argv, "n:t:d:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n records] [-t threads] "
+					"[-d dir]\n",
+				prog);
+			return 2;
+		}
+	}
+	if (!n || !max_threads) {
+		fprintf(stderr, "%s: -n and -t must be at least 1\n", prog);
+		return 2;
+	}
+
+	saved_file = log_file();
+	log_level_set(LOG_LEVEL_INFO);
+
+	t0 = now_ns();
+	for (i = 0; i < 1000000; i++) {
+		(void)now_ns();
+	}
+	t1 = now_ns();
+	printf("# clock read: %ld ns; %zu records per thread\n",
+	       (t1 - t0) / 1000000, n);
+	printf("%-7s %-10s %-9s %7s %8s %8s %7s %7s %7s %7s\n", "sink",
+	       "target", "level", "threads", "ns/rec", "Mrec/s", "p50", "p99",
+	       "p999", "wr/rec");
+
+	for (sink = 0; sink < N_SINKS; sink++) {
+		for (target = 0; target < N_TARGETS; target++) {
+			for (threads = 1; threads <= max_threads;
+			     threads *= 2) {
+				run(sink, target, threads, n, 0);
+				run(sink, target, threads, n, 1);
+			}
+		}
+	}
+
+	if (fflush(stdout)) {
+		die("write");
+	}
+	return 0;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long write_syscalls(void)
+{
+	char line[64];
+	long n = -1;
+	FILE *f;
+
+	f = fopen("/proc/self/io", "r");
+	if (f == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "syscw: %ld", &n) == 1) {
+			break;
+		}
+	}
+	fclose(f);
+	return n;
+}
+
+static int open_target(enum target target, pthread_t *drainer)
+{
+	char path[4096];
+	int fds[2], fd;
+
+	switch (target) {
+	case TARGET_NULL:
+		fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		if (fd < 0) {
+			die("/dev/null");
+		}
+		return fd;
+	case TARGET_FILE:
+		snprintf(path, sizeof(path), "%s/bench_log.XXXXXX", dir);
+		fd = mkstemp(path);
+		if (fd < 0) {
+			die(path);
+		}
+		unlink(path);
+		return fd;
+	case TARGET_PIPE:
+		if (pipe(fds)) {
+			die("pipe");
+		}
+		errno = pthread_create(drainer, NULL, drain_main,
+				       (void *)(intptr_t)fds[0]);
+		if (errno) {
+			die("pthread_create");
+		}
+		return fds[1];
+	default:
+		abort();
+	}
+}
+
+static void close_target(enum target target, int fd, pthread_t drainer)
+{
+	close(fd);
+	if (target == TARGET_PIPE) {
+		pthread_join(drainer, NULL);
+	}
+}
+
+static void *drain_main(void *arg)
+{
+	static char buf[65536]; /* only ever one drainer */
+	int fd = (int)(intptr_t)arg;
+
+	for (;;) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+
+		if (n == 0 || (n < 0 && errno != EINTR)) {
+			break;
+		}
+	}
+	close(fd);
+	return NULL;
+}
+
+static void start_sink(enum sink sink, int fd)
+{
+	FILE *f;
+	int rc = 0;
+
+	switch (sink) {
+	case SINK_STDIO:
+		f = fdopen(dup(fd), "w");
+		if (f == NULL) {
+			die("fdopen");
+		}
+		log_file_set(f);
+		break;
+	case SINK_FD:
+		rc = log_fd_start(fd);
+		break;
+	case SINK_ASYNC:
+		rc = log_async_start(fd, ASYNC_SLOTS, LOG_ASYNC_BLOCK);
+		break;
+	case SINK_BINARY:
+		rc = log_binary_start(fd);
+		break;
+	default:
+		abort();
+	}
+	if (rc) {
+		fprintf(stderr, "%s: couldn't start the %s sink\n", prog,
+			sink_names[sink]);
+		exit(1);
+	}
+}
+
+static void stop_sink(enum sink sink)
+{
+	switch (sink) {
+	case SINK_STDIO:
+		fclose(log_file());
+		log_file_set(saved_file);
+		break;
+	case SINK_FD:
+		log_fd_stop();
+		break;
+	case SINK_ASYNC:
+		log_async_stop();
+		break;
+	case SINK_BINARY:
+		log_binary_stop();
+		break;
+	default:
+		abort();
+	}
+}
+
+static void run(enum sink sink, enum target target, size_t threads,
+		size_t n, int filtered)
+{
+	struct worker *w;
+	pthread_t drainer;
+	long t0, t1, sc0, sc1, *lat = NULL, total = 0;
+	size_t i, records = threads * n;
+	int fd;
+
+	w = calloc(threads, sizeof(*w));
+	if (w == NULL) {
+		die("calloc");
+	}
+	for (i = 0; i < threads; i++) {
+		w[i].n = n;
+		w[i].filtered = filtered;
+	}
+	if (!filtered) {
+		lat = malloc(records * sizeof(*lat));
+		if (lat == NULL) {
+			die("malloc");
+		}
+		for (i = 0; i < threads; i++) {
+			w[i].lat = lat + i * n;
+		}
+	}
+
+	fd = open_target(target, &drainer);
+	start_sink(sink, fd);
+
+	sc0 = write_syscalls();
+	t0 = now_ns();
+	for (i = 0; i < threads; i++) {
+		errno = pthread_create(&w[i].thread, NULL, worker_main, &w[i]);
+		if (errno) {
+			die("pthread_create");
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(w[i].thread, NULL);
+		total += w[i].total;
+	}
+	log_flush();
+	t1 = now_ns();
+	sc1 = write_syscalls();
+
+	stop_sink(sink);
+	close_target(target, fd, drainer);
+
+	printf("%-7s %-10s %-9s %7zu %8.1f %8.2f", sink_names[sink],
+	       target_names[target], filtered ? "filtered" : "enabled", threads,
+	       (double)total / (double)records,
+	       (double)records * 1000.0 / (double)(t1 - t0));
+	if (lat != NULL) {
+		qsort(lat, records, sizeof(*lat), cmp_long);
+		printf(" %7ld %7ld %7ld", lat[(records - 1) / 2],
+		       lat[(records - 1) * 99 / 100],
+		       lat[(records - 1) * 999 / 1000]);
+	} else {
+		printf(" %7s %7s %7s", "-", "-", "-");
+	}
+	if (sc0 >= 0 && sc1 >= 0) {
+		printf(" %7.3f\n", (double)(sc1 - sc0) / (double)records);
+	} else {
+		printf(" %7s\n", "-");
+	}
+	fflush(stdout);
+
+	free(lat);
+	free(w);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	long t0, t1;
+	size_t i;
+
+	if (w->filtered) {
+		t0 = now_ns();
+		for (i = 0; i < w->n; i++) {
+			log_debug2("bench record %zu of %s", i, "bench_log");
+		}
+		w->total = now_ns() - t0;
+		return NULL;
+	}
+
+	for (i = 0; i < w->n; i++) {
+		t0 = now_ns();
+		log_info2("bench record %zu of %s", i, "bench_log");
+		t1 = now_ns();
+		w->lat[i] = t1 - t0;
+		w->total += t1 - t0;
+	}
+	return NULL;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return x < y ? -1 : x > y;
+}
@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "line_reader.h"
+#include "str_view.h"
+
+struct line_reader_t {
+	int fd, owns_fd, flags;
+	size_t lineno;
+
+	/* Mapped files: the whole file, read up to pos, and advised as needed
+	 * up to advised. */
+	const char *map;
+	size_t map_len, pos, advised;
+
+	/* Otherwise: data from start to end, of which up to scanned has no
+	 * newline. */
+	char *buf;
+	size_t cap, start, end, scanned;
+	int eof;
+};
+
+/* Map fd if it is a regular file that will map, returning 0, or -1 to read it
+ * instead. */
+static int try_map(line_reader_t *lr);
+
+static int next_mapped(line_reader_t *lr, str_view_t *line);
+static int next_read(line_reader_t *lr, str_view_t *line);
+
+/* Read more into the buffer, first moving what is left to the front and
+ * growing it if full. Returns 0, or -1 on error. */
+static int fill(line_reader_t *lr);
+
+line_reader_t *line_reader_open(const char *path, int flags)
+{
+	line_reader_t *lr;
+	int fd;
+
+	assert(path != NULL);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+	lr = line_reader_fdopen(fd, flags);
+	if (lr == NULL) {
+		int saved = errno;
+
+		close(fd);
+		errno = saved;
+		return NULL;
+	}
+	lr->owns_fd = 1;
+	return lr;
+}
+
+line_reader_t *line_reader_fdopen(int fd, int flags)
+{
+	line_reader_t *lr;
+
+	assert(fd >= 0);
+
+	lr = malloc(sizeof(*lr));
+	if (lr == NULL) {
+		return NULL;
+	}
+	lr->fd = fd;
+	lr->owns_fd = 0;
+	lr->flags = flags;
+	lr->lineno = 0;
+	lr->map = NULL;
+	lr->map_len = lr->pos = lr->advised = 0;
+	lr->buf = NULL;
+	lr->cap = lr->start = lr->end = lr->scanned = 0;
+	lr->eof = 0;
+
+	if (try_map(lr)) {
+		lr->buf = malloc(LINE_READER_BUF);
+		if (lr->buf == NULL) {
+			free(lr);
+			return NULL;
+		}
+		lr->cap = LINE_READER_BUF;
+	}
+
+	return lr;
+}
+
+void line_reader_close(line_reader_t *lr)
+{
+	assert(lr != NULL);
+
+	if (lr->map != NULL) {
+		munmap((void *)lr->map, lr->map_len);
+	}
+	free(lr->buf);
+	if (lr->owns_fd) {
+		close(lr->fd);
+	}
+	free(lr);
+}
+
+int line_reader_next(line_reader_t *lr, str_view_t *line)
+{
+	int r;
+
+	assert(lr != NULL);
+	assert(line != NULL);
+
+	r = lr->buf == NULL ? next_mapped(lr, line) : next_read(lr, line);
+	if (r == 1) {
+		lr->lineno++;
+		if (lr->flags & LINE_READER_STRIP) {
+			*line = str_view_strip(*line);
+		}
+	}
+	return r;
+}
+
+size_t line_reader_lineno(line_reader_t *lr)
+{
+	assert(lr != NULL);
+
+	return lr->lineno;
+}
+
+static int try_map(line_reader_t *lr)
+{
+	struct stat st;
+	off_t off;
+	void *p;
+
+	/* Mapped from where fd is, which may not be a page boundary. */
+	if (fstat(lr->fd, &st) || !S_ISREG(st.st_mode)) {
+		return -1;
+	}
+	off = lseek(lr->fd, 0, SEEK_CUR);
+	if (off < 0 || off % sysconf(_SC_PAGESIZE) || st.st_size <= off ||
+	    (unsigned long long)(st.st_size - off) > (size_t)-1) {
+		return -1;
+	}
+
+	p = mmap(NULL, (size_t)(st.st_size - off), PROT_READ, MAP_PRIVATE,
+		 lr->fd, off);
+	if (p == MAP_FAILED) {
+		return -1;
+	}
+	lr->map = p;
+	lr->map_len = (size_t)(st.st_size - off);
+
+	posix_madvise(p, lr->map_len, POSIX_MADV_SEQUENTIAL);
+	posix_fadvise(lr->fd, off, st.st_size - off, POSIX_FADV_SEQUENTIAL);
+	return 0;
+}
+
+static int next_mapped(line_reader_t *lr, str_view_t *line)
+{
+	const char *p, *nl;
+	size_t left;
+
+	if (lr->pos == lr->map_len) {
+		return 0;
+	}
+
+	/* Keep a window ahead of the reader on its way in. */
+	while (lr->advised < lr->map_len &&
+	       lr->advised <= lr->pos + LINE_READER_READAHEAD / 2) {
+		size_t n = lr->map_len - lr->advised;
+
+		n = n < LINE_READER_READAHEAD ? n : LINE_READER_READAHEAD;
+		posix_madvise((void *)(lr->map + lr->advised), n,
+			      POSIX_MADV_WILLNEED);
+		lr->advised += n;
+	}
+
+	p = lr->map + lr->pos;
+	left = lr->map_len - lr->pos;
+	nl = memchr(p, '\n', left);
+	if (nl == NULL) {
+		*line = str_view_make(p, left);
+		lr->pos = lr->map_len;
+	} else {
+		*line = str_view_make(p, (size_t)(nl - p));
+		lr->pos += (size_t)(nl - p) + 1;
+	}
+	return 1;
+}
+
+static int next_read(line_reader_t *lr, str_view_t *line)
+{
+	char *nl;
+
+	for (;;) {
+		nl = memchr(lr->buf + lr->scanned, '\n', lr->end - lr->scanned);
+		if (nl != NULL) {
+			*line = str_view_make(lr->buf + lr->start,
+					      (size_t)(nl - lr->buf) -
+						      lr->start);
+			lr->start = lr->scanned = (size_t)(nl - lr->buf) + 1;
+			return 1;
+		}
+		lr->scanned = lr->end;
+
+		if (lr->eof) {
+			if (lr->start == lr->end) {
+				return 0;
+			}
+			*line = str_view_make(lr->buf + lr->start,
+					      lr->end - lr->start);
+			lr->start = lr->end;
+			return 1;
+		}
+
+		if (fill(lr)) {
+			return -1;
+		}
+	}
+}
+
+static int fill(line_reader_t *lr)
+{
+	ssize_t n;
+	char *buf;
+
+	if (lr->start) {
+		memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+		lr->end -= lr->start;
+		lr->scanned -= lr->start;
+		lr->start = 0;
+	}
+
+	if (lr->end == lr->cap) {
+		if (lr->cap > (size_t)-1 / 2) {
+			errno = ENOMEM;
+			return -1;
+		}
+		buf = realloc(lr->buf, lr->cap * 2);
+		if (buf == NULL) {
+			return -1;
+		}
+		lr->buf = buf;
+		lr->cap *= 2;
+	}
+
+	do {
+		n = read(lr->fd, lr->buf + lr->end, lr->cap - lr->end);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0) {
+		return -1;
+	}
+	if (!n) {
+		lr->eof = 1;
+	}
+	lr->end += (size_t)n;
+	return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+/*
+ * A reader of text files line by line, yielding str_view_t views into its own
+ * buffer rather than copies: nothing is copied out or modified in place.
+ *
+ * Regular files are memory-mapped, with sequential-access advice for the
+ * kernel and WILLNEED advice a window ahead of the reader. Anything else
+ * (pipes, terminals, files that won't map) is read(2) in large chunks.
+ * Newlines are found with memchr, which C libraries vectorize, and stripping
+ * uses the vector scans of str_view_strip.
+ *
+ * A view stays valid until the next call on the reader.
+ */
+
+#include <stddef.h>
+
+#include "str_view.h"
+
+/* Size of the buffer for read(2); it grows for longer lines. */
+#ifndef LINE_READER_BUF
+#define LINE_READER_BUF (1 << 20)
+#endif
+
+/* How far ahead of the reader mapped files are advised as needed. */
+#ifndef LINE_READER_READAHEAD
+#define LINE_READER_READAHEAD (4 << 20)
+#endif
+
+/* Flags for opening. */
+#define LINE_READER_STRIP 0x1 /* strip whitespace (as in str.h) from lines */
+
+typedef struct line_reader_t line_reader_t;
+
+/* Open the file at path, or return NULL with errno set. */
+line_reader_t *line_reader_open(const char *path, int flags);
+
+/* Read from fd, which the reader doesn't close, or return NULL with errno
+ * set. */
+line_reader_t *line_reader_fdopen(int fd, int flags);
+
+void line_reader_close(line_reader_t *lr);
+
+/*
+ * Store the next line in *line: without its newline, and stripped under
+ * LINE_READER_STRIP. A last line without a newline counts as a line.
+ *
+ * Returns 1, or 0 at end of file, or -1 with errno set if reading failed.
+ */
+int line_reader_next(line_reader_t *lr, str_view_t *line);
+
+/* Number of lines read so far. */
+size_t line_reader_lineno(line_reader_t *lr);
+
+#endif /* LINE_READER_H */
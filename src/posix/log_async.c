@@ -0,0 +1,364 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "log_async.h"
+#include "log_fmt.h"
+
+/* Size of the writer's batch buffer - the most handed to one write(2). */
+#ifndef LOG_ASYNC_BATCH_CAP
+#define LOG_ASYNC_BATCH_CAP 65536
+#endif
+
+/* How long the idle writer sleeps between checks, absent wakeups. */
+#ifndef LOG_ASYNC_IDLE_NS
+#define LOG_ASYNC_IDLE_NS 100000000L
+#endif
+
+/*
+ * A bounded multi-producer queue after Dmitry Vyukov's: each slot's sequence
+ * number says whose turn it is. A slot at position pos is free for a producer
+ * when seq == pos, holds a record for the writer when seq == pos + 1, and is
+ * handed back for the next lap with seq = pos + nslots.
+ */
+struct slot {
+	atomic_size_t seq;
+	size_t len;
+	char buf[LOG_ASYNC_RECORD_MAX];
+};
+
+static struct {
+	struct slot *slots;
+	size_t mask;
+	enum log_async_overflow overflow;
+	int fd;
+
+	atomic_size_t head; /* next position producers claim */
+	size_t tail; /* next position the writer reads - writer only */
+	atomic_size_t done; /* all positions before this are written */
+
+	atomic_ulong dropped, dropped_unreported;
+	atomic_int failed;
+
+	/* writer sleep/wakeup and flush completion */
+	pthread_mutex_t mtx;
+	pthread_cond_t wake, drained;
+	atomic_int sleeping, stopping;
+
+	pthread_t writer;
+	int running;
+	struct log_sink prev_sink;
+} q = { .mtx = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.drained = PTHREAD_COND_INITIALIZER };
+
+static int async_emit(void *ctx, const struct log_record *rec, va_list ap);
+static int async_flush(void *ctx);
+static int async_write(void *ctx, enum log_level lvl, const char *line,
+		       size_t len);
+
+/* Claim the slot for the next position, or return NULL if the queue is full
+ * and the overflow policy says to discard. */
+static struct slot *claim_slot(size_t *pos_out);
+
+/* Hand the claimed slot s at pos to the writer. */
+static void publish(struct slot *s, size_t pos);
+
+/* Wake the writer if it is sleeping. */
+static void wake_writer(void);
+
+static void *writer_main(void *arg);
+
+int log_async_start(int fd, size_t slots, enum log_async_overflow overflow)
+{
+	struct log_sink sink = { async_emit, async_flush, NULL, async_write };
+	size_t n, i;
+
+	assert(fd >= 0);
+
+	if (q.running) {
+		return -1;
+	}
+
+	for (n = 2; n < slots; n <<= 1) {
+		if (n > ((size_t)-1 >> 1) / sizeof(*q.slots)) {
+			return -1;
+		}
+	}
+
+	q.slots = malloc(n * sizeof(*q.slots));
+	if (q.slots == NULL) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		atomic_init(&q.slots[i].seq, i);
+	}
+	q.mask = n - 1;
+	q.overflow = overflow;
+	q.fd = fd;
+	atomic_init(&q.head, 0);
+	q.tail = 0;
+	atomic_init(&q.done, 0);
+	atomic_init(&q.dropped, 0);
+	atomic_init(&q.dropped_unreported, 0);
+	atomic_init(&q.failed, 0);
+	atomic_init(&q.sleeping, 0);
+	atomic_init(&q.stopping, 0);
+
+	if (pthread_create(&q.writer, NULL, writer_main, NULL)) {
+		free(q.slots);
+		q.slots = NULL;
+		return -1;
+	}
+	q.running = 1;
+
+	q.prev_sink = *log_sink();
+	log_sink_set(&sink);
+
+	return 0;
+}
+
+int log_async_stop(void)
+{
+	if (!q.running) {
+		return 0;
+	}
+
+	log_sink_set(&q.prev_sink);
+
+	atomic_store(&q.stopping, 1);
+	wake_writer();
+	pthread_join(q.writer, NULL);
+	q.running = 0;
+
+	free(q.slots);
+	q.slots = NULL;
+
+	return atomic_load(&q.failed) ? -1 : 0;
+}
+
+unsigned long log_async_dropped(void)
+{
+	return atomic_load_explicit(&q.dropped, memory_order_relaxed);
+}
+
+static int async_emit(void *ctx, const struct log_record *rec, va_list ap)
+{
+	struct slot *s;
+	size_t pos, len;
+
+	(void)ctx;
+
+	s = claim_slot(&pos);
+	if (s == NULL) {
+		return 0; /* discarded, per policy */
+	}
+
+	/* s belongs to the writer once published - keep len to hand */
+	s->len = len = log_fmt_record(s->buf, sizeof(s->buf), rec, ap);
+
+	/* Published even if rendering failed, as the writer must get past
+	 * every claimed position; an empty record writes nothing. */
+	publish(s, pos);
+
+	return len ? 0 : -1;
+}
+
+static int async_write(void *ctx, enum log_level lvl, const char *line,
+		       size_t len)
+{
+	struct slot *s;
+	size_t pos;
+
+	(void)ctx;
+	(void)lvl;
+
+	s = claim_slot(&pos);
+	if (s == NULL) {
+		return 0; /* discarded, per policy */
+	}
+
+	if (len > sizeof(s->buf) - 1) {
+		len = sizeof(s->buf) - 1; /* truncated */
+	}
+	memcpy(s->buf, line, len);
+	s->buf[len] = '\n';
+	s->len = len + 1;
+
+	publish(s, pos);
+
+	return 0;
+}
+
+static int async_flush(void *ctx)
+{
+	size_t target;
+
+	(void)ctx;
+
+	target = atomic_load(&q.head);
+	wake_writer();
+
+	pthread_mutex_lock(&q.mtx);
+	while (atomic_load(&q.done) < target) {
+		pthread_cond_wait(&q.drained, &q.mtx);
+	}
+	pthread_mutex_unlock(&q.mtx);
+
+	return atomic_load(&q.failed) ? -1 : 0;
+}
+
+static struct slot *claim_slot(size_t *pos_out)
+{
+	size_t pos = atomic_load_explicit(&q.head, memory_order_relaxed);
+
+	for (;;) {
+		struct slot *s = &q.slots[pos & q.mask];
+		size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &q.head, &pos, pos + 1,
+				    memory_order_relaxed,
+				    memory_order_relaxed)) {
+				*pos_out = pos;
+				return s;
+			}
+			/* lost the race; pos has been reloaded */
+		} else if ((ptrdiff_t)(seq - pos) < 0) {
+			/* still holding last lap's record: full */
+			if (q.overflow != LOG_ASYNC_BLOCK) {
+				atomic_fetch_add_explicit(&q.dropped, 1,
+							  memory_order_relaxed);
+				if (q.overflow == LOG_ASYNC_COUNT) {
+					atomic_fetch_add_explicit(
+						&q.dropped_unreported, 1,
+						memory_order_relaxed);
+				}
+				return NULL;
+			}
+			wake_writer();
+			sched_yield();
+			pos = atomic_load_explicit(&q.head,
+						   memory_order_relaxed);
+		} else {
+			/* another producer claimed it first */
+			pos = atomic_load_explicit(&q.head,
+						   memory_order_relaxed);
+		}
+	}
+}
+
+static void publish(struct slot *s, size_t pos)
+{
+	atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&q.sleeping, memory_order_relaxed)) {
+		wake_writer();
+	}
+}
+
+static void wake_writer(void)
+{
+	pthread_mutex_lock(&q.mtx);
+	pthread_cond_signal(&q.wake);
+	pthread_mutex_unlock(&q.mtx);
+}
+
+static void *writer_main(void *arg)
+{
+	static char batch[LOG_ASYNC_BATCH_CAP];
+	size_t len;
+
+	(void)arg;
+
+	for (;;) {
+		unsigned long dropped;
+		int stopping;
+
+		/* Read before draining, so nothing logged before stopping is
+		 * left behind. */
+		stopping = atomic_load(&q.stopping);
+
+		/* Drain as much as is ready, a batch at a time. */
+		len = 0;
+		for (;;) {
+			struct slot *s = &q.slots[q.tail & q.mask];
+			size_t seq = atomic_load_explicit(
+				&s->seq, memory_order_acquire);
+
+			if (seq != q.tail + 1) {
+				break; /* empty, or not yet published */
+			}
+
+			if (len + s->len > sizeof(batch)) {
+				if (log_fmt_write_all(q.fd, batch, len)) {
+					atomic_store(&q.failed, 1);
+				}
+				len = 0;
+			}
+			memcpy(batch + len, s->buf, s->len);
+			len += s->len;
+
+			atomic_store_explicit(&s->seq, q.tail + q.mask + 1,
+					      memory_order_release);
+			q.tail++;
+		}
+
+		dropped = atomic_exchange(&q.dropped_unreported, 0);
+		if (dropped && sizeof(batch) - len >= LOG_ASYNC_RECORD_MAX) {
+			len += log_fmt_note(batch + len, LOG_ASYNC_RECORD_MAX,
+					    LOG_LEVEL_WARNING, __FILE__,
+					    __LINE__,
+					    "log queue full: dropped %lu records",
+					    dropped);
+		} else if (dropped) {
+			atomic_fetch_add(&q.dropped_unreported, dropped);
+		}
+
+		if (len && log_fmt_write_all(q.fd, batch, len)) {
+			atomic_store(&q.failed, 1);
+		}
+
+		pthread_mutex_lock(&q.mtx);
+		atomic_store(&q.done, q.tail);
+		pthread_cond_broadcast(&q.drained);
+
+		if (stopping && q.tail == atomic_load(&q.head)) {
+			pthread_mutex_unlock(&q.mtx);
+			break;
+		}
+
+		/* Sleep if there's nothing more to do. Producers check
+		 * sleeping after publishing, so either they see it set and
+		 * signal (which needs the mutex we hold until waiting), or we
+		 * see their record here. */
+		atomic_store(&q.sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (atomic_load_explicit(&q.slots[q.tail & q.mask].seq,
+					 memory_order_acquire) != q.tail + 1 &&
+		    !atomic_load(&q.stopping)) {
+			struct timespec until;
+
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += LOG_ASYNC_IDLE_NS;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&q.wake, &q.mtx, &until);
+		}
+		atomic_store(&q.sleeping, 0);
+		pthread_mutex_unlock(&q.mtx);
+	}
+
+	return NULL;
+}
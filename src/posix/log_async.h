@@ -0,0 +1,48 @@
+#ifndef LOG_ASYNC_H
+#define LOG_ASYNC_H
+
+/*
+ * An asynchronous log sink. Logging threads render records into slots of a
+ * bounded lock-free queue; a background writer thread drains it, batching many
+ * records into each write(2). Logging threads never wait on I/O, only (under
+ * LOG_ASYNC_BLOCK) on the queue having room.
+ *
+ * log_flush() waits until every record logged before the call is written.
+ */
+
+#include <stddef.h>
+
+/* Largest rendered record, including its newline; longer ones are truncated. */
+#ifndef LOG_ASYNC_RECORD_MAX
+#define LOG_ASYNC_RECORD_MAX 512
+#endif
+
+/* What logging threads do when the queue is full. */
+enum log_async_overflow {
+	LOG_ASYNC_BLOCK, /* wait for the writer to make room */
+	LOG_ASYNC_DROP, /* discard the record */
+	LOG_ASYNC_COUNT /* discard the record, and have the writer log how many
+			   were discarded once it catches up */
+};
+
+/*
+ * Install the asynchronous sink, writing to fd, with a queue of at least the
+ * given number of record slots (rounded up to a power of two).
+ *
+ * Returns 0 on success, or -1 if memory or the writer thread couldn't be had,
+ * or it is already running.
+ */
+int log_async_start(int fd, size_t slots, enum log_async_overflow overflow);
+
+/*
+ * Write out everything queued, stop the writer, and restore the sink that was
+ * installed before log_async_start. Nothing may be logging concurrently.
+ *
+ * Returns 0 on success, or -1 if any write failed while running.
+ */
+int log_async_stop(void);
+
+/* Number of records discarded due to a full queue since starting. */
+unsigned long log_async_dropped(void);
+
+#endif /* LOG_ASYNC_H */
@@ -0,0 +1,763 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "log_binary.h"
+#include "log_fmt.h"
+#include "log_ts.h"
+
+/* Size of each thread's buffer records are encoded into - the most handed to
+ * one write(2). */
+#ifndef LOG_BINARY_BUF_CAP
+#define LOG_BINARY_BUF_CAP 65536
+#endif
+
+/* Call sites each thread remembers the registration of, without locking. */
+#define SITE_CACHE 256
+
+/* Most bytes one conversion can encode to: two '*' ints, then the value. */
+#define SPEC_MAX (8 + 8 + 4 + LOG_BINARY_STR_MAX)
+
+/* Most bytes an 'R' or 'T' entry can take. */
+#define RECORD_MAX (1 + 4 + 8 + 4 + 4 + LOG_BINARY_SPECS_MAX * SPEC_MAX)
+#define TEXT_MAX (1 + 4 + LOG_BINARY_TEXT_MAX)
+
+#if LOG_BINARY_BUF_CAP < 2 * RECORD_MAX || LOG_BINARY_BUF_CAP < 2 * TEXT_MAX
+#error LOG_BINARY_BUF_CAP too small for LOG_BINARY_SPECS_MAX/STR_MAX/TEXT_MAX
+#endif
+
+#define STR_NULL 0xFFFFFFFFUL
+
+/* What the sink knows of a registered call site, never changed once
+ * registered. */
+struct site_info {
+	struct log_site *site;
+	const char *fmt; /* the format parsed, which records must come with */
+	int text; /* its format can't be encoded raw */
+	size_t nspecs;
+	struct log_binary_spec specs[LOG_BINARY_SPECS_MAX];
+};
+
+/*
+ * A buffer of entries. Each thread encodes its records into its own, and
+ * its mutex is only contended by log_flush(); buffers of exited threads are
+ * kept on the list for new threads to take over.
+ */
+struct tbuf {
+	pthread_mutex_t mtx;
+	struct tbuf *next;
+	int in_use;
+
+	size_t len;
+	unsigned char buf[LOG_BINARY_BUF_CAP];
+};
+
+static struct {
+	int fd;
+	int running;
+	atomic_int failed;
+	struct log_sink prev_sink;
+
+	/* Held across each buffer's write, which may take several write(2)s:
+	 * the stream is lost past any interleaving of two. */
+	pthread_mutex_t write_mtx;
+
+	pthread_mutex_t list_mtx; /* guards bufs and in_use */
+	struct tbuf *bufs;
+
+	pthread_once_t key_once;
+	pthread_key_t key; /* the thread's tbuf, to write out on exit */
+
+	/* For threads that couldn't get a buffer of their own. */
+	struct tbuf shared;
+
+	/*
+	 * Registered sites, indexed by id - 1, and the buffer their 'S'
+	 * entries are written from, guarded by sites_mtx. An 'S' entry is
+	 * written out before the site's id is handed to any thread, so it
+	 * precedes every record of the site in the stream. Kept across
+	 * restarts, as the ids stay in their sites.
+	 */
+	pthread_mutex_t sites_mtx;
+	struct site_info **sites;
+	size_t nsites, sites_cap;
+	struct tbuf site_buf;
+} b = { .write_mtx = PTHREAD_MUTEX_INITIALIZER,
+	.list_mtx = PTHREAD_MUTEX_INITIALIZER,
+	.key_once = PTHREAD_ONCE_INIT,
+	.shared = { .mtx = PTHREAD_MUTEX_INITIALIZER },
+	.sites_mtx = PTHREAD_MUTEX_INITIALIZER,
+	.site_buf = { .mtx = PTHREAD_MUTEX_INITIALIZER } };
+
+static _Thread_local struct tbuf *this_buf;
+
+/* The sites this thread has looked up, by address. */
+static _Thread_local const struct site_info *site_cache[SITE_CACHE];
+
+static int binary_emit(void *ctx, const struct log_record *rec, va_list ap);
+static int binary_flush(void *ctx);
+
+/*
+ * Return the registered info for the record's call site, registering it
+ * (and writing its 'S' entry) on first use, or NULL if the record must be
+ * written as text: as it must if it doesn't come with the format the site
+ * was registered with.
+ */
+static const struct site_info *site_for(const struct log_record *rec);
+
+/* site_for, past this thread's cache: takes sites_mtx. */
+static const struct site_info *register_site(struct log_site *site,
+					     const char *fmt);
+
+/* Parse fmt into si, returning -1 if it can't be encoded raw. */
+static int parse_format(struct site_info *si, const char *fmt);
+
+/* Append si's 'S' entry to tb. Marks the site as text if it doesn't fit. */
+static void put_site(struct tbuf *tb, struct site_info *si);
+
+/* Append an 'R' entry for si with the given time and arguments. */
+static void put_record(struct tbuf *tb, const struct site_info *si,
+		       const struct timespec *t, va_list ap);
+
+/* Append a 'T' entry for the record, rendered. */
+static void put_text(struct tbuf *tb, const struct log_record *rec,
+		     va_list ap);
+
+/* Return this thread's buffer, taking one on first use, or NULL if there's
+ * no memory for one. */
+static struct tbuf *thread_buf(void);
+
+static void make_key(void);
+
+/* Thread exit: write out the buffer and give it up. */
+static void release_buf(void *p);
+
+/* Make sure n bytes fit in tb, writing it out if they don't. */
+static void reserve(struct tbuf *tb, size_t n);
+
+/* Write out tb, which must be locked, recording any failure. Takes
+ * write_mtx. */
+static void drain(struct tbuf *tb);
+
+static void put_u8(struct tbuf *tb, unsigned v);
+static void put_u32(struct tbuf *tb, unsigned long v);
+static void put_u64(struct tbuf *tb, uint64_t v);
+static void put_bytes(struct tbuf *tb, const void *p, size_t n);
+
+/* Put a length-prefixed string, s[0..n). */
+static void put_str(struct tbuf *tb, const char *s, size_t n);
+
+/* Store v at offset at in tb, for backfilling lengths. */
+static void store_u32(struct tbuf *tb, size_t at, unsigned long v);
+
+int log_binary_start(int fd)
+{
+	struct log_sink sink = { binary_emit, binary_flush, NULL, NULL };
+	struct tbuf *tb = &b.site_buf;
+	size_t i;
+
+	assert(fd >= 0);
+
+	pthread_once(&b.key_once, make_key);
+
+	pthread_mutex_lock(&b.sites_mtx);
+
+	if (b.running) {
+		pthread_mutex_unlock(&b.sites_mtx);
+		return -1;
+	}
+
+	b.fd = fd;
+	atomic_store(&b.failed, 0);
+
+	put_bytes(tb, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN);
+	put_u32(tb, LOG_BINARY_BOM);
+	put_u8(tb, sizeof(long double));
+
+	/* Sites registered by an earlier run won't register again. */
+	for (i = 0; i < b.nsites; i++) {
+		if (!b.sites[i]->text) {
+			put_site(tb, b.sites[i]);
+		}
+	}
+	drain(tb);
+
+	if (atomic_load(&b.failed)) {
+		pthread_mutex_unlock(&b.sites_mtx);
+		return -1;
+	}
+	b.running = 1;
+
+	pthread_mutex_unlock(&b.sites_mtx);
+
+	b.prev_sink = *log_sink();
+	log_sink_set(&sink);
+
+	return 0;
+}
+
+int log_binary_stop(void)
+{
+	int failed;
+
+	if (!b.running) {
+		return 0;
+	}
+
+	log_sink_set(&b.prev_sink);
+	failed = binary_flush(NULL);
+	b.running = 0;
+
+	return failed;
+}
+
+int log_binary_next_spec(const char **fmt, struct log_binary_spec *spec)
+{
+	enum { NONE, HH, H, L, LL, J, Z, T, BIG_L } len = NONE;
+	const char *p;
+	int is_signed;
+
+	assert(fmt != NULL && *fmt != NULL);
+	assert(spec != NULL);
+
+	p = strchr(*fmt, '%');
+	if (p == NULL) {
+		*fmt += strlen(*fmt);
+		return 0;
+	}
+
+	spec->start = p++;
+	spec->width_star = 0;
+	spec->prec_star = 0;
+	spec->prec = -1;
+
+	p += strspn(p, "-+ #0");
+	if (*p == '*') {
+		spec->width_star = 1;
+		p++;
+	} else {
+		p += strspn(p, "0123456789");
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->prec_star = 1;
+			p++;
+		} else {
+			spec->prec = 0;
+			for (; *p >= '0' && *p <= '9'; p++) {
+				if (spec->prec <= LOG_BINARY_STR_MAX) {
+					spec->prec = spec->prec * 10 + *p - '0';
+				}
+			}
+		}
+	}
+
+	switch (*p) {
+	case 'h':
+		len = p[1] == 'h' ? HH : H;
+		break;
+	case 'l':
+		len = p[1] == 'l' ? LL : L;
+		break;
+	case 'j':
+		len = J;
+		break;
+	case 'z':
+		len = Z;
+		break;
+	case 't':
+		len = T;
+		break;
+	case 'L':
+		len = BIG_L;
+		break;
+	}
+	p += len == HH || len == LL ? 2 : len != NONE ? 1 : 0;
+
+	spec->arg = LOG_BINARY_ARG_UNSUPPORTED;
+	is_signed = 0;
+
+	switch (*p) {
+	case 'd':
+	case 'i':
+		is_signed = 1;
+		/* fall through */
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		switch (len) {
+		case NONE:
+		case HH:
+		case H:
+			spec->arg = is_signed ? LOG_BINARY_ARG_INT :
+						LOG_BINARY_ARG_UINT;
+			break;
+		case L:
+			spec->arg = is_signed ? LOG_BINARY_ARG_LONG :
+						LOG_BINARY_ARG_ULONG;
+			break;
+		case LL:
+			spec->arg = is_signed ? LOG_BINARY_ARG_LLONG :
+						LOG_BINARY_ARG_ULLONG;
+			break;
+		case J:
+			spec->arg = is_signed ? LOG_BINARY_ARG_INTMAX :
+						LOG_BINARY_ARG_UINTMAX;
+			break;
+		case Z:
+			spec->arg = LOG_BINARY_ARG_SIZE;
+			break;
+		case T:
+			spec->arg = LOG_BINARY_ARG_PTRDIFF;
+			break;
+		case BIG_L:
+			break;
+		}
+		break;
+	case 'c':
+		if (len == NONE) {
+			spec->arg = LOG_BINARY_ARG_INT;
+		}
+		break;
+	case 's':
+		if (len == NONE) {
+			spec->arg = LOG_BINARY_ARG_STR;
+		}
+		break;
+	case 'p':
+		if (len == NONE) {
+			spec->arg = LOG_BINARY_ARG_PTR;
+		}
+		break;
+	case 'a':
+	case 'A':
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+		if (len == NONE || len == L) {
+			spec->arg = LOG_BINARY_ARG_DOUBLE;
+		} else if (len == BIG_L) {
+			spec->arg = LOG_BINARY_ARG_LDOUBLE;
+		}
+		break;
+	case '%':
+		if (p == spec->start + 1) {
+			spec->arg = LOG_BINARY_ARG_NONE;
+		}
+		break;
+	}
+
+	if (*p != '\0') {
+		p++;
+	}
+	spec->len = (size_t)(p - spec->start);
+	*fmt = p;
+
+	return 1;
+}
+
+static int binary_emit(void *ctx, const struct log_record *rec, va_list ap)
+{
+	const struct site_info *si;
+	struct timespec now;
+	struct tbuf *tb;
+
+	(void)ctx;
+
+	if (clock_gettime(LOG_TS_CLOCK, &now)) {
+		return -1;
+	}
+
+	si = site_for(rec);
+
+	tb = thread_buf();
+	if (tb == NULL) {
+		tb = &b.shared;
+	}
+	pthread_mutex_lock(&tb->mtx);
+
+	if (si != NULL) {
+		put_record(tb, si, &now, ap);
+	} else {
+		put_text(tb, rec, ap);
+	}
+
+	if (rec->lvl <= LOG_LEVEL_ERR) {
+		drain(tb);
+	}
+
+	pthread_mutex_unlock(&tb->mtx);
+
+	return atomic_load_explicit(&b.failed, memory_order_relaxed) ? -1 : 0;
+}
+
+static int binary_flush(void *ctx)
+{
+	struct tbuf *tb;
+
+	(void)ctx;
+
+	pthread_mutex_lock(&b.list_mtx);
+	for (tb = b.bufs; tb != NULL; tb = tb->next) {
+		pthread_mutex_lock(&tb->mtx);
+		drain(tb);
+		pthread_mutex_unlock(&tb->mtx);
+	}
+	pthread_mutex_unlock(&b.list_mtx);
+
+	pthread_mutex_lock(&b.shared.mtx);
+	drain(&b.shared);
+	pthread_mutex_unlock(&b.shared.mtx);
+
+	return atomic_load(&b.failed) ? -1 : 0;
+}
+
+static const struct site_info *site_for(const struct log_record *rec)
+{
+	const struct site_info *si;
+	size_t i;
+
+	if (rec->site == NULL) {
+		return NULL;
+	}
+
+	i = ((uintptr_t)rec->site / sizeof(struct log_site)) % SITE_CACHE;
+	si = site_cache[i];
+	if (si == NULL || si->site != rec->site) {
+		si = register_site(rec->site, rec->fmt);
+		if (si == NULL) {
+			return NULL;
+		}
+		site_cache[i] = si;
+	}
+
+	return !si->text && si->fmt == rec->fmt ? si : NULL;
+}
+
+static const struct site_info *register_site(struct log_site *site,
+					     const char *fmt)
+{
+	struct site_info *si;
+
+	pthread_mutex_lock(&b.sites_mtx);
+
+	if (site->id != 0) {
+		si = b.sites[site->id - 1];
+		pthread_mutex_unlock(&b.sites_mtx);
+		return si;
+	}
+
+	if (b.nsites == b.sites_cap) {
+		size_t cap = b.sites_cap ? b.sites_cap * 2 : 64;
+		struct site_info **sites;
+
+		if (cap > (size_t)-1 / sizeof(*sites)) {
+			pthread_mutex_unlock(&b.sites_mtx);
+			return NULL;
+		}
+		sites = realloc(b.sites, cap * sizeof(*sites));
+		if (sites == NULL) {
+			pthread_mutex_unlock(&b.sites_mtx);
+			return NULL; /* try again next time */
+		}
+		b.sites = sites;
+		b.sites_cap = cap;
+	}
+
+	si = malloc(sizeof(*si));
+	if (si == NULL) {
+		pthread_mutex_unlock(&b.sites_mtx);
+		return NULL;
+	}
+	si->site = site;
+	si->fmt = fmt;
+	si->text = parse_format(si, fmt) != 0;
+
+	b.sites[b.nsites++] = si;
+	site->id = b.nsites;
+	site->fmt = fmt;
+
+	if (!si->text) {
+		put_site(&b.site_buf, si);
+		drain(&b.site_buf);
+	}
+
+	pthread_mutex_unlock(&b.sites_mtx);
+	return si;
+}
+
+static int parse_format(struct site_info *si, const char *fmt)
+{
+	struct log_binary_spec spec;
+
+	si->nspecs = 0;
+	while (log_binary_next_spec(&fmt, &spec)) {
+		if (spec.arg == LOG_BINARY_ARG_NONE) {
+			continue;
+		}
+		if (spec.arg == LOG_BINARY_ARG_UNSUPPORTED ||
+		    si->nspecs == LOG_BINARY_SPECS_MAX) {
+			return -1;
+		}
+		si->specs[si->nspecs++] = spec;
+	}
+	return 0;
+}
+
+static void put_site(struct tbuf *tb, struct site_info *si)
+{
+	const struct log_site *site = si->site;
+	size_t file_len = strlen(site->file);
+	size_t fmt_len = strlen(site->fmt);
+	size_t n = 1 + 4 + 1 + 4 + 4 + file_len + 4 + fmt_len;
+
+	if (n > LOG_BINARY_BUF_CAP) {
+		si->text = 1;
+		return;
+	}
+
+	reserve(tb, n);
+	put_u8(tb, 'S');
+	put_u32(tb, site->id);
+	put_u8(tb, (unsigned)site->lvl);
+	put_u32(tb, site->lineno);
+	put_str(tb, site->file, file_len);
+	put_str(tb, site->fmt, fmt_len);
+}
+
+static void put_record(struct tbuf *tb, const struct site_info *si,
+		       const struct timespec *t, va_list ap)
+{
+	size_t i, len_at;
+
+	reserve(tb, RECORD_MAX);
+	put_u8(tb, 'R');
+	put_u32(tb, si->site->id);
+	put_u64(tb, (uint64_t)(int64_t)t->tv_sec);
+	put_u32(tb, (unsigned long)t->tv_nsec);
+	len_at = tb->len;
+	put_u32(tb, 0);
+
+	for (i = 0; i < si->nspecs; i++) {
+		const struct log_binary_spec *spec = &si->specs[i];
+		int prec = spec->prec;
+		long double ld;
+		double d;
+		const char *s;
+
+		if (spec->width_star) {
+			put_u64(tb, (uint64_t)(int64_t)va_arg(ap, int));
+		}
+		if (spec->prec_star) {
+			prec = va_arg(ap, int);
+			put_u64(tb, (uint64_t)(int64_t)prec);
+		}
+
+		switch (spec->arg) {
+		case LOG_BINARY_ARG_INT:
+			put_u64(tb, (uint64_t)(int64_t)va_arg(ap, int));
+			break;
+		case LOG_BINARY_ARG_UINT:
+			put_u64(tb, va_arg(ap, unsigned));
+			break;
+		case LOG_BINARY_ARG_LONG:
+			put_u64(tb, (uint64_t)(int64_t)va_arg(ap, long));
+			break;
+		case LOG_BINARY_ARG_ULONG:
+			put_u64(tb, va_arg(ap, unsigned long));
+			break;
+		case LOG_BINARY_ARG_LLONG:
+			put_u64(tb, (uint64_t)(int64_t)va_arg(ap, long long));
+			break;
+		case LOG_BINARY_ARG_ULLONG:
+			put_u64(tb, va_arg(ap, unsigned long long));
+			break;
+		case LOG_BINARY_ARG_INTMAX:
+			put_u64(tb, (uint64_t)(int64_t)va_arg(ap, intmax_t));
+			break;
+		case LOG_BINARY_ARG_UINTMAX:
+			put_u64(tb, (uint64_t)va_arg(ap, uintmax_t));
+			break;
+		case LOG_BINARY_ARG_SIZE:
+			put_u64(tb, va_arg(ap, size_t));
+			break;
+		case LOG_BINARY_ARG_PTRDIFF:
+			put_u64(tb, (uint64_t)(int64_t)va_arg(ap, ptrdiff_t));
+			break;
+		case LOG_BINARY_ARG_DOUBLE:
+			d = va_arg(ap, double);
+			put_bytes(tb, &d, sizeof(d));
+			break;
+		case LOG_BINARY_ARG_LDOUBLE:
+			ld = va_arg(ap, long double);
+			put_bytes(tb, &ld, sizeof(ld));
+			break;
+		case LOG_BINARY_ARG_PTR:
+			put_u64(tb, (uintptr_t)va_arg(ap, void *));
+			break;
+		case LOG_BINARY_ARG_STR:
+			s = va_arg(ap, const char *);
+			if (s == NULL) {
+				put_u32(tb, STR_NULL);
+				break;
+			}
+			/* a precision allows s to be unterminated */
+			if (prec < 0 || prec > LOG_BINARY_STR_MAX) {
+				prec = LOG_BINARY_STR_MAX;
+			}
+			put_str(tb, s, strnlen(s, (size_t)prec));
+			break;
+		case LOG_BINARY_ARG_NONE:
+		case LOG_BINARY_ARG_UNSUPPORTED:
+			assert(0); /* not kept by parse_format */
+			break;
+		}
+	}
+
+	store_u32(tb, len_at, tb->len - len_at - 4);
+}
+
+static void put_text(struct tbuf *tb, const struct log_record *rec,
+		     va_list ap)
+{
+	size_t len;
+
+	reserve(tb, TEXT_MAX);
+	len = log_fmt_record((char *)tb->buf + tb->len + 5, LOG_BINARY_TEXT_MAX,
+			     rec, ap);
+	if (len == 0) {
+		return;
+	}
+
+	put_u8(tb, 'T');
+	put_u32(tb, len);
+	tb->len += len;
+}
+
+static struct tbuf *thread_buf(void)
+{
+	struct tbuf *tb;
+
+	if (this_buf != NULL) {
+		return this_buf;
+	}
+
+	pthread_mutex_lock(&b.list_mtx);
+
+	tb = b.bufs;
+	while (tb != NULL && tb->in_use) {
+		tb = tb->next;
+	}
+	if (tb == NULL) {
+		tb = malloc(sizeof(*tb));
+		if (tb == NULL) {
+			pthread_mutex_unlock(&b.list_mtx);
+			return NULL;
+		}
+		pthread_mutex_init(&tb->mtx, NULL);
+		tb->len = 0;
+		tb->next = b.bufs;
+		b.bufs = tb;
+	}
+	tb->in_use = 1;
+
+	pthread_mutex_unlock(&b.list_mtx);
+
+	/* if this fails there's no drain on exit, but log_flush() still
+	 * sees the buffer */
+	pthread_setspecific(b.key, tb);
+	this_buf = tb;
+
+	return tb;
+}
+
+static void make_key(void)
+{
+	if (pthread_key_create(&b.key, release_buf)) {
+		abort();
+	}
+}
+
+static void release_buf(void *p)
+{
+	struct tbuf *tb = p;
+
+	pthread_mutex_lock(&tb->mtx);
+	drain(tb);
+	pthread_mutex_unlock(&tb->mtx);
+
+	pthread_mutex_lock(&b.list_mtx);
+	tb->in_use = 0;
+	pthread_mutex_unlock(&b.list_mtx);
+
+	this_buf = NULL;
+}
+
+static void reserve(struct tbuf *tb, size_t n)
+{
+	assert(n <= sizeof(tb->buf));
+
+	if (sizeof(tb->buf) - tb->len < n) {
+		drain(tb);
+	}
+}
+
+static void drain(struct tbuf *tb)
+{
+	if (tb->len) {
+		pthread_mutex_lock(&b.write_mtx);
+		if (log_fmt_write_all(b.fd, tb->buf, tb->len)) {
+			atomic_store(&b.failed, 1);
+		}
+		pthread_mutex_unlock(&b.write_mtx);
+	}
+	tb->len = 0;
+}
+
+static void put_u8(struct tbuf *tb, unsigned v)
+{
+	tb->buf[tb->len++] = (unsigned char)v;
+}
+
+static void put_u32(struct tbuf *tb, unsigned long v)
+{
+	store_u32(tb, tb->len, v);
+	tb->len += 4;
+}
+
+static void put_u64(struct tbuf *tb, uint64_t v)
+{
+	put_bytes(tb, &v, sizeof(v));
+}
+
+static void put_bytes(struct tbuf *tb, const void *p, size_t n)
+{
+	memcpy(tb->buf + tb->len, p, n);
+	tb->len += n;
+}
+
+static void put_str(struct tbuf *tb, const char *s, size_t n)
+{
+	put_u32(tb, n);
+	put_bytes(tb, s, n);
+}
+
+static void store_u32(struct tbuf *tb, size_t at, unsigned long v)
+{
+	uint32_t v32 = (uint32_t)v;
+
+	memcpy(tb->buf + at, &v32, sizeof(v32));
+}
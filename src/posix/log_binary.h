@@ -0,0 +1,117 @@
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+/*
+ * A binary log sink that defers formatting. The first record from each call
+ * site registers the site's level, file, line and format string in the
+ * stream; after that, records carry only the site's id, a timestamp, and the
+ * raw arguments. logdecode renders the stream as text later.
+ *
+ * A site is keyed on the address of its format, which the log_* macros
+ * require to be a string literal. Records that can't be encoded this way -
+ * logged without a call site (plain log_emit), through log_emit_site with a
+ * format other than the one the site registered with, or with conversions
+ * that have no portable raw form (%n, wide characters, positional arguments)
+ * - are written already rendered, so nothing is lost.
+ *
+ * Each thread buffers its records, without contending with other threads
+ * short of registering a new site or writing out its buffer; a buffer is
+ * written once nearly full, on log_flush(), when its thread exits, and
+ * immediately for LOG_LEVEL_ERR and more severe. Buffers are written one at a
+ * time under a lock, as a stream split by another thread's bytes couldn't be
+ * decoded past the split. Records of different threads may so appear out of
+ * time order.
+ *
+ * The stream is in the writing machine's byte order and type sizes, which its
+ * header records; decode it on a like machine.
+ */
+
+#include <stddef.h>
+
+/* First bytes of a stream, followed by a 32-bit 0x01020304 in the writer's
+ * byte order and a byte giving sizeof(long double). */
+#define LOG_BINARY_MAGIC "LOGBIN1\n"
+#define LOG_BINARY_MAGIC_LEN 8
+#define LOG_BINARY_BOM 0x01020304UL
+
+/* Most conversions in a format string for it to be encoded raw. */
+#ifndef LOG_BINARY_SPECS_MAX
+#define LOG_BINARY_SPECS_MAX 16
+#endif
+
+/* Longest %s argument kept; longer ones are truncated. */
+#ifndef LOG_BINARY_STR_MAX
+#define LOG_BINARY_STR_MAX 1024
+#endif
+
+/* Longest rendered record, for those written as text. */
+#ifndef LOG_BINARY_TEXT_MAX
+#define LOG_BINARY_TEXT_MAX 1024
+#endif
+
+/*
+ * Install the binary sink, writing to fd (after a stream header).
+ *
+ * Returns 0 on success, or -1 if the header couldn't be written or it is
+ * already running.
+ */
+int log_binary_start(int fd);
+
+/*
+ * Write out everything buffered and restore the sink that was installed
+ * before log_binary_start. Nothing may be logging concurrently.
+ *
+ * Returns 0 on success, or -1 if any write failed while running.
+ */
+int log_binary_stop(void);
+
+/*
+ * Format strings, as the sink and logdecode both see them.
+ *
+ * Entries in the stream, after the header, begin with a tag byte:
+ *
+ *   'S' site:   u32 id, u8 level, u32 line, u32 len + file, u32 len + format
+ *   'R' record: u32 id, i64 seconds, u32 nanoseconds, u32 len + arguments
+ *   'T' text:   u32 len + the record as log_fmt_record renders it
+ *
+ * A record's arguments follow its format's conversions in order: an int for
+ * each '*' width or precision, then the value. Integers and pointers take 8
+ * bytes, doubles 8, long doubles sizeof(long double), and strings a u32 length
+ * (0xFFFFFFFF for NULL) and their bytes.
+ */
+
+/* The argument a conversion takes. */
+enum log_binary_arg {
+	LOG_BINARY_ARG_NONE, /* %% */
+	LOG_BINARY_ARG_INT, /* d i c, and hh h */
+	LOG_BINARY_ARG_UINT, /* o u x X, and hh h */
+	LOG_BINARY_ARG_LONG,
+	LOG_BINARY_ARG_ULONG,
+	LOG_BINARY_ARG_LLONG,
+	LOG_BINARY_ARG_ULLONG,
+	LOG_BINARY_ARG_INTMAX,
+	LOG_BINARY_ARG_UINTMAX,
+	LOG_BINARY_ARG_SIZE,
+	LOG_BINARY_ARG_PTRDIFF,
+	LOG_BINARY_ARG_DOUBLE,
+	LOG_BINARY_ARG_LDOUBLE,
+	LOG_BINARY_ARG_PTR,
+	LOG_BINARY_ARG_STR,
+	LOG_BINARY_ARG_UNSUPPORTED
+};
+
+struct log_binary_spec {
+	const char *start; /* the '%' */
+	size_t len; /* through the conversion character */
+	int width_star, prec_star; /* '*' given as width/precision */
+	int prec; /* literal precision, or -1 */
+	enum log_binary_arg arg;
+};
+
+/*
+ * Find the next conversion in *fmt. Returns 1, having filled in *spec and
+ * advanced *fmt past it, or 0 if there are no more.
+ */
+int log_binary_next_spec(const char **fmt, struct log_binary_spec *spec);
+
+#endif /* LOG_BINARY_H */
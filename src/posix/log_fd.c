@@ -0,0 +1,349 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "log_fd.h"
+#include "log_fmt.h"
+
+#if LOG_FD_BUF_CAP < LOG_FD_RECORD_MAX || LOG_FD_RECORD_MAX < LOG_FMT_CAP_MIN
+#error LOG_FD_BUF_CAP and LOG_FD_RECORD_MAX too small
+#endif
+
+/* Writes of up to PIPE_BUF bytes to a pipe are atomic; so that each record is
+ * written whole, buffers are written in chunks of whole records no longer. */
+#ifndef PIPE_BUF
+#define PIPE_BUF _POSIX_PIPE_BUF
+#endif
+#if LOG_FD_RECORD_MAX > PIPE_BUF
+#error LOG_FD_RECORD_MAX larger than PIPE_BUF
+#endif
+
+/* Most chunks a buffer can hold: any two consecutive ones together hold more
+ * than PIPE_BUF bytes. */
+#define CHUNKS_MAX (2 * LOG_FD_BUF_CAP / PIPE_BUF + 2)
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define FLUSH_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define FLUSH_CLOCK CLOCK_MONOTONIC
+#endif
+
+/*
+ * A thread's buffer. Its mutex is only contended by log_flush(); buffers of
+ * exited threads are kept on the list for new threads to take over.
+ */
+struct tbuf {
+	pthread_mutex_t mtx;
+	struct tbuf *next;
+	int in_use;
+
+	struct timespec oldest; /* when the first buffered record was logged */
+	size_t len;
+	char buf[LOG_FD_BUF_CAP];
+
+	/* Where each chunk but the last ends, and the last begins. */
+	size_t ends[CHUNKS_MAX];
+	size_t n_ends, chunk;
+};
+
+static struct {
+	int fd;
+	int running;
+	atomic_int failed;
+	struct log_sink prev_sink;
+
+	pthread_mutex_t list_mtx; /* guards bufs and in_use */
+	struct tbuf *bufs;
+
+	pthread_once_t key_once;
+	pthread_key_t key; /* the thread's tbuf, to flush on exit */
+} s = { .list_mtx = PTHREAD_MUTEX_INITIALIZER,
+	.key_once = PTHREAD_ONCE_INIT };
+
+static _Thread_local struct tbuf *this_buf;
+
+static int fd_emit(void *ctx, const struct log_record *rec, va_list ap);
+static int fd_flush(void *ctx);
+static int fd_write(void *ctx, enum log_level lvl, const char *line,
+		    size_t len);
+
+/* Return this thread's buffer, taking one on first use, or NULL if there's
+ * no memory for one. */
+static struct tbuf *thread_buf(void);
+
+static void make_key(void);
+
+/* Thread exit: write out the buffer and give it up. */
+static void release_buf(void *p);
+
+/* Take the len bytes rendered at the end of tb's contents as a record,
+ * starting a new chunk if they don't fit in the last. */
+static void add(struct tbuf *tb, size_t len);
+
+/* Write out tb, which must be locked, a chunk per write(2). */
+static void drain(struct tbuf *tb);
+
+/* Return non-zero if the oldest record in tb has waited long enough. */
+static int is_stale(const struct tbuf *tb, const struct timespec *now);
+
+int log_fd_start(int fd)
+{
+	struct log_sink sink = { fd_emit, fd_flush, NULL, fd_write };
+
+	assert(fd >= 0);
+
+	if (s.running) {
+		return -1;
+	}
+
+	pthread_once(&s.key_once, make_key);
+
+	s.fd = fd;
+	atomic_init(&s.failed, 0);
+	s.running = 1;
+
+	s.prev_sink = *log_sink();
+	log_sink_set(&sink);
+
+	return 0;
+}
+
+int log_fd_stop(void)
+{
+	if (!s.running) {
+		return 0;
+	}
+
+	log_sink_set(&s.prev_sink);
+	fd_flush(NULL);
+	s.running = 0;
+
+	return atomic_load(&s.failed) ? -1 : 0;
+}
+
+static int fd_emit(void *ctx, const struct log_record *rec, va_list ap)
+{
+	struct tbuf *tb;
+	struct timespec now;
+	size_t len;
+
+	(void)ctx;
+
+	if (clock_gettime(FLUSH_CLOCK, &now)) {
+		return -1;
+	}
+
+	tb = thread_buf();
+	if (tb == NULL) {
+		char buf[LOG_FD_RECORD_MAX];
+
+		len = log_fmt_record(buf, sizeof(buf), rec, ap);
+		if (!len || log_fmt_write_all(s.fd, buf, len)) {
+			return -1;
+		}
+		return 0;
+	}
+
+	pthread_mutex_lock(&tb->mtx);
+
+	if (LOG_FD_BUF_CAP - tb->len < LOG_FD_RECORD_MAX) {
+		drain(tb);
+	}
+
+	len = log_fmt_record(tb->buf + tb->len, LOG_FD_RECORD_MAX, rec, ap);
+	if (len) {
+		if (!tb->len) {
+			tb->oldest = now;
+		}
+		add(tb, len);
+	}
+
+	if (rec->lvl <= LOG_FD_FLUSH_LEVEL || is_stale(tb, &now)) {
+		drain(tb);
+	}
+
+	pthread_mutex_unlock(&tb->mtx);
+
+	if (!len || atomic_load_explicit(&s.failed, memory_order_relaxed)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int fd_write(void *ctx, enum log_level lvl, const char *line,
+		    size_t len)
+{
+	struct tbuf *tb;
+	struct timespec now;
+
+	(void)ctx;
+
+	if (len > LOG_FD_RECORD_MAX - 1) {
+		len = LOG_FD_RECORD_MAX - 1; /* truncated */
+	}
+
+	if (clock_gettime(FLUSH_CLOCK, &now)) {
+		return -1;
+	}
+
+	tb = thread_buf();
+	if (tb == NULL) {
+		char buf[LOG_FD_RECORD_MAX];
+
+		memcpy(buf, line, len);
+		buf[len] = '\n';
+		return log_fmt_write_all(s.fd, buf, len + 1);
+	}
+
+	pthread_mutex_lock(&tb->mtx);
+
+	if (LOG_FD_BUF_CAP - tb->len < LOG_FD_RECORD_MAX) {
+		drain(tb);
+	}
+	if (!tb->len) {
+		tb->oldest = now;
+	}
+	memcpy(tb->buf + tb->len, line, len);
+	tb->buf[tb->len + len] = '\n';
+	add(tb, len + 1);
+
+	if (lvl <= LOG_FD_FLUSH_LEVEL || is_stale(tb, &now)) {
+		drain(tb);
+	}
+
+	pthread_mutex_unlock(&tb->mtx);
+
+	return atomic_load_explicit(&s.failed, memory_order_relaxed) ? -1 : 0;
+}
+
+static int fd_flush(void *ctx)
+{
+	struct tbuf *tb;
+
+	(void)ctx;
+
+	pthread_mutex_lock(&s.list_mtx);
+	for (tb = s.bufs; tb != NULL; tb = tb->next) {
+		pthread_mutex_lock(&tb->mtx);
+		drain(tb);
+		pthread_mutex_unlock(&tb->mtx);
+	}
+	pthread_mutex_unlock(&s.list_mtx);
+
+	return atomic_load(&s.failed) ? -1 : 0;
+}
+
+static struct tbuf *thread_buf(void)
+{
+	struct tbuf *tb;
+
+	if (this_buf != NULL) {
+		return this_buf;
+	}
+
+	pthread_mutex_lock(&s.list_mtx);
+
+	tb = s.bufs;
+	while (tb != NULL && tb->in_use) {
+		tb = tb->next;
+	}
+	if (tb == NULL) {
+		tb = malloc(sizeof(*tb));
+		if (tb == NULL) {
+			pthread_mutex_unlock(&s.list_mtx);
+			return NULL;
+		}
+		pthread_mutex_init(&tb->mtx, NULL);
+		tb->len = 0;
+		tb->n_ends = 0;
+		tb->chunk = 0;
+		tb->next = s.bufs;
+		s.bufs = tb;
+	}
+	tb->in_use = 1;
+
+	pthread_mutex_unlock(&s.list_mtx);
+
+	/* if this fails there's no flush on exit, but log_flush() still
+	 * sees the buffer */
+	pthread_setspecific(s.key, tb);
+	this_buf = tb;
+
+	return tb;
+}
+
+static void make_key(void)
+{
+	if (pthread_key_create(&s.key, release_buf)) {
+		abort();
+	}
+}
+
+static void release_buf(void *p)
+{
+	struct tbuf *tb = p;
+
+	pthread_mutex_lock(&tb->mtx);
+	drain(tb);
+	pthread_mutex_unlock(&tb->mtx);
+
+	pthread_mutex_lock(&s.list_mtx);
+	tb->in_use = 0;
+	pthread_mutex_unlock(&s.list_mtx);
+
+	this_buf = NULL;
+}
+
+static void add(struct tbuf *tb, size_t len)
+{
+	assert(len <= PIPE_BUF);
+
+	if (tb->len + len - tb->chunk > PIPE_BUF) {
+		assert(tb->n_ends < CHUNKS_MAX);
+		tb->ends[tb->n_ends++] = tb->len;
+		tb->chunk = tb->len;
+	}
+	tb->len += len;
+}
+
+static void drain(struct tbuf *tb)
+{
+	size_t i, start = 0;
+
+	for (i = 0; i <= tb->n_ends; i++) {
+		size_t end = i < tb->n_ends ? tb->ends[i] : tb->len;
+
+		if (end > start &&
+		    log_fmt_write_all(s.fd, tb->buf + start, end - start)) {
+			atomic_store(&s.failed, 1);
+			break;
+		}
+		start = end;
+	}
+	tb->len = 0;
+	tb->n_ends = 0;
+	tb->chunk = 0;
+}
+
+static int is_stale(const struct tbuf *tb, const struct timespec *now)
+{
+	long ns;
+
+	if (!tb->len) {
+		return 0;
+	}
+	if (now->tv_sec - tb->oldest.tv_sec > LOG_FD_FLUSH_NS / 1000000000L) {
+		return 1;
+	}
+
+	ns = (long)(now->tv_sec - tb->oldest.tv_sec) * 1000000000L +
+	     (now->tv_nsec - tb->oldest.tv_nsec);
+	return ns >= LOG_FD_FLUSH_NS;
+}
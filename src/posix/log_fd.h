@@ -0,0 +1,62 @@
+#ifndef LOG_FD_H
+#define LOG_FD_H
+
+/*
+ * A log sink writing to a file descriptor from per-thread buffers. Each
+ * thread renders its records into its own buffer, uncontended, and hands
+ * them to the kernel in writes of whole records of at most PIPE_BUF bytes, so
+ * no lock is shared between logging threads, and records from different
+ * threads don't interleave on regular files, pipes and FIFOs. (A short write,
+ * as to a socket or a non-blocking fd, is retried, and may leave a record
+ * split by another thread's.)
+ *
+ * A thread's buffer is written out:
+ *  - immediately after a record at LOG_FD_FLUSH_LEVEL or more severe,
+ *  - when it hasn't room for another record,
+ *  - when a record is logged LOG_FD_FLUSH_NS or more after the oldest one
+ *    buffered,
+ *  - when the thread exits, and on log_flush().
+ *
+ * Records from different threads reach the fd in the order their buffers are
+ * written, not strictly in time order. A thread that stops logging holds on
+ * to its records until one of the above.
+ */
+
+#include "log.h"
+
+/* Size of each thread's buffer. */
+#ifndef LOG_FD_BUF_CAP
+#define LOG_FD_BUF_CAP 16384
+#endif
+
+/* Largest rendered record, including its newline; longer ones are truncated. */
+#ifndef LOG_FD_RECORD_MAX
+#define LOG_FD_RECORD_MAX 1024
+#endif
+
+/* Least severe level written out as soon as it is logged. */
+#ifndef LOG_FD_FLUSH_LEVEL
+#define LOG_FD_FLUSH_LEVEL LOG_LEVEL_ERR
+#endif
+
+/* Longest a record waits in a buffer while its thread keeps logging. */
+#ifndef LOG_FD_FLUSH_NS
+#define LOG_FD_FLUSH_NS 100000000L
+#endif
+
+/*
+ * Install the sink, writing to fd.
+ *
+ * Returns 0 on success, or -1 if it is already running.
+ */
+int log_fd_start(int fd);
+
+/*
+ * Write out every thread's buffer and restore the sink that was installed
+ * before log_fd_start. Nothing may be logging concurrently.
+ *
+ * Returns 0 on success, or -1 if any write failed while running.
+ */
+int log_fd_stop(void);
+
+#endif /* LOG_FD_H */
@@ -0,0 +1,90 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "log_fmt.h"
+#include "log_ts.h"
+
+size_t log_fmt_record(char *buf, size_t cap, const struct log_record *rec,
+		      va_list ap)
+{
+	static const char ellipsis[] = "...\n";
+	char now_s[LOG_TS_LEN + 1];
+	int n;
+	size_t len;
+
+	assert(buf != NULL);
+	assert(cap >= LOG_FMT_CAP_MIN);
+	assert(rec != NULL);
+
+	if (!log_ts_format(now_s)) {
+		return 0;
+	}
+
+	n = snprintf(buf, cap, "[%s] %s %s:%u ", now_s,
+		     log_level_name(rec->lvl), rec->file, rec->lineno);
+	if (n < 0) {
+		return 0;
+	}
+	len = (size_t)n < cap ? (size_t)n : cap - 1;
+
+	/* leave room for the newline */
+	n = vsnprintf(buf + len, cap - len - 1, rec->fmt, ap);
+	if (n < 0) {
+		return 0;
+	}
+	len += (size_t)n;
+
+	if (len >= cap - 1) {
+		len = cap - sizeof(ellipsis);
+		memcpy(buf + len, ellipsis, sizeof(ellipsis));
+		return len + sizeof(ellipsis) - 1;
+	}
+
+	buf[len++] = '\n';
+	buf[len] = '\0';
+	return len;
+}
+
+size_t log_fmt_note(char *buf, size_t cap, enum log_level lvl,
+		    const char *file, unsigned lineno, const char *fmt, ...)
+{
+	struct log_record rec;
+	va_list ap;
+	size_t len;
+
+	rec.lvl = lvl;
+	rec.file = file;
+	rec.lineno = lineno;
+	rec.fmt = fmt;
+	rec.site = NULL;
+
+	va_start(ap, fmt);
+	len = log_fmt_record(buf, cap, &rec, ap);
+	va_end(ap);
+
+	return len;
+}
+
+int log_fmt_write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef LOG_FMT_H
+#define LOG_FMT_H
+
+/* Rendering of log records into memory, for sinks that assemble a whole record
+ * before writing it, and writing it out. */
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include "log.h"
+
+/* Smallest buffer log_fmt_record accepts. */
+#define LOG_FMT_CAP_MIN 64
+
+/*
+ * Render the given record, its arguments in ap, as the default sink would:
+ * "[time] LEVEL file:lineno message\n", with a log_ts timestamp. Records too
+ * long for cap are truncated to end in "...\n".
+ *
+ * Returns the rendered length, which is less than cap (a terminator follows),
+ * or 0 on failure.
+ */
+size_t log_fmt_record(char *buf, size_t cap, const struct log_record *rec,
+		      va_list ap);
+
+/* log_fmt_record, for a record made up on the spot by a sink itself (e.g. to
+ * report dropped records). */
+size_t log_fmt_note(char *buf, size_t cap, enum log_level lvl,
+		    const char *file, unsigned lineno, const char *fmt, ...);
+
+/* Write all of buf to fd, retrying short and interrupted writes. Returns 0, or
+ * -1 with errno set. Only calls write(2), so it is async-signal-safe. */
+int log_fmt_write_all(int fd, const void *buf, size_t len);
+
+#endif /* LOG_FMT_H */
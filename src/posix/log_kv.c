@@ -0,0 +1,524 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "log_kv.h"
+#include "log_ts.h"
+
+#if LOG_KV_LINE_MAX < 256
+#error LOG_KV_LINE_MAX too small
+#endif
+
+/* Room kept at the end of a line for closing it, and marking it truncated. */
+#define TAIL_MAX 32
+
+/* Most keys a site renders once; any more are rendered as used. */
+#define KEYS_CACHED 32
+
+#define TRUNCATED_JSON ",\"truncated\":true"
+#define TRUNCATED_LOGFMT " truncated=true"
+
+struct key {
+	const char *key; /* as the site gave it, to check it still does */
+	const char *frag; /* rendered: ,"key": or  key= */
+	size_t len;
+};
+
+/*
+ * What a site renders once per format: its head, everything after the
+ * timestamp up to the first field, and the prefixes for its first n_keys keys.
+ * A site's cache is only replaced when the format changes, and the one replaced
+ * is kept, as other threads may still be using it.
+ */
+struct log_kv_cache_ {
+	enum log_kv_format format;
+	struct log_kv_cache_ *prev;
+	const char *head;
+	size_t head_len;
+	size_t n_keys;
+	struct key keys[];
+};
+
+/* A buffer being rendered into. Once something doesn't fit, full is set and
+ * nothing more is written. */
+struct out {
+	char *buf;
+	size_t len, cap;
+	int full;
+};
+
+static atomic_int current_format = LOG_KV_JSON;
+
+/* Most decimal places put_double renders without printf. */
+#define FRAC_DIGITS_MAX 9
+
+static const double powers10[FRAC_DIGITS_MAX + 1] = { 1e0, 1e1, 1e2, 1e3, 1e4,
+						   1e5, 1e6, 1e7, 1e8, 1e9 };
+
+static const char digits2[] = "0001020304050607080910111213141516171819"
+			      "2021222324252627282930313233343536373839"
+			      "4041424344454647484950515253545556575859"
+			      "6061626364656667686970717273747576777879"
+			      "8081828384858687888990919293949596979899";
+
+/* Render and publish the site's cache for format, replacing old, whose fields
+ * are in ap. Returns the site's cache, or NULL if memory couldn't be had. */
+static struct log_kv_cache_ *cache_site(struct log_kv_site *site,
+					struct log_kv_cache_ *old,
+					enum log_kv_format format, va_list ap);
+
+/* Skip the value of a field of the given type. */
+static void skip_value(int type, va_list *ap);
+
+static void put(struct out *o, const char *s, size_t len);
+static void put_str(struct out *o, const char *s);
+
+/* The prefix of a field, with its key. */
+static void put_key(struct out *o, enum log_kv_format format, const char *key);
+
+/* A string value, quoted and escaped as the format needs. */
+static void put_json_str(struct out *o, const char *s);
+static void put_logfmt_str(struct out *o, const char *s);
+
+static void put_uint(struct out *o, unsigned long long v);
+static void put_int(struct out *o, long long v);
+static void put_double(struct out *o, enum log_kv_format format, double v);
+
+void log_kv_format_set(enum log_kv_format format)
+{
+	atomic_store_explicit(&current_format, format, memory_order_relaxed);
+}
+
+enum log_kv_format log_kv_format(void)
+{
+	return atomic_load_explicit(&current_format, memory_order_relaxed);
+}
+
+int log_kv_emit(struct log_kv_site *site, ...)
+{
+	static _Thread_local char line[LOG_KV_LINE_MAX];
+	struct out o = { line, 0, LOG_KV_LINE_MAX - TAIL_MAX, 0 };
+	struct log_kv_cache_ *c;
+	enum log_kv_format format = log_kv_format();
+	size_t ts_len, mark, i;
+	int type, truncated = 0;
+	va_list ap;
+
+	c = atomic_load_explicit(&site->cache, memory_order_acquire);
+	if (c == NULL || c->format != format) {
+		va_start(ap, site);
+		c = cache_site(site, c, format, ap);
+		va_end(ap);
+		if (c == NULL) {
+			return -1;
+		}
+	}
+	/* which may not be format, if another thread changed it meanwhile */
+	format = c->format;
+
+	if (format == LOG_KV_JSON) {
+		put(&o, "{\"ts\":\"", 7);
+	} else {
+		put(&o, "ts=", 3);
+	}
+	ts_len = log_ts_format(line + o.len);
+	if (!ts_len) {
+		return -1;
+	}
+	o.len += ts_len;
+	put(&o, c->head, c->head_len);
+	mark = o.len;
+
+	va_start(ap, site);
+	for (i = 0; (type = va_arg(ap, int)) != LOG_KV_END_; i++) {
+		const char *key = va_arg(ap, const char *);
+
+		if (i < c->n_keys && c->keys[i].key == key) {
+			put(&o, c->keys[i].frag, c->keys[i].len);
+		} else {
+			put_key(&o, format, key);
+		}
+
+		switch (type) {
+		case LOG_KV_STR_:
+			if (format == LOG_KV_JSON) {
+				put_json_str(&o, va_arg(ap, const char *));
+			} else {
+				put_logfmt_str(&o, va_arg(ap, const char *));
+			}
+			break;
+		case LOG_KV_INT_:
+			put_int(&o, va_arg(ap, long long));
+			break;
+		case LOG_KV_UINT_:
+			put_uint(&o, va_arg(ap, unsigned long long));
+			break;
+		case LOG_KV_DOUBLE_:
+			put_double(&o, format, va_arg(ap, double));
+			break;
+		case LOG_KV_BOOL_:
+			put_str(&o, va_arg(ap, int) ? "true" : "false");
+			break;
+		default:
+			o.full = 1; /* can't tell where the next field is */
+			break;
+		}
+
+		if (o.full) {
+			truncated = 1;
+			break;
+		}
+		mark = o.len;
+	}
+	va_end(ap);
+
+	/* within TAIL_MAX, so these always fit */
+	o.len = mark;
+	if (truncated) {
+		if (format == LOG_KV_JSON) {
+			memcpy(line + o.len, TRUNCATED_JSON,
+			       sizeof(TRUNCATED_JSON) - 1);
+			o.len += sizeof(TRUNCATED_JSON) - 1;
+		} else {
+			memcpy(line + o.len, TRUNCATED_LOGFMT,
+			       sizeof(TRUNCATED_LOGFMT) - 1);
+			o.len += sizeof(TRUNCATED_LOGFMT) - 1;
+		}
+	}
+	if (format == LOG_KV_JSON) {
+		line[o.len++] = '}';
+	}
+
+	return log_write(site->site.lvl, site->site.file, site->site.lineno,
+			 line, o.len);
+}
+
+static struct log_kv_cache_ *cache_site(struct log_kv_site *site,
+					struct log_kv_cache_ *old,
+					enum log_kv_format format, va_list ap)
+{
+	/* The head may take half, so that fields always have room. */
+	char arena[LOG_KV_LINE_MAX];
+	struct out o = { arena, 0, LOG_KV_LINE_MAX / 2, 0 };
+	size_t key_off[KEYS_CACHED + 1];
+	const char *keys[KEYS_CACHED];
+	struct log_kv_cache_ *c, *expected;
+	size_t head_len, n, i;
+	char *strs;
+	int type;
+	va_list aq;
+
+	if (format == LOG_KV_JSON) {
+		put_str(&o, "\",\"level\":\"");
+		put_str(&o, log_level_name(site->site.lvl));
+		put_str(&o, "\",\"file\":");
+		put_json_str(&o, site->site.file);
+		put_str(&o, ",\"line\":");
+		put_uint(&o, site->site.lineno);
+		put_str(&o, ",\"msg\":");
+		put_json_str(&o, site->msg);
+	} else {
+		put_str(&o, " level=");
+		put_str(&o, log_level_name(site->site.lvl));
+		put_str(&o, " file=");
+		put_logfmt_str(&o, site->site.file);
+		put_str(&o, " line=");
+		put_uint(&o, site->site.lineno);
+		put_str(&o, " msg=");
+		put_logfmt_str(&o, site->msg);
+	}
+	if (o.full) {
+		return NULL; /* an unreasonable message */
+	}
+	head_len = o.len;
+
+	/* Keys for as long as they fit. */
+	o.cap = sizeof(arena);
+	va_copy(aq, ap);
+	for (n = 0; n < KEYS_CACHED; n++) {
+		size_t len = o.len;
+
+		type = va_arg(aq, int);
+		if (type == LOG_KV_END_) {
+			break;
+		}
+		keys[n] = va_arg(aq, const char *);
+		skip_value(type, &aq);
+
+		key_off[n] = len;
+		put_key(&o, format, keys[n]);
+		if (o.full) {
+			o.len = len;
+			break;
+		}
+	}
+	va_end(aq);
+	key_off[n] = o.len;
+
+	c = malloc(sizeof(*c) + n * sizeof(c->keys[0]) + o.len);
+	if (c == NULL) {
+		return NULL;
+	}
+	strs = (char *)&c->keys[n];
+	memcpy(strs, arena, o.len);
+
+	c->format = format;
+	c->prev = old;
+	c->head = strs;
+	c->head_len = head_len;
+	c->n_keys = n;
+	for (i = 0; i < n; i++) {
+		c->keys[i].key = keys[i];
+		c->keys[i].frag = strs + key_off[i];
+		c->keys[i].len = key_off[i + 1] - key_off[i];
+	}
+
+	expected = old;
+	if (!atomic_compare_exchange_strong_explicit(&site->cache, &expected, c,
+						     memory_order_acq_rel,
+						     memory_order_acquire)) {
+		free(c); /* another thread beat us to it */
+		return expected;
+	}
+	return c;
+}
+
+static void skip_value(int type, va_list *ap)
+{
+	switch (type) {
+	case LOG_KV_STR_:
+		(void)va_arg(*ap, const char *);
+		break;
+	case LOG_KV_INT_:
+		(void)va_arg(*ap, long long);
+		break;
+	case LOG_KV_UINT_:
+		(void)va_arg(*ap, unsigned long long);
+		break;
+	case LOG_KV_DOUBLE_:
+		(void)va_arg(*ap, double);
+		break;
+	case LOG_KV_BOOL_:
+		(void)va_arg(*ap, int);
+		break;
+	}
+}
+
+static void put(struct out *o, const char *s, size_t len)
+{
+	if (o->full || len > o->cap - o->len) {
+		o->full = 1;
+		return;
+	}
+	memcpy(o->buf + o->len, s, len);
+	o->len += len;
+}
+
+static void put_str(struct out *o, const char *s)
+{
+	put(o, s, strlen(s));
+}
+
+static void put_key(struct out *o, enum log_kv_format format, const char *key)
+{
+	const char *k;
+
+	if (format == LOG_KV_JSON) {
+		put(o, ",", 1);
+		put_json_str(o, key);
+		put(o, ":", 1);
+		return;
+	}
+
+	/* logfmt keys can't be quoted, so anything that would need it goes */
+	put(o, " ", 1);
+	if (!*key) {
+		put(o, "_", 1);
+	}
+	for (k = key; *k; k++) {
+		unsigned char ch = (unsigned char)*k;
+
+		if (ch <= ' ' || ch == '=' || ch == '"' || ch == 0x7f) {
+			put(o, "_", 1);
+		} else {
+			put(o, k, 1);
+		}
+	}
+	put(o, "=", 1);
+}
+
+static void put_json_str(struct out *o, const char *s)
+{
+	const char *run;
+
+	if (s == NULL) {
+		put(o, "null", 4);
+		return;
+	}
+
+	put(o, "\"", 1);
+	for (;;) {
+		char esc[7];
+		unsigned char ch;
+
+		for (run = s; (unsigned char)*s >= 0x20 && *s != '"' &&
+			      *s != '\\';
+		     s++) {
+		}
+		put(o, run, (size_t)(s - run));
+
+		ch = (unsigned char)*s++;
+		switch (ch) {
+		case '\0':
+			put(o, "\"", 1);
+			return;
+		case '"':
+			put(o, "\\\"", 2);
+			break;
+		case '\\':
+			put(o, "\\\\", 2);
+			break;
+		case '\n':
+			put(o, "\\n", 2);
+			break;
+		case '\r':
+			put(o, "\\r", 2);
+			break;
+		case '\t':
+			put(o, "\\t", 2);
+			break;
+		default:
+			snprintf(esc, sizeof(esc), "\\u%04x", ch);
+			put(o, esc, 6);
+			break;
+		}
+	}
+}
+
+static void put_logfmt_str(struct out *o, const char *s)
+{
+	const char *p;
+
+	if (s == NULL) {
+		return;
+	}
+
+	for (p = s; *p; p++) {
+		unsigned char ch = (unsigned char)*p;
+
+		if (ch <= ' ' || ch == '=' || ch == '"' || ch == 0x7f) {
+			break;
+		}
+	}
+	if (!*p && p != s) {
+		put(o, s, (size_t)(p - s)); /* needs no quoting */
+		return;
+	}
+
+	/* quoted, escaped as JSON, which is what logfmt parsers expect */
+	put_json_str(o, s);
+}
+
+static void put_uint(struct out *o, unsigned long long v)
+{
+	char buf[20]; /* 2^64 - 1 has 20 digits */
+	char *p = buf + sizeof(buf);
+
+	while (v >= 100) {
+		const char *d = &digits2[(v % 100) * 2];
+
+		v /= 100;
+		*--p = d[1];
+		*--p = d[0];
+	}
+	if (v >= 10) {
+		*--p = digits2[v * 2 + 1];
+		*--p = digits2[v * 2];
+	} else {
+		*--p = (char)('0' + v);
+	}
+	put(o, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+static void put_int(struct out *o, long long v)
+{
+	if (v < 0) {
+		put(o, "-", 1);
+		/* negated unsigned, as -LLONG_MIN overflows */
+		put_uint(o, -(unsigned long long)v);
+	} else {
+		put_uint(o, (unsigned long long)v);
+	}
+}
+
+static void put_double(struct out *o, enum log_kv_format format, double v)
+{
+	char buf[32];
+	int len;
+
+	if (isnan(v) || isinf(v)) {
+		if (format == LOG_KV_JSON) {
+			put(o, "null", 4);
+		} else {
+			put_str(o, isnan(v) ? "NaN" : v > 0 ? "+Inf" : "-Inf");
+		}
+		return;
+	}
+
+	/* Integers up to 2^53 are exact, and the common case. */
+	if (v >= -9007199254740992.0 && v <= 9007199254740992.0 &&
+	    v == (double)(long long)v) {
+		put_int(o, (long long)v);
+		return;
+	}
+
+	/* Then few decimal places, n / 10^k: as both are exact, the division
+	 * rounds as reading the digits back would, so that checks them. */
+	if (v > -1e9 && v < 1e9) {
+		unsigned long long n, ip, fp;
+		char digits[FRAC_DIGITS_MAX + 1];
+		size_t k, j;
+
+		for (k = 1; k <= FRAC_DIGITS_MAX; k++) {
+			double s = (v < 0 ? -v : v) * powers10[k];
+
+			n = (unsigned long long)s;
+			if ((double)n == s && (double)n / powers10[k] ==
+						      (v < 0 ? -v : v)) {
+				break;
+			}
+		}
+		if (k <= FRAC_DIGITS_MAX) {
+			ip = n / (unsigned long long)powers10[k];
+			fp = n % (unsigned long long)powers10[k];
+			digits[0] = '.';
+			for (j = k; j; j--) {
+				digits[j] = (char)('0' + fp % 10);
+				fp /= 10;
+			}
+			while (digits[k] == '0') {
+				k--;
+			}
+
+			if (v < 0) {
+				put(o, "-", 1);
+			}
+			put_uint(o, ip);
+			put(o, digits, k + 1);
+			return;
+		}
+	}
+
+	/* Otherwise the shortest of the usual precisions that reads back the
+	 * same. */
+	len = snprintf(buf, sizeof(buf), "%.15g", v);
+	if (strtod(buf, NULL) != v) {
+		len = snprintf(buf, sizeof(buf), "%.17g", v);
+	}
+	put(o, buf, (size_t)len);
+}
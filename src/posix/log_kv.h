@@ -0,0 +1,113 @@
+#ifndef LOG_KV_H
+#define LOG_KV_H
+
+/*
+ * Structured logging: records made of a message and typed key/value pairs,
+ * written to the current sink as JSON lines or logfmt rather than printf text,
+ * so nothing downstream has to parse them back apart:
+ *
+ *	log_kv_info("request done", LOG_KV_STR("path", path),
+ *		    LOG_KV_UINT("status", status), LOG_KV_DOUBLE("secs", t));
+ *
+ *	{"ts":"2026-10-19T13:14:35.123456Z","level":"INFO","file":"srv.c",
+ *	 "line":42,"msg":"request done","path":"/","status":200,"secs":0.25}
+ *	ts=2026-10-19T13:14:35.123456Z level=INFO file=srv.c line=42
+ *	 msg="request done" path=/ status=200 secs=0.25
+ *
+ * (each one line). The message and keys must be string literals, or at least
+ * outlive the program's logging: each call site renders its level, file, line,
+ * message and key prefixes, escaped, once per output format, and thereafter
+ * only its values. Numbers are rendered without printf, except for doubles
+ * that aren't integers.
+ *
+ * Call sites are filtered as with the log_* macros of log.h, and their records
+ * handed to the sink with log_write. Records longer than LOG_KV_LINE_MAX are
+ * cut after their last whole field and marked "truncated".
+ */
+
+#include <stdatomic.h>
+
+#include "log.h"
+
+/* Longest record rendered, excluding its newline. */
+#ifndef LOG_KV_LINE_MAX
+#define LOG_KV_LINE_MAX 4096
+#endif
+
+enum log_kv_format {
+	LOG_KV_JSON, /* one JSON object per line (the default) */
+	LOG_KV_LOGFMT /* space-separated key=value pairs */
+};
+
+/* Set the output format of all call sites. */
+void log_kv_format_set(enum log_kv_format format);
+enum log_kv_format log_kv_format(void);
+
+/*
+ * The fields of a record, each converted to its type. A string that is NULL is
+ * written as null (JSON) or an empty value (logfmt); non-finite doubles are
+ * written as null (JSON) or NaN, +Inf and -Inf (logfmt).
+ */
+#define LOG_KV_STR(K, V) LOG_KV_STR_, (const char *)(K), (const char *)(V)
+#define LOG_KV_INT(K, V) LOG_KV_INT_, (const char *)(K), (long long)(V)
+#define LOG_KV_UINT(K, V) \
+	LOG_KV_UINT_, (const char *)(K), (unsigned long long)(V)
+#define LOG_KV_DOUBLE(K, V) LOG_KV_DOUBLE_, (const char *)(K), (double)(V)
+#define LOG_KV_BOOL(K, V) LOG_KV_BOOL_, (const char *)(K), (V) ? 1 : 0
+
+/* For the macros above, and log_kv_emit's callers, only. */
+enum log_kv_type_ {
+	LOG_KV_END_,
+	LOG_KV_STR_,
+	LOG_KV_INT_,
+	LOG_KV_UINT_,
+	LOG_KV_DOUBLE_,
+	LOG_KV_BOOL_
+};
+
+struct log_kv_cache_;
+
+/* A structured call site: a log_site, its message, and what it has rendered
+ * once for the current format. */
+struct log_kv_site {
+	struct log_site site;
+	const char *msg;
+	_Atomic(struct log_kv_cache_ *) cache;
+};
+
+/*
+ * Render and write a record for the site, its fields following as given by the
+ * LOG_KV_* macros and ending with LOG_KV_END_. The caller has already filtered
+ * it. Returns 0 on success, or -1 on failure.
+ */
+int log_kv_emit(struct log_kv_site *site, ...);
+
+/* A structured call site, as LOG_SITE_ of log.h. The arguments are the message
+ * then the fields, followed by LOG_KV_END_. */
+#define LOG_KV_(LVL, MSG, ...)                                                \
+	do {                                                                  \
+		static struct log_kv_site log_kv_site_ = {                    \
+			{ LVL, __FILE__, __LINE__, LOG_MODULE, 0, 0, 0,       \
+			  NULL },                                             \
+			MSG,                                                  \
+			NULL                                                  \
+		};                                                            \
+		if ((LVL) <= LOG_LEVEL_COMPILED_MIN &&                        \
+		    (log_kv_site_.site.gen == log_filter_gen_ ?               \
+			     log_kv_site_.site.enabled :                      \
+			     log_site_enabled_(&log_kv_site_.site))) {        \
+			log_kv_emit(&log_kv_site_, __VA_ARGS__);              \
+		}                                                             \
+	} while (0)
+
+#define log_kv_emerg(...) LOG_KV_(LOG_LEVEL_EMERG, __VA_ARGS__, LOG_KV_END_)
+#define log_kv_alert(...) LOG_KV_(LOG_LEVEL_ALERT, __VA_ARGS__, LOG_KV_END_)
+#define log_kv_crit(...) LOG_KV_(LOG_LEVEL_CRIT, __VA_ARGS__, LOG_KV_END_)
+#define log_kv_err(...) LOG_KV_(LOG_LEVEL_ERR, __VA_ARGS__, LOG_KV_END_)
+#define log_kv_warning(...) \
+	LOG_KV_(LOG_LEVEL_WARNING, __VA_ARGS__, LOG_KV_END_)
+#define log_kv_notice(...) LOG_KV_(LOG_LEVEL_NOTICE, __VA_ARGS__, LOG_KV_END_)
+#define log_kv_info(...) LOG_KV_(LOG_LEVEL_INFO, __VA_ARGS__, LOG_KV_END_)
+#define log_kv_debug(...) LOG_KV_(LOG_LEVEL_DEBUG, __VA_ARGS__, LOG_KV_END_)
+
+#endif /* LOG_KV_H */
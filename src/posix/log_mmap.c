@@ -0,0 +1,467 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "log_fmt.h"
+#include "log_mmap.h"
+
+#if LOG_MMAP_RECORD_MAX < LOG_FMT_CAP_MIN
+#error LOG_MMAP_RECORD_MAX too small
+#endif
+
+/*
+ * A mapped segment. Writers reserve [off, off + len) with an atomic add; the
+ * first whose reservation doesn't fit sets used to its off, which is then
+ * final, as every reservation before it fit. Once committed reaches used, no
+ * writer is still copying in and the segment can be retired.
+ *
+ * Segments are never freed while running, as a writer may still be looking at
+ * one long retired - though only at off, which it will find past size.
+ */
+struct seg {
+	char *map;
+	size_t size;
+	int fd;
+	char *path;
+
+	atomic_size_t off, committed, used;
+	struct seg *next_retiring, *next_all;
+};
+
+#define USED_UNKNOWN ((size_t)-1)
+
+static struct {
+	char *path;
+	size_t seg_size;
+	int msync_async;
+	unsigned long seq; /* next segment number to try */
+
+	_Atomic(struct seg *) cur;
+
+	pthread_mutex_t mtx;
+	pthread_cond_t bg_wake, changed;
+
+	/* under mtx */
+	struct seg *next; /* ready to switch to, or NULL */
+	struct seg *pending; /* full, waiting for next */
+	struct seg *retiring; /* full, to be retired by the background */
+	struct seg *all; /* every segment created */
+	int stopping;
+	int want; /* next couldn't be created; retrying */
+
+	atomic_int failed;
+	atomic_ulong dropped;
+
+	pthread_t bg;
+	int running;
+	struct log_sink prev_sink;
+} m = { .mtx = PTHREAD_MUTEX_INITIALIZER,
+	.bg_wake = PTHREAD_COND_INITIALIZER,
+	.changed = PTHREAD_COND_INITIALIZER };
+
+static int mmap_emit(void *ctx, const struct log_record *rec, va_list ap);
+static int mmap_flush(void *ctx);
+static int mmap_write(void *ctx, enum log_level lvl, const char *line,
+		      size_t len);
+
+/* Copy len bytes of buf into the current segment, switching segments as
+ * needed. Returns 0, or -1 if the record was dropped. */
+static int append(const char *buf, size_t len);
+
+/* Handle a reservation at off in seg that didn't fit. Returns 0 once it is
+ * worth retrying with the current segment, or -1 to drop the record. */
+static int overflow(struct seg *seg, size_t off);
+
+/* Switch from the current segment, seg, to next. Called with mtx held. */
+static void switch_to_next(struct seg *seg);
+
+/* Create and map a new segment, or return NULL on failure. */
+static struct seg *seg_create(void);
+
+/* Wait for writers to finish with seg, then unmap, truncate and close it. */
+static int seg_retire(struct seg *seg);
+
+/* Unmap, close and remove an unused segment. */
+static void seg_discard(struct seg *seg);
+
+static void *bg_main(void *arg);
+
+int log_mmap_start(const char *path, size_t segment_size, int msync_async)
+{
+	struct log_sink sink = { mmap_emit, mmap_flush, NULL, mmap_write };
+	struct seg *first;
+
+	assert(path != NULL);
+	assert(segment_size >= 2 * LOG_MMAP_RECORD_MAX);
+
+	if (m.running) {
+		return -1;
+	}
+
+	m.path = strdup(path);
+	if (m.path == NULL) {
+		return -1;
+	}
+	m.seg_size = segment_size;
+	m.msync_async = msync_async;
+	m.seq = 0;
+	m.next = m.pending = m.retiring = m.all = NULL;
+	m.stopping = 0;
+	m.want = 0;
+	atomic_init(&m.failed, 0);
+	atomic_init(&m.dropped, 0);
+
+	first = seg_create();
+	if (first == NULL) {
+		free(m.path);
+		return -1;
+	}
+	atomic_init(&m.cur, first);
+
+	if (pthread_create(&m.bg, NULL, bg_main, NULL)) {
+		seg_discard(first);
+		free(first);
+		m.all = NULL;
+		free(m.path);
+		return -1;
+	}
+	m.running = 1;
+
+	m.prev_sink = *log_sink();
+	log_sink_set(&sink);
+
+	return 0;
+}
+
+int log_mmap_stop(void)
+{
+	struct seg *seg, *cur;
+	size_t off;
+
+	if (!m.running) {
+		return 0;
+	}
+
+	log_sink_set(&m.prev_sink);
+
+	pthread_mutex_lock(&m.mtx);
+	m.stopping = 1;
+	pthread_cond_signal(&m.bg_wake);
+	pthread_mutex_unlock(&m.mtx);
+	pthread_join(m.bg, NULL);
+
+	/* Nothing is logging, so what is reserved is written. */
+	cur = atomic_load(&m.cur);
+	off = atomic_load(&cur->off);
+	if (atomic_load(&cur->used) == USED_UNKNOWN) {
+		atomic_store(&cur->used, off < cur->size ? off : cur->size);
+	}
+	if (seg_retire(cur)) {
+		atomic_store(&m.failed, 1);
+	}
+	if (m.next != NULL) {
+		seg_discard(m.next);
+	}
+
+	while ((seg = m.all) != NULL) {
+		m.all = seg->next_all;
+		free(seg->path);
+		free(seg);
+	}
+	free(m.path);
+	m.running = 0;
+
+	return atomic_load(&m.failed) ? -1 : 0;
+}
+
+unsigned long log_mmap_dropped(void)
+{
+	return atomic_load_explicit(&m.dropped, memory_order_relaxed);
+}
+
+static int mmap_emit(void *ctx, const struct log_record *rec, va_list ap)
+{
+	char buf[LOG_MMAP_RECORD_MAX];
+	size_t len;
+
+	(void)ctx;
+
+	len = log_fmt_record(buf, sizeof(buf), rec, ap);
+	if (!len) {
+		return -1;
+	}
+	return append(buf, len);
+}
+
+static int mmap_write(void *ctx, enum log_level lvl, const char *line,
+		      size_t len)
+{
+	char buf[LOG_MMAP_RECORD_MAX];
+
+	(void)ctx;
+	(void)lvl;
+
+	if (len > sizeof(buf) - 1) {
+		len = sizeof(buf) - 1; /* truncated */
+	}
+	memcpy(buf, line, len);
+	buf[len] = '\n';
+
+	return append(buf, len + 1);
+}
+
+static int append(const char *buf, size_t len)
+{
+	for (;;) {
+		struct seg *seg;
+		size_t off;
+
+		seg = atomic_load_explicit(&m.cur, memory_order_acquire);
+		off = atomic_fetch_add_explicit(&seg->off, len,
+						memory_order_relaxed);
+
+		if (off <= seg->size && len <= seg->size - off) {
+			memcpy(seg->map + off, buf, len);
+			atomic_fetch_add_explicit(&seg->committed, len,
+						  memory_order_release);
+			return 0;
+		}
+
+		if (overflow(seg, off)) {
+			atomic_fetch_add_explicit(&m.dropped, 1,
+						  memory_order_relaxed);
+			return -1;
+		}
+	}
+}
+
+static int mmap_flush(void *ctx)
+{
+	struct seg *seg;
+	int rc;
+
+	(void)ctx;
+
+	/* holding mtx keeps the segment from being retired meanwhile */
+	pthread_mutex_lock(&m.mtx);
+	seg = atomic_load(&m.cur);
+	rc = msync(seg->map, seg->size, MS_SYNC);
+	pthread_mutex_unlock(&m.mtx);
+
+	return rc || atomic_load(&m.failed) ? -1 : 0;
+}
+
+static int overflow(struct seg *seg, size_t off)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&m.mtx);
+
+	if (off <= seg->size) {
+		/* The first not to fit: the segment is now full. */
+		atomic_store(&seg->used, off);
+		while (m.next == NULL && !m.want) {
+			pthread_cond_wait(&m.changed, &m.mtx);
+		}
+		if (m.next != NULL) {
+			switch_to_next(seg);
+		} else {
+			/* the background switches once it can */
+			m.pending = seg;
+			rc = -1;
+		}
+	} else {
+		while (atomic_load(&m.cur) == seg && !m.want) {
+			pthread_cond_wait(&m.changed, &m.mtx);
+		}
+		if (atomic_load(&m.cur) == seg) {
+			rc = -1;
+		}
+	}
+
+	pthread_mutex_unlock(&m.mtx);
+
+	return rc;
+}
+
+static void switch_to_next(struct seg *seg)
+{
+	atomic_store_explicit(&m.cur, m.next, memory_order_release);
+	m.next = NULL;
+	m.pending = NULL;
+
+	seg->next_retiring = m.retiring;
+	m.retiring = seg;
+
+	pthread_cond_broadcast(&m.changed);
+	pthread_cond_signal(&m.bg_wake);
+}
+
+static struct seg *seg_create(void)
+{
+	struct seg *seg;
+	size_t path_cap = strlen(m.path) + sizeof(".18446744073709551615");
+
+	seg = malloc(sizeof(*seg));
+	if (seg == NULL) {
+		return NULL;
+	}
+	seg->path = malloc(path_cap);
+	if (seg->path == NULL) {
+		free(seg);
+		return NULL;
+	}
+
+	for (;;) {
+		snprintf(seg->path, path_cap, "%s.%lu", m.path, m.seq++);
+		seg->fd = open(seg->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+			       0644);
+		if (seg->fd >= 0) {
+			break;
+		}
+		if (errno != EEXIST) {
+			goto fail;
+		}
+	}
+
+	if (ftruncate(seg->fd, (off_t)m.seg_size)) {
+		goto fail_file;
+	}
+	seg->map = mmap(NULL, m.seg_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			seg->fd, 0);
+	if (seg->map == MAP_FAILED) {
+		goto fail_file;
+	}
+
+	seg->size = m.seg_size;
+	atomic_init(&seg->off, 0);
+	atomic_init(&seg->committed, 0);
+	atomic_init(&seg->used, USED_UNKNOWN);
+	seg->next_retiring = NULL;
+	seg->next_all = m.all;
+	m.all = seg;
+
+	return seg;
+
+fail_file:
+	close(seg->fd);
+	unlink(seg->path);
+fail:
+	free(seg->path);
+	free(seg);
+	return NULL;
+}
+
+static int seg_retire(struct seg *seg)
+{
+	size_t used = atomic_load(&seg->used);
+	int rc = 0;
+
+	assert(used != USED_UNKNOWN);
+
+	/* Writers that reserved space before it filled are copying in. */
+	while (atomic_load_explicit(&seg->committed, memory_order_acquire) !=
+	       used) {
+		sched_yield();
+	}
+
+	if (m.msync_async && used && msync(seg->map, used, MS_ASYNC)) {
+		rc = -1;
+	}
+	if (munmap(seg->map, seg->size)) {
+		rc = -1;
+	}
+	if (ftruncate(seg->fd, (off_t)used)) {
+		rc = -1;
+	}
+	if (close(seg->fd)) {
+		rc = -1;
+	}
+	return rc;
+}
+
+static void seg_discard(struct seg *seg)
+{
+	munmap(seg->map, seg->size);
+	close(seg->fd);
+	unlink(seg->path);
+}
+
+static void *bg_main(void *arg)
+{
+	(void)arg;
+
+	pthread_mutex_lock(&m.mtx);
+
+	for (;;) {
+		if (m.retiring != NULL) {
+			struct seg *seg = m.retiring;
+
+			m.retiring = seg->next_retiring;
+			pthread_mutex_unlock(&m.mtx);
+			if (seg_retire(seg)) {
+				atomic_store(&m.failed, 1);
+			}
+			pthread_mutex_lock(&m.mtx);
+			continue;
+		}
+
+		if (m.stopping) {
+			break;
+		}
+
+		if (m.next == NULL) {
+			struct seg *seg;
+
+			pthread_mutex_unlock(&m.mtx);
+			seg = seg_create();
+			pthread_mutex_lock(&m.mtx);
+
+			if (seg != NULL) {
+				m.next = seg;
+				m.want = 0;
+				if (m.pending != NULL) {
+					switch_to_next(m.pending);
+				}
+				pthread_cond_broadcast(&m.changed);
+				continue;
+			}
+
+			if (!m.want) {
+				m.want = 1;
+				atomic_store(&m.failed, 1);
+				pthread_cond_broadcast(&m.changed);
+			}
+		}
+
+		if (m.want) {
+			struct timespec until;
+
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += LOG_MMAP_RETRY_NS;
+			while (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&m.bg_wake, &m.mtx, &until);
+		} else {
+			pthread_cond_wait(&m.bg_wake, &m.mtx);
+		}
+	}
+
+	pthread_mutex_unlock(&m.mtx);
+
+	return NULL;
+}
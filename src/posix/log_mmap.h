@@ -0,0 +1,57 @@
+#ifndef LOG_MMAP_H
+#define LOG_MMAP_H
+
+/*
+ * A log sink appending to memory-mapped, pre-sized log file segments,
+ * path.0, path.1, ... (skipping any that exist). Logging threads reserve
+ * space in the current segment with an atomic add and copy their record into
+ * the mapping: no locks, and no system calls.
+ *
+ * A background thread keeps the next segment created and mapped. When a
+ * record doesn't fit, the thread logging it switches to that segment, and the
+ * background thread retires the full one once its last records are copied
+ * in: it is optionally msync'd (MS_ASYNC), unmapped, and truncated to what
+ * was written. Until then a segment is its full size, its tail NUL bytes.
+ *
+ * Should the next segment not be ready, threads wait for it; should it not
+ * be creatable (e.g. the disk is full), records are dropped until it is.
+ *
+ * log_flush() msyncs the current segment (MS_SYNC).
+ */
+
+#include <stddef.h>
+
+/* Largest rendered record, including its newline; longer ones are truncated. */
+#ifndef LOG_MMAP_RECORD_MAX
+#define LOG_MMAP_RECORD_MAX 1024
+#endif
+
+/* How often the background thread retries creating a segment. */
+#ifndef LOG_MMAP_RETRY_NS
+#define LOG_MMAP_RETRY_NS 1000000000L
+#endif
+
+/*
+ * Install the sink, writing segments of segment_size bytes (at least
+ * 2 * LOG_MMAP_RECORD_MAX) named after path. If msync_async, retired segments
+ * are msync'd with MS_ASYNC.
+ *
+ * Returns 0 on success, or -1 if the first segment or the background thread
+ * couldn't be had, or it is already running.
+ */
+int log_mmap_start(const char *path, size_t segment_size, int msync_async);
+
+/*
+ * Retire the current segment, remove the unused next one, stop the background
+ * thread, and restore the sink that was installed before log_mmap_start.
+ * Nothing may be logging concurrently.
+ *
+ * Returns 0 on success, or -1 if any segment couldn't be created or retired
+ * while running.
+ */
+int log_mmap_stop(void);
+
+/* Number of records dropped for want of a segment since starting. */
+unsigned long log_mmap_dropped(void);
+
+#endif /* LOG_MMAP_H */
@@ -0,0 +1,337 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "log.h"
+#include "log_ratelimit.h"
+
+#if LOG_RATELIMIT_SITES & (LOG_RATELIMIT_SITES - 1)
+#error LOG_RATELIMIT_SITES must be a power of two
+#endif
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define LIMIT_CLOCK CLOCK_MONOTONIC_COARSE
+#else
+#define LIMIT_CLOCK CLOCK_MONOTONIC
+#endif
+
+/* Slots probed for a site before giving up on limiting it. */
+#define PROBE_MAX 16
+
+/*
+ * A site's state. The bucket is kept as a theoretical arrival time (as in
+ * GCRA): a record passes if tat - now is within the burst, advancing tat by
+ * one record's interval. key is claimed first; file and lineno are for
+ * reporting, and may lag it.
+ */
+struct slot {
+	atomic_uintptr_t key; /* 0 if free */
+	_Atomic(const char *) file;
+	atomic_uint lineno;
+
+	atomic_int_least64_t tat;
+	atomic_ulong over; /* records over the limit, for sampling */
+	atomic_ulong suppressed; /* not yet reported */
+	atomic_int_least64_t reported; /* when suppressed was last reported */
+};
+
+static struct {
+	struct slot *slots;
+	int_least64_t interval, window; /* ns per record, ns of burst */
+	unsigned long sample;
+
+	atomic_ulong suppressed;
+	struct log_sink inner;
+	int running;
+} rl;
+
+static int ratelimit_emit(void *ctx, const struct log_record *rec,
+			  va_list ap);
+static int ratelimit_flush(void *ctx);
+static int ratelimit_write(void *ctx, enum log_level lvl, const char *line,
+			   size_t len);
+
+/* Return the record's site key - never 0. */
+static uintptr_t site_key(const struct log_record *rec);
+
+/* Find or claim the slot for the record's site, or return NULL if the table
+ * has no room near its hash. */
+static struct slot *find_slot(const struct log_record *rec);
+
+/* Take a token from the slot's bucket, returning non-zero if there was one. */
+static int take_token(struct slot *s, int_least64_t now);
+
+/* Report suppressions for the slot, if any, through the inner sink. */
+static int report(struct slot *s, const char *file, unsigned lineno,
+		  int_least64_t now);
+
+/* Emit a record of the sink's own through the inner sink. */
+static int emit_note(enum log_level lvl, const char *file, unsigned lineno,
+		     const char *fmt, ...);
+
+/* Monotonic time in ns, or -1 on failure. */
+static int_least64_t now_ns(void);
+
+int log_ratelimit_start(const struct log_ratelimit *limits)
+{
+	struct log_sink sink = { ratelimit_emit, ratelimit_flush, NULL, NULL };
+	int_least64_t now = now_ns();
+	size_t i;
+
+	assert(limits != NULL);
+	assert(limits->rate >= 1 && limits->rate <= 1000000000UL);
+	assert(limits->burst >= 1);
+
+	if (rl.running) {
+		return -1;
+	}
+
+	rl.slots = malloc(LOG_RATELIMIT_SITES * sizeof(*rl.slots));
+	if (rl.slots == NULL) {
+		return -1;
+	}
+	for (i = 0; i < LOG_RATELIMIT_SITES; i++) {
+		atomic_init(&rl.slots[i].key, 0);
+		atomic_init(&rl.slots[i].file, NULL);
+		atomic_init(&rl.slots[i].lineno, 0);
+		atomic_init(&rl.slots[i].tat, 0);
+		atomic_init(&rl.slots[i].over, 0);
+		atomic_init(&rl.slots[i].suppressed, 0);
+		atomic_init(&rl.slots[i].reported, now);
+	}
+
+	rl.interval = 1000000000LL / (int_least64_t)limits->rate;
+	rl.window = rl.interval * (int_least64_t)limits->burst;
+	rl.sample = limits->sample;
+	atomic_init(&rl.suppressed, 0);
+
+	/* Lines written whole carry no site to key on; they pass through. */
+	rl.inner = *log_sink();
+	if (rl.inner.write != NULL) {
+		sink.write = ratelimit_write;
+	}
+	log_sink_set(&sink);
+	rl.running = 1;
+
+	return 0;
+}
+
+int log_ratelimit_stop(void)
+{
+	int rc;
+
+	if (!rl.running) {
+		return 0;
+	}
+
+	rc = ratelimit_flush(NULL);
+	log_sink_set(&rl.inner);
+	rl.running = 0;
+
+	free(rl.slots);
+	rl.slots = NULL;
+
+	return rc;
+}
+
+unsigned long log_ratelimit_suppressed(void)
+{
+	return atomic_load_explicit(&rl.suppressed, memory_order_relaxed);
+}
+
+static int ratelimit_emit(void *ctx, const struct log_record *rec,
+			  va_list ap)
+{
+	struct slot *s;
+	int_least64_t now;
+	unsigned long over;
+	int sampled;
+
+	(void)ctx;
+
+	if (rec->lvl <= LOG_RATELIMIT_EXEMPT_LEVEL) {
+		return rl.inner.emit(rl.inner.ctx, rec, ap);
+	}
+
+	now = now_ns();
+	s = find_slot(rec);
+	if (s == NULL || now < 0) {
+		return rl.inner.emit(rl.inner.ctx, rec, ap);
+	}
+
+	if (take_token(s, now)) {
+		if (atomic_load_explicit(&s->suppressed,
+					 memory_order_relaxed)) {
+			report(s, rec->file, rec->lineno, now);
+		}
+		return rl.inner.emit(rl.inner.ctx, rec, ap);
+	}
+
+	over = atomic_fetch_add_explicit(&s->over, 1, memory_order_relaxed);
+	sampled = rl.sample && over % rl.sample == 0;
+	if (!sampled) {
+		atomic_fetch_add_explicit(&s->suppressed, 1,
+					  memory_order_relaxed);
+		atomic_fetch_add_explicit(&rl.suppressed, 1,
+					  memory_order_relaxed);
+	}
+
+	if (now - atomic_load_explicit(&s->reported, memory_order_relaxed) >=
+	    LOG_RATELIMIT_SUMMARY_NS) {
+		report(s, rec->file, rec->lineno, now);
+	}
+	return sampled ? rl.inner.emit(rl.inner.ctx, rec, ap) : 0;
+}
+
+static int ratelimit_write(void *ctx, enum log_level lvl, const char *line,
+			   size_t len)
+{
+	(void)ctx;
+
+	return rl.inner.write(rl.inner.ctx, lvl, line, len);
+}
+
+static int ratelimit_flush(void *ctx)
+{
+	int_least64_t now = now_ns();
+	size_t i;
+
+	(void)ctx;
+
+	for (i = 0; i < LOG_RATELIMIT_SITES; i++) {
+		struct slot *s = &rl.slots[i];
+		const char *file;
+
+		if (!atomic_load_explicit(&s->suppressed,
+					  memory_order_relaxed)) {
+			continue;
+		}
+		file = atomic_load_explicit(&s->file, memory_order_acquire);
+		if (file != NULL) {
+			report(s, file,
+			       atomic_load_explicit(&s->lineno,
+						    memory_order_relaxed),
+			       now);
+		}
+	}
+
+	return rl.inner.flush != NULL ? rl.inner.flush(rl.inner.ctx) : 0;
+}
+
+static uintptr_t site_key(const struct log_record *rec)
+{
+	uintptr_t key;
+
+	if (rec->site != NULL) {
+		return (uintptr_t)rec->site;
+	}
+
+	/* Not a pointer to anything, but unlikely to collide with one, and
+	 * odd so never 0. */
+	key = (uintptr_t)rec->file * 31 + rec->lineno;
+	return key << 1 | 1;
+}
+
+static struct slot *find_slot(const struct log_record *rec)
+{
+	uintptr_t key = site_key(rec);
+	size_t i, h;
+
+	/* Fibonacci hashing, as pointers' low bits are mostly alignment */
+	h = (size_t)((uint64_t)key * 0x9E3779B97F4A7C15ULL >> 32);
+
+	for (i = 0; i < PROBE_MAX; i++) {
+		struct slot *s = &rl.slots[(h + i) % LOG_RATELIMIT_SITES];
+		uintptr_t cur;
+
+		cur = atomic_load_explicit(&s->key, memory_order_relaxed);
+
+		if (cur == key) {
+			return s;
+		}
+		if (cur == 0) {
+			if (atomic_compare_exchange_strong_explicit(
+				    &s->key, &cur, key, memory_order_relaxed,
+				    memory_order_relaxed)) {
+				atomic_store_explicit(&s->lineno, rec->lineno,
+						      memory_order_relaxed);
+				atomic_store_explicit(&s->file, rec->file,
+						      memory_order_release);
+				return s;
+			}
+			if (cur == key) {
+				return s; /* claimed for this site meanwhile */
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int take_token(struct slot *s, int_least64_t now)
+{
+	int_least64_t tat;
+
+	tat = atomic_load_explicit(&s->tat, memory_order_relaxed);
+	for (;;) {
+		int_least64_t from = tat > now ? tat : now;
+
+		if (from + rl.interval - now > rl.window) {
+			return 0;
+		}
+		if (atomic_compare_exchange_weak_explicit(
+			    &s->tat, &tat, from + rl.interval,
+			    memory_order_relaxed, memory_order_relaxed)) {
+			return 1;
+		}
+	}
+}
+
+static int report(struct slot *s, const char *file, unsigned lineno,
+		  int_least64_t now)
+{
+	unsigned long n;
+
+	atomic_store_explicit(&s->reported, now, memory_order_relaxed);
+
+	n = atomic_exchange_explicit(&s->suppressed, 0, memory_order_relaxed);
+	if (!n) {
+		return 0; /* another thread got there first */
+	}
+	return emit_note(LOG_LEVEL_WARNING, file, lineno,
+			 "%lu similar records suppressed", n);
+}
+
+static int emit_note(enum log_level lvl, const char *file, unsigned lineno,
+		     const char *fmt, ...)
+{
+	struct log_record rec;
+	va_list ap;
+	int rc;
+
+	rec.lvl = lvl;
+	rec.file = file;
+	rec.lineno = lineno;
+	rec.fmt = fmt;
+	rec.site = NULL;
+
+	va_start(ap, fmt);
+	rc = rl.inner.emit(rl.inner.ctx, &rec, ap);
+	va_end(ap);
+
+	return rc;
+}
+
+static int_least64_t now_ns(void)
+{
+	struct timespec t;
+
+	if (clock_gettime(LIMIT_CLOCK, &t)) {
+		return -1;
+	}
+	return (int_least64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
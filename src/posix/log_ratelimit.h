@@ -0,0 +1,59 @@
+#ifndef LOG_RATELIMIT_H
+#define LOG_RATELIMIT_H
+
+/*
+ * A log sink wrapping the current one with per-call-site rate limits. Each
+ * site gets a token bucket of the configured rate and burst; records over it
+ * are suppressed, except for 1 in every `sample` of them. Suppressions are
+ * reported with a "N similar records suppressed" record from the site: when
+ * the site next passes, at most every LOG_RATELIMIT_SUMMARY_NS while it stays
+ * over its limit, and on log_flush().
+ *
+ * Sites are keyed by their log_site (or file and line, for plain log_emit) in
+ * a fixed lock-free table; a suppressed record costs a clock read, a hash
+ * probe and an atomic add. Sites beyond the table's capacity aren't limited,
+ * nor are lines written whole with log_write.
+ */
+
+#include "log.h"
+
+/* Number of sites tracked; a power of two. */
+#ifndef LOG_RATELIMIT_SITES
+#define LOG_RATELIMIT_SITES 4096
+#endif
+
+/* Most often suppressions are reported while a site stays over its limit. */
+#ifndef LOG_RATELIMIT_SUMMARY_NS
+#define LOG_RATELIMIT_SUMMARY_NS 10000000000LL
+#endif
+
+/* Records this severe are never limited. */
+#ifndef LOG_RATELIMIT_EXEMPT_LEVEL
+#define LOG_RATELIMIT_EXEMPT_LEVEL LOG_LEVEL_CRIT
+#endif
+
+struct log_ratelimit {
+	unsigned long rate; /* records per second per site, sustained */
+	unsigned long burst; /* records per site allowed at once */
+	unsigned long sample; /* pass 1 in this many over the limit, or 0 */
+};
+
+/*
+ * Wrap the current sink with the given limits, which must have a rate and
+ * burst of at least 1.
+ *
+ * Returns 0 on success, or -1 if memory couldn't be had or it is already
+ * running.
+ */
+int log_ratelimit_start(const struct log_ratelimit *limits);
+
+/*
+ * Report any suppressions, flush, and restore the wrapped sink. Nothing may
+ * be logging concurrently.
+ */
+int log_ratelimit_stop(void);
+
+/* Number of records suppressed since starting. */
+unsigned long log_ratelimit_suppressed(void);
+
+#endif /* LOG_RATELIMIT_H */
@@ -0,0 +1,318 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "log_fmt.h"
+#include "log_ring.h"
+
+#if LOG_RING_RECORD_MAX < LOG_FMT_CAP_MIN
+#error LOG_RING_RECORD_MAX too small
+#endif
+
+#define DUMP_BEGIN "--- flight recorder: begin ---\n"
+#define DUMP_END "--- flight recorder: end ---\n"
+
+#define SLOT_BUSY ((size_t)-1)
+
+/*
+ * A slot's seq is pos + 1 once the record logged at position pos is in it,
+ * 0 before any is, and SLOT_BUSY while a writer has it. A writer only takes
+ * a slot it sees not busy, so two never write the same slot at once, and a
+ * dump skips slots whose seq changes under it.
+ */
+struct slot {
+	atomic_size_t seq;
+	size_t len;
+	char buf[LOG_RING_RECORD_MAX];
+};
+
+static const int fatal_signals[] = { SIGABRT, SIGBUS, SIGFPE, SIGILL,
+				     SIGSEGV };
+#define N_FATAL_SIGNALS (sizeof(fatal_signals) / sizeof(fatal_signals[0]))
+
+static struct {
+	struct slot *slots;
+	size_t mask;
+	atomic_size_t head; /* next position to claim */
+
+	enum log_level prev_capture_lvl;
+	int fd; /* log_file()'s, when started */
+	atomic_flag dumping;
+
+	int running, catching;
+	struct sigaction prev_actions[N_FATAL_SIGNALS];
+	struct log_sink inner;
+} r = { .dumping = ATOMIC_FLAG_INIT };
+
+static int ring_emit(void *ctx, const struct log_record *rec, va_list ap);
+static int ring_flush(void *ctx);
+static int ring_write(void *ctx, enum log_level lvl, const char *line,
+		      size_t len);
+
+/* Return non-zero if the record passes the levels, and so would have been
+ * written out without the ring. */
+static int passes(const struct log_record *rec);
+
+/* Claim the next slot, or return NULL if a writer still has it. */
+static struct slot *claim(size_t *pos_out);
+
+/* Render the record into the next slot, unless a writer still has it. */
+static void record(const struct log_record *rec, va_list ap);
+
+/* log_ring_dump, without touching stdio. */
+static int dump(void);
+
+static void on_fatal_signal(int sig);
+
+int log_ring_start(size_t records, enum log_level record_lvl,
+		   int catch_signals)
+{
+	struct log_sink sink = { ring_emit, ring_flush, NULL, NULL };
+	size_t n, i;
+
+	if (r.running) {
+		return -1;
+	}
+
+	for (n = 2; n < records; n <<= 1) {
+		if (n > ((size_t)-1 >> 1) / sizeof(*r.slots)) {
+			return -1;
+		}
+	}
+
+	r.slots = malloc(n * sizeof(*r.slots));
+	if (r.slots == NULL) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		atomic_init(&r.slots[i].seq, 0);
+		r.slots[i].len = 0;
+	}
+	r.mask = n - 1;
+	atomic_init(&r.head, 0);
+	r.fd = fileno(log_file());
+
+	r.catching = 0;
+	if (catch_signals) {
+		struct sigaction sa;
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = on_fatal_signal;
+		sa.sa_flags = SA_RESETHAND;
+		sigemptyset(&sa.sa_mask);
+
+		for (i = 0; i < N_FATAL_SIGNALS; i++) {
+			if (sigaction(fatal_signals[i], &sa,
+				      &r.prev_actions[i])) {
+				while (i--) {
+					sigaction(fatal_signals[i],
+						  &r.prev_actions[i], NULL);
+				}
+				free(r.slots);
+				r.slots = NULL;
+				return -1;
+			}
+		}
+		r.catching = 1;
+	}
+
+	r.prev_capture_lvl = log_level_capture();
+	if (record_lvl > r.prev_capture_lvl) {
+		log_level_set_capture(record_lvl);
+	}
+
+	r.inner = *log_sink();
+	if (r.inner.write != NULL) {
+		sink.write = ring_write;
+	}
+	log_sink_set(&sink);
+	r.running = 1;
+
+	return 0;
+}
+
+void log_ring_stop(void)
+{
+	size_t i;
+
+	if (!r.running) {
+		return;
+	}
+
+	log_sink_set(&r.inner);
+	log_level_set_capture(r.prev_capture_lvl);
+
+	if (r.catching) {
+		for (i = 0; i < N_FATAL_SIGNALS; i++) {
+			sigaction(fatal_signals[i], &r.prev_actions[i], NULL);
+		}
+		r.catching = 0;
+	}
+
+	r.running = 0;
+	free(r.slots);
+	r.slots = NULL;
+}
+
+int log_ring_dump(void)
+{
+	if (!r.running) {
+		return 0;
+	}
+
+	/* so the dump lands after what was already logged */
+	if (fflush(log_file()) == EOF) {
+		return -1;
+	}
+	return dump();
+}
+
+static int ring_emit(void *ctx, const struct log_record *rec, va_list ap)
+{
+	va_list ap2;
+
+	(void)ctx;
+
+	if (!passes(rec)) {
+		record(rec, ap);
+		return 0;
+	}
+
+	va_copy(ap2, ap);
+	record(rec, ap2);
+	va_end(ap2);
+
+	return r.inner.emit(r.inner.ctx, rec, ap);
+}
+
+static int ring_write(void *ctx, enum log_level lvl, const char *line,
+		      size_t len)
+{
+	struct slot *s;
+	size_t pos, n;
+
+	(void)ctx;
+
+	s = claim(&pos);
+	if (s != NULL) {
+		n = len < sizeof(s->buf) - 1 ? len : sizeof(s->buf) - 1;
+		memcpy(s->buf, line, n);
+		s->buf[n] = '\n';
+		s->len = n + 1;
+		atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+	}
+
+	/* the caller has filtered it by log_level(), which the ring leaves */
+	return r.inner.write(r.inner.ctx, lvl, line, len);
+}
+
+static int ring_flush(void *ctx)
+{
+	(void)ctx;
+
+	return r.inner.flush != NULL ? r.inner.flush(r.inner.ctx) : 0;
+}
+
+static int passes(const struct log_record *rec)
+{
+	if (rec->site == NULL) {
+		return rec->lvl <= log_level();
+	}
+	return rec->lvl <= log_level_module(rec->site->module);
+}
+
+static void record(const struct log_record *rec, va_list ap)
+{
+	size_t pos;
+	struct slot *s;
+
+	s = claim(&pos);
+	if (s == NULL) {
+		return;
+	}
+
+	s->len = log_fmt_record(s->buf, sizeof(s->buf), rec, ap);
+
+	atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+}
+
+static struct slot *claim(size_t *pos_out)
+{
+	size_t pos, seq;
+	struct slot *s;
+
+	pos = atomic_fetch_add_explicit(&r.head, 1, memory_order_relaxed);
+	s = &r.slots[pos & r.mask];
+
+	seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+	if (seq == SLOT_BUSY ||
+	    !atomic_compare_exchange_strong_explicit(&s->seq, &seq, SLOT_BUSY,
+						     memory_order_acquire,
+						     memory_order_relaxed)) {
+		return NULL; /* a lapped writer still has it */
+	}
+	atomic_thread_fence(memory_order_release);
+
+	*pos_out = pos;
+	return s;
+}
+
+static int dump(void)
+{
+	char buf[LOG_RING_RECORD_MAX];
+	size_t head, pos, n;
+	int rc = 0;
+
+	if (atomic_flag_test_and_set(&r.dumping)) {
+		return -1; /* already dumping, e.g. crashed while doing so */
+	}
+
+	head = atomic_load_explicit(&r.head, memory_order_acquire);
+	n = r.mask + 1;
+
+	rc |= log_fmt_write_all(r.fd, DUMP_BEGIN, sizeof(DUMP_BEGIN) - 1);
+	for (pos = head > n ? head - n : 0; pos != head; pos++) {
+		struct slot *s = &r.slots[pos & r.mask];
+		size_t len;
+
+		if (atomic_load_explicit(&s->seq, memory_order_acquire) !=
+		    pos + 1) {
+			continue; /* overwritten, or never finished */
+		}
+		len = s->len;
+		if (len > sizeof(buf)) {
+			continue; /* torn */
+		}
+		memcpy(buf, s->buf, len);
+
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&s->seq, memory_order_relaxed) !=
+		    pos + 1) {
+			continue; /* overwritten while copying */
+		}
+		rc |= log_fmt_write_all(r.fd, buf, len);
+	}
+	rc |= log_fmt_write_all(r.fd, DUMP_END, sizeof(DUMP_END) - 1);
+
+	atomic_flag_clear(&r.dumping);
+
+	return rc ? -1 : 0;
+}
+
+static void on_fatal_signal(int sig)
+{
+	int saved_errno = errno;
+
+	dump();
+
+	/* The handler has been reset to the default, so this is fatal. */
+	errno = saved_errno;
+	raise(sig);
+}
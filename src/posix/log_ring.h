@@ -0,0 +1,55 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+/*
+ * A flight recorder: a log sink wrapping the current one that also keeps the
+ * most recent records in a fixed-size in-memory ring, without I/O, for
+ * dumping to log_file() when something goes wrong - on demand, or from a
+ * handler for abort() and other fatal signals.
+ *
+ * The ring captures records down to its own record level, which may be less
+ * severe than what is written out: while it runs, that is the capture level
+ * (see log_level_set_capture), and only records passing log_level() and the
+ * per-module levels reach the wrapped sink. Lines from log_write are kept and
+ * passed on as they come, their levels being left to the caller.
+ *
+ * Writers claim slots with an atomic increment and never block; a record that
+ * would overwrite one still being written is discarded instead.
+ */
+
+#include <stddef.h>
+
+#include "log.h"
+
+/* Largest record kept, including its newline; longer ones are truncated. */
+#ifndef LOG_RING_RECORD_MAX
+#define LOG_RING_RECORD_MAX 256
+#endif
+
+/*
+ * Wrap the current sink, keeping the last `records` (rounded up to a power of
+ * two) records at record_lvl or more severe. If catch_signals, dump the ring
+ * on SIGABRT, SIGBUS, SIGFPE, SIGILL and SIGSEGV before dying of them.
+ *
+ * Returns 0 on success, or -1 if memory or the signal handlers couldn't be
+ * had, or it is already running.
+ */
+int log_ring_start(size_t records, enum log_level record_lvl,
+		   int catch_signals);
+
+/*
+ * Restore the wrapped sink, capture level and signal handlers, and free the
+ * ring (without dumping it). Nothing may be logging concurrently.
+ */
+void log_ring_stop(void);
+
+/*
+ * Write the ring's records, oldest first, to log_file()'s file descriptor.
+ * Async-signal-safe, except that it first flushes log_file() when not called
+ * from the signal handlers.
+ *
+ * Returns 0 on success, or -1 on failure.
+ */
+int log_ring_dump(void);
+
+#endif /* LOG_RING_H */
@@ -0,0 +1,98 @@
+#include <string.h>
+#include <time.h>
+
+#include "log_ts.h"
+
+/* Offsets into "YYYY-MM-DDTHH:MM:SS.uuuuuuZ" */
+#define SEC_OFF 17
+#define USEC_OFF 20
+
+/* The last timestamp this thread rendered, and the second it was for. */
+static _Thread_local char cached[LOG_TS_LEN + 1];
+static _Thread_local time_t cached_sec = (time_t)-1;
+
+/* Write v as n zero-padded decimal digits to p. */
+static void put_digits(char *p, unsigned long v, int n);
+
+/* Render the date and time (to the second) of t into cached. */
+static int render_datetime(time_t t);
+
+/* Render tm into buf, leaving the microseconds for the caller. */
+static void render_tm(char *buf, const struct tm *tm);
+
+size_t log_ts_format(char *buf)
+{
+	struct timespec now;
+
+	if (clock_gettime(LOG_TS_CLOCK, &now)) {
+		return 0;
+	}
+
+	if (now.tv_sec != cached_sec) {
+		if (cached_sec != (time_t)-1 && now.tv_sec > cached_sec &&
+		    now.tv_sec / 60 == cached_sec / 60) {
+			/* same minute - only the seconds changed */
+			put_digits(&cached[SEC_OFF],
+				   (unsigned long)(now.tv_sec % 60), 2);
+		} else if (render_datetime(now.tv_sec)) {
+			return 0;
+		}
+		cached_sec = now.tv_sec;
+	}
+
+	put_digits(&cached[USEC_OFF], (unsigned long)(now.tv_nsec / 1000), 6);
+	memcpy(buf, cached, sizeof(cached));
+
+	return LOG_TS_LEN;
+}
+
+size_t log_ts_format_at(char *buf, const struct timespec *t)
+{
+	struct tm tm;
+
+	if (gmtime_r(&t->tv_sec, &tm) == NULL) {
+		return 0;
+	}
+	render_tm(buf, &tm);
+	put_digits(&buf[USEC_OFF], (unsigned long)(t->tv_nsec / 1000), 6);
+
+	return LOG_TS_LEN;
+}
+
+static void put_digits(char *p, unsigned long v, int n)
+{
+	while (n--) {
+		p[n] = (char)('0' + v % 10);
+		v /= 10;
+	}
+}
+
+static int render_datetime(time_t t)
+{
+	struct tm tm;
+
+	if (gmtime_r(&t, &tm) == NULL) {
+		return -1;
+	}
+	render_tm(cached, &tm);
+
+	return 0;
+}
+
+static void render_tm(char *buf, const struct tm *tm)
+{
+	put_digits(&buf[0], (unsigned long)tm->tm_year + 1900, 4);
+	buf[4] = '-';
+	put_digits(&buf[5], (unsigned long)tm->tm_mon + 1, 2);
+	buf[7] = '-';
+	put_digits(&buf[8], (unsigned long)tm->tm_mday, 2);
+	buf[10] = 'T';
+	put_digits(&buf[11], (unsigned long)tm->tm_hour, 2);
+	buf[13] = ':';
+	put_digits(&buf[14], (unsigned long)tm->tm_min, 2);
+	buf[16] = ':';
+	put_digits(&buf[SEC_OFF], (unsigned long)tm->tm_sec, 2);
+	buf[19] = '.';
+	buf[LOG_TS_LEN - 1] = 'Z';
+	buf[LOG_TS_LEN] = '\0';
+}
@@ -0,0 +1,39 @@
+#ifndef LOG_TS_H
+#define LOG_TS_H
+
+/*
+ * Cheap ISO-8601 timestamps for log records, in UTC with microseconds:
+ * "2026-10-19T13:14:35.123456Z".
+ *
+ * The clock is read with clock_gettime(LOG_TS_CLOCK), which defaults to the
+ * coarse real-time clock where there is one: a few nanoseconds to read, at the
+ * cost of only advancing every tick (typically 1-4ms). Define LOG_TS_CLOCK as
+ * CLOCK_REALTIME for true microsecond resolution.
+ *
+ * Each thread caches the rendered date and time, re-rendering only the parts
+ * that changed since its last timestamp.
+ */
+
+#include <stddef.h>
+#include <time.h> /* for clock ids */
+
+#ifndef LOG_TS_CLOCK
+#ifdef CLOCK_REALTIME_COARSE
+#define LOG_TS_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define LOG_TS_CLOCK CLOCK_REALTIME
+#endif
+#endif
+
+/* Length of a timestamp, excluding its terminator. */
+#define LOG_TS_LEN 27
+
+/* Write the current time to buf, which must hold LOG_TS_LEN + 1 bytes.
+ * Returns LOG_TS_LEN, or 0 if the clock couldn't be read. */
+size_t log_ts_format(char *buf);
+
+/* Write the given time to buf, as log_ts_format, without caching. Returns
+ * LOG_TS_LEN, or 0 if it couldn't be rendered. */
+size_t log_ts_format_at(char *buf, const struct timespec *t);
+
+#endif /* LOG_TS_H */
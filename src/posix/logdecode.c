@@ -0,0 +1,407 @@
+/* Decoder for log_binary streams.
+ *
+ * Renders each record as log_fmt_record would have at the time it was logged:
+ * "[time] LEVEL file:lineno message". Records the sink wrote as text are
+ * copied through. Concatenated streams (e.g. from restarting the sink on the
+ * same file) decode as one.
+ *
+ * Must be run on a machine like the one that wrote the stream: same byte
+ * order and type sizes.
+ *
+ * Usage: ./logdecode [file] > log.txt
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "log_binary.h"
+#include "log_ts.h"
+
+/* Room for a conversion spec, with its '*'s substituted; longer ones end the
+ * record at "<truncated>". */
+#define SPEC_BUF_CAP 64
+
+#define STR_NULL 0xFFFFFFFFUL
+
+struct site {
+	int known;
+	enum log_level lvl;
+	unsigned long lineno;
+	char *file, *fmt;
+};
+
+/* A record's arguments, being read. */
+struct args {
+	const unsigned char *p, *end;
+};
+
+static const char *prog = "logdecode";
+static FILE *in;
+
+static struct site *sites;
+static size_t nsites;
+
+/* Print an error and exit. */
+static void die(const char *what);
+
+/* Read exactly n bytes, dying if the input ends first. */
+static void read_bytes(void *p, size_t n);
+static unsigned long read_u32(void);
+
+/* Read a u32 length and that many bytes, returned NUL-terminated. */
+static char *read_str(void);
+
+static void read_header(void);
+static void read_site(void);
+static void read_record(void);
+static void read_text(void);
+
+/* Print fmt, taking its arguments from a. */
+static void render(const char *fmt, struct args *a);
+
+/* Print one conversion, taking its arguments from a. Returns -1 if a ran
+ * out. */
+static int render_spec(const struct log_binary_spec *spec, struct args *a);
+
+/* Take n bytes from a into p, returning -1 if there aren't enough. */
+static int take(struct args *a, void *p, size_t n);
+
+int main(int argc, char **argv)
+{
+	int tag;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [file]\n", prog);
+		return 2;
+	}
+
+	in = stdin;
+	if (argc == 2 && (in = fopen(argv[1], "rb")) == NULL) {
+		die(argv[1]);
+	}
+
+	tag = getc(in);
+	if (tag != LOG_BINARY_MAGIC[0]) {
+		fprintf(stderr, "%s: not a binary log\n", prog);
+		return 1;
+	}
+
+	do {
+		switch (tag) {
+		case 'L': /* LOG_BINARY_MAGIC[0]: a (further) stream header */
+			read_header();
+			break;
+		case 'S':
+			read_site();
+			break;
+		case 'R':
+			read_record();
+			break;
+		case 'T':
+			read_text();
+			break;
+		default:
+			fprintf(stderr, "%s: corrupt input\n", prog);
+			return 1;
+		}
+	} while ((tag = getc(in)) != EOF);
+
+	if (ferror(in)) {
+		die("read");
+	}
+	if (fflush(stdout)) {
+		die("write");
+	}
+	return 0;
+}
+
+static void die(const char *what)
+{
+	if (what != NULL) {
+		perror(what);
+	} else {
+		fprintf(stderr, "%s: truncated input\n", prog);
+	}
+	exit(1);
+}
+
+static void read_bytes(void *p, size_t n)
+{
+	if (fread(p, 1, n, in) != n) {
+		die(ferror(in) ? "read" : NULL);
+	}
+}
+
+static unsigned long read_u32(void)
+{
+	uint32_t v;
+
+	read_bytes(&v, sizeof(v));
+	return v;
+}
+
+static char *read_str(void)
+{
+	unsigned long len = read_u32();
+	char *s;
+
+	s = malloc(len + 1);
+	if (s == NULL) {
+		die("malloc");
+	}
+	read_bytes(s, len);
+	s[len] = '\0';
+	return s;
+}
+
+static void read_header(void)
+{
+	char magic[LOG_BINARY_MAGIC_LEN - 1];
+	unsigned long bom;
+	unsigned char ld_size;
+
+	/* the first byte was read as the tag */
+	read_bytes(magic, sizeof(magic));
+	if (memcmp(magic, LOG_BINARY_MAGIC + 1, sizeof(magic))) {
+		fprintf(stderr, "%s: not a binary log\n", prog);
+		exit(1);
+	}
+
+	bom = read_u32();
+	read_bytes(&ld_size, 1);
+	if (bom != LOG_BINARY_BOM || ld_size != sizeof(long double)) {
+		fprintf(stderr, "%s: log written on an unlike machine\n", prog);
+		exit(1);
+	}
+}
+
+static void read_site(void)
+{
+	unsigned long id = read_u32();
+	unsigned char lvl;
+	struct site *s;
+
+	if (id == 0) {
+		fprintf(stderr, "%s: corrupt input\n", prog);
+		exit(1);
+	}
+	if (id > nsites) {
+		s = realloc(sites, id * sizeof(*sites));
+		if (s == NULL) {
+			die("realloc");
+		}
+		memset(s + nsites, 0, (id - nsites) * sizeof(*s));
+		sites = s;
+		nsites = id;
+	}
+
+	s = &sites[id - 1];
+	if (s->known) {
+		/* registered again by a restarted sink */
+		free(s->file);
+		free(s->fmt);
+	}
+
+	read_bytes(&lvl, 1);
+	s->lvl = (enum log_level)lvl;
+	s->lineno = read_u32();
+	s->file = read_str();
+	s->fmt = read_str();
+	s->known = 1;
+}
+
+static void read_record(void)
+{
+	static unsigned char *buf;
+	static size_t buf_cap;
+	char ts[LOG_TS_LEN + 1];
+	struct timespec t;
+	const struct site *s;
+	struct args a;
+	unsigned long id, len;
+	int64_t sec;
+
+	id = read_u32();
+	read_bytes(&sec, sizeof(sec));
+	t.tv_sec = (time_t)sec;
+	t.tv_nsec = (long)read_u32();
+
+	len = read_u32();
+	if (len > buf_cap) {
+		free(buf);
+		buf = malloc(len);
+		if (buf == NULL) {
+			die("malloc");
+		}
+		buf_cap = len;
+	}
+	read_bytes(buf, len);
+
+	if (id == 0 || id > nsites || !sites[id - 1].known) {
+		fprintf(stderr, "%s: record for unknown site %lu\n", prog, id);
+		return;
+	}
+	s = &sites[id - 1];
+
+	if (!log_ts_format_at(ts, &t)) {
+		strcpy(ts, "?");
+	}
+	printf("[%s] %s %s:%lu ", ts, log_level_name(s->lvl), s->file,
+	       s->lineno);
+
+	a.p = buf;
+	a.end = buf + len;
+	render(s->fmt, &a);
+	putchar('\n');
+}
+
+static void read_text(void)
+{
+	char *text = read_str();
+
+	fputs(text, stdout);
+	free(text);
+}
+
+static void render(const char *fmt, struct args *a)
+{
+	struct log_binary_spec spec;
+	const char *lit = fmt;
+
+	while (log_binary_next_spec(&fmt, &spec)) {
+		fwrite(lit, 1, (size_t)(spec.start - lit), stdout);
+		lit = fmt;
+
+		if (render_spec(&spec, a)) {
+			fputs("<truncated>", stdout);
+			return;
+		}
+	}
+	fputs(lit, stdout);
+}
+
+static int render_spec(const struct log_binary_spec *spec, struct args *a)
+{
+	static char str[LOG_BINARY_STR_MAX + 1];
+	char buf[SPEC_BUF_CAP];
+	long double ld;
+	double d;
+	uint64_t v;
+	uint32_t len;
+	size_t i, n;
+
+	if (spec->arg == LOG_BINARY_ARG_NONE) {
+		putchar('%');
+		return 0;
+	}
+	if (spec->arg == LOG_BINARY_ARG_UNSUPPORTED) {
+		/* never encoded raw; shouldn't appear */
+		fwrite(spec->start, 1, spec->len, stdout);
+		return 0;
+	}
+
+	/* Copy the spec, with '*'s replaced by the given width/precision. */
+	for (i = n = 0; i < spec->len; i++) {
+		if (n + 24 >= sizeof(buf)) {
+			return -1;
+		}
+		if (spec->start[i] != '*') {
+			buf[n++] = spec->start[i];
+			continue;
+		}
+		if (take(a, &v, sizeof(v))) {
+			return -1;
+		}
+		n += (size_t)sprintf(buf + n, "%d", (int)(int64_t)v);
+	}
+	buf[n] = '\0';
+
+	switch (spec->arg) {
+	case LOG_BINARY_ARG_LDOUBLE:
+		if (take(a, &ld, sizeof(ld))) {
+			return -1;
+		}
+		printf(buf, ld);
+		return 0;
+	case LOG_BINARY_ARG_DOUBLE:
+		if (take(a, &d, sizeof(d))) {
+			return -1;
+		}
+		printf(buf, d);
+		return 0;
+	case LOG_BINARY_ARG_STR:
+		if (take(a, &len, sizeof(len))) {
+			return -1;
+		}
+		if (len == STR_NULL) {
+			printf(buf, "(null)");
+			return 0;
+		}
+		if (len > LOG_BINARY_STR_MAX || take(a, str, len)) {
+			return -1;
+		}
+		str[len] = '\0';
+		printf(buf, str);
+		return 0;
+	default:
+		break;
+	}
+
+	if (take(a, &v, sizeof(v))) {
+		return -1;
+	}
+
+	switch (spec->arg) {
+	case LOG_BINARY_ARG_INT:
+		printf(buf, (int)(int64_t)v);
+		break;
+	case LOG_BINARY_ARG_UINT:
+		printf(buf, (unsigned)v);
+		break;
+	case LOG_BINARY_ARG_LONG:
+		printf(buf, (long)(int64_t)v);
+		break;
+	case LOG_BINARY_ARG_ULONG:
+		printf(buf, (unsigned long)v);
+		break;
+	case LOG_BINARY_ARG_LLONG:
+		printf(buf, (long long)(int64_t)v);
+		break;
+	case LOG_BINARY_ARG_ULLONG:
+		printf(buf, (unsigned long long)v);
+		break;
+	case LOG_BINARY_ARG_INTMAX:
+		printf(buf, (intmax_t)(int64_t)v);
+		break;
+	case LOG_BINARY_ARG_UINTMAX:
+		printf(buf, (uintmax_t)v);
+		break;
+	case LOG_BINARY_ARG_SIZE:
+		printf(buf, (size_t)v);
+		break;
+	case LOG_BINARY_ARG_PTRDIFF:
+		printf(buf, (ptrdiff_t)(int64_t)v);
+		break;
+	case LOG_BINARY_ARG_PTR:
+		printf(buf, (void *)(uintptr_t)v);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static int take(struct args *a, void *p, size_t n)
+{
+	if ((size_t)(a->end - a->p) < n) {
+		return -1;
+	}
+	memcpy(p, a->p, n);
+	a->p += n;
+	return 0;
+}
@@ -0,0 +1,653 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "shm_htable.h"
+
+/* "shmhtab1", stored last on creation to mark the table ready. */
+#define MAGIC UINT64_C(0x736d686874616231)
+
+#define ALIGN(n, a) (((n) + (a) - 1) & ~(size_t)((a) - 1))
+
+/* Times a reader yields to a writer mid-change before checking that it is
+ * still alive. */
+#define READ_SPINS 1000
+
+/*
+ * The start of the object. Buckets follow, at buckets_off, then the arena,
+ * at arena_off; offsets rather than pointers, like everything in it.
+ */
+struct header {
+	atomic_uint_least64_t magic;
+	uint64_t cap, mask, size;
+	uint64_t buckets_off, arena_off, arena_size;
+
+	/* Bytes of the arena taken; only writers, holding the lock, change
+	 * it. */
+	atomic_uint_least64_t arena_used;
+
+	atomic_uint_least64_t len;
+
+	/* Odd while a writer changes the buckets. */
+	atomic_uint seq;
+
+	pthread_mutex_t lock;
+};
+
+/* Open addressing with linear probing; empty buckets have a hash of 0. */
+struct bucket {
+	atomic_uint_least64_t hash;
+	atomic_uint_least64_t entry; /* arena offset */
+};
+
+/* An entry in the arena, never changed once its bucket points at it. */
+struct entry {
+	uint64_t klen, vlen;
+	unsigned char data[]; /* the key, then the value */
+};
+
+struct shm_htable_t {
+	struct header *hdr;
+	struct bucket *buckets;
+	unsigned char *arena;
+	size_t size;
+};
+
+/* Map size bytes of fd shared, and make a handle of it whose buckets and arena
+ * are found by locate(). Returns NULL on failure. */
+static shm_htable_t *map(int fd, size_t size);
+static void locate(shm_htable_t *sh);
+
+/* Check the header of a mapped table against its size. Returns 0 if it holds
+ * up, -1 otherwise. */
+static int check(shm_htable_t *sh);
+
+/* Hash of key, never 0. */
+static uint64_t key_hash(const void *key, size_t klen);
+
+/* The entry at arena offset off, or NULL if it runs out of the arena (as it
+ * can, for readers, in the middle of a change). */
+static const struct entry *entry_at(shm_htable_t *sh, uint64_t off);
+
+/*
+ * Look for key along its probe sequence, setting *i to its bucket and *e to
+ * its entry if found, and *i to the empty bucket ending the sequence if not.
+ * Returns 1 if found, 0 if not, or -1 if the buckets didn't make sense, which
+ * readers racing a writer may see (and then retry).
+ */
+static int probe(shm_htable_t *sh, uint64_t hash, const void *key,
+		 size_t klen, size_t *i, const struct entry **e);
+
+/* Copy key and val to a new entry in the arena, returning its offset, or
+ * (uint64_t)-1 with errno ENOSPC if there isn't room. */
+static uint64_t append(shm_htable_t *sh, const void *key, size_t klen,
+		       const void *val, size_t vlen);
+
+/* Take the writers' lock, recovering it from a writer that died. Returns 0,
+ * or -1 with errno set if it can't be had. */
+static int lock(shm_htable_t *sh);
+static void unlock(shm_htable_t *sh);
+
+/* For a reader that has long seen a change in progress: if the writer making
+ * it died, recover the lock, letting readers through. Returns 0, or -1 with
+ * errno set if the lock can't be had. */
+static int reader_recover(shm_htable_t *sh);
+
+/* Make the lock, just taken from a writer that died, consistent again. */
+static int recover(shm_htable_t *sh);
+
+/* Bracket a change to the buckets, holding the lock. */
+static void write_begin(shm_htable_t *sh);
+static void write_end(shm_htable_t *sh);
+
+shm_htable_t *shm_htable_create(const char *name, size_t cap,
+				size_t arena_size, int mode)
+{
+	shm_htable_t *sh;
+	struct header *hdr;
+	pthread_mutexattr_t attr;
+	size_t n, buckets_off, arena_off, size;
+	int fd, r;
+
+	assert(name != NULL);
+	assert(cap > 0);
+
+	/* Enough buckets to keep the load at most 7/8. */
+	if (cap > (size_t)-1 / sizeof(struct bucket) / 4 ||
+	    arena_size > (size_t)-1 / 2) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	for (n = 2; n < cap + cap / 7 + 1; n <<= 1)
+		;
+	buckets_off = ALIGN(sizeof(struct header), 64);
+	arena_off = buckets_off + n * sizeof(struct bucket);
+	arena_size = ALIGN(arena_size, 8);
+	if (arena_size > (size_t)-1 - arena_off) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size = arena_off + arena_size;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, (mode_t)mode);
+	if (fd < 0) {
+		return NULL;
+	}
+	/* Zero-filled, so every bucket starts empty. */
+	if (ftruncate(fd, (off_t)size) || (sh = map(fd, size)) == NULL) {
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	hdr = sh->hdr;
+	hdr->cap = cap;
+	hdr->mask = n - 1;
+	hdr->size = size;
+	hdr->buckets_off = buckets_off;
+	hdr->arena_off = arena_off;
+	hdr->arena_size = arena_size;
+	atomic_init(&hdr->arena_used, 0);
+	atomic_init(&hdr->len, 0);
+	atomic_init(&hdr->seq, 0);
+
+	r = pthread_mutexattr_init(&attr);
+	if (!r) {
+		r = pthread_mutexattr_setpshared(&attr,
+						 PTHREAD_PROCESS_SHARED);
+		if (!r) {
+			r = pthread_mutexattr_setrobust(&attr,
+							PTHREAD_MUTEX_ROBUST);
+		}
+		if (!r) {
+			r = pthread_mutex_init(&hdr->lock, &attr);
+		}
+		pthread_mutexattr_destroy(&attr);
+	}
+	if (r) {
+		shm_htable_close(sh);
+		errno = r;
+		goto fail;
+	}
+
+	locate(sh);
+	atomic_store_explicit(&hdr->magic, MAGIC, memory_order_release);
+	return sh;
+
+fail:
+	r = errno;
+	if (fd >= 0) {
+		close(fd);
+	}
+	shm_unlink(name);
+	errno = r;
+	return NULL;
+}
+
+shm_htable_t *shm_htable_open(const char *name)
+{
+	shm_htable_t *sh;
+	struct stat st;
+	int fd, saved;
+
+	assert(name != NULL);
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st)) {
+		goto fail;
+	}
+	if (st.st_size < (off_t)sizeof(struct header) ||
+	    (unsigned long long)st.st_size > (size_t)-1) {
+		errno = EINVAL;
+		goto fail;
+	}
+	sh = map(fd, (size_t)st.st_size);
+	if (sh == NULL) {
+		goto fail;
+	}
+	close(fd);
+
+	if (check(sh)) {
+		shm_htable_close(sh);
+		errno = EINVAL;
+		return NULL;
+	}
+	locate(sh);
+	return sh;
+
+fail:
+	saved = errno;
+	close(fd);
+	errno = saved;
+	return NULL;
+}
+
+void shm_htable_close(shm_htable_t *sh)
+{
+	assert(sh != NULL);
+
+	munmap(sh->hdr, sh->size);
+	free(sh);
+}
+
+int shm_htable_unlink(const char *name)
+{
+	assert(name != NULL);
+
+	return shm_unlink(name) ? -1 : 0;
+}
+
+size_t shm_htable_cap(shm_htable_t *sh)
+{
+	assert(sh != NULL);
+
+	return (size_t)sh->hdr->cap;
+}
+
+size_t shm_htable_len(shm_htable_t *sh)
+{
+	assert(sh != NULL);
+
+	return (size_t)atomic_load_explicit(&sh->hdr->len,
+					    memory_order_relaxed);
+}
+
+size_t shm_htable_arena_used(shm_htable_t *sh)
+{
+	assert(sh != NULL);
+
+	return (size_t)atomic_load_explicit(&sh->hdr->arena_used,
+					    memory_order_relaxed);
+}
+
+size_t shm_htable_arena_size(shm_htable_t *sh)
+{
+	assert(sh != NULL);
+
+	return (size_t)sh->hdr->arena_size;
+}
+
+int shm_htable_get(shm_htable_t *sh, const void *key, size_t klen,
+		   const void **val, size_t *vlen)
+{
+	const struct entry *e = NULL;
+	uint64_t hash;
+	unsigned seq, spins = 0;
+	size_t i;
+	int r;
+
+	assert(sh != NULL);
+	assert(key != NULL || !klen);
+	assert(val != NULL);
+	assert(vlen != NULL);
+
+	hash = key_hash(key, klen);
+	for (;;) {
+		seq = atomic_load_explicit(&sh->hdr->seq, memory_order_acquire);
+		if (seq & 1) {
+			if (++spins == READ_SPINS) {
+				spins = 0;
+				if (reader_recover(sh)) {
+					return -1;
+				}
+			}
+			sched_yield();
+			continue;
+		}
+		r = probe(sh, hash, key, klen, &i, &e);
+		atomic_thread_fence(memory_order_acquire);
+		if (r >= 0 && atomic_load_explicit(&sh->hdr->seq,
+						   memory_order_relaxed) == seq) {
+			break;
+		}
+	}
+
+	if (r) {
+		*val = e->data + e->klen;
+		*vlen = (size_t)e->vlen;
+	}
+	return r;
+}
+
+int shm_htable_set(shm_htable_t *sh, const void *key, size_t klen,
+		   const void *val, size_t vlen)
+{
+	const struct entry *e;
+	uint64_t hash, off;
+	size_t i, len;
+	int r;
+
+	assert(sh != NULL);
+	assert(key != NULL || !klen);
+	assert(val != NULL || !vlen);
+
+	hash = key_hash(key, klen);
+	if (lock(sh)) {
+		return -1;
+	}
+
+	r = probe(sh, hash, key, klen, &i, &e);
+	assert(r >= 0);
+	len = (size_t)atomic_load_explicit(&sh->hdr->len,
+					   memory_order_relaxed);
+	if (!r && len == sh->hdr->cap) {
+		errno = ENOSPC;
+		r = -1;
+		goto out;
+	}
+
+	/* Written before the bucket points at it, and made visible to readers
+	 * by write_end(). */
+	off = append(sh, key, klen, val, vlen);
+	if (off == (uint64_t)-1) {
+		r = -1;
+		goto out;
+	}
+
+	write_begin(sh);
+	atomic_store_explicit(&sh->buckets[i].entry, off,
+			      memory_order_relaxed);
+	if (!r) {
+		atomic_store_explicit(&sh->buckets[i].hash, hash,
+				      memory_order_relaxed);
+		atomic_store_explicit(&sh->hdr->len, len + 1,
+				      memory_order_relaxed);
+	}
+	write_end(sh);
+
+out:
+	unlock(sh);
+	return r;
+}
+
+int shm_htable_remove(shm_htable_t *sh, const void *key, size_t klen)
+{
+	const struct entry *e;
+	struct bucket *b;
+	uint64_t hash, h;
+	size_t i, j, home, mask;
+	int r;
+
+	assert(sh != NULL);
+	assert(key != NULL || !klen);
+
+	hash = key_hash(key, klen);
+	if (lock(sh)) {
+		return -1;
+	}
+
+	r = probe(sh, hash, key, klen, &i, &e);
+	assert(r >= 0);
+	if (!r) {
+		unlock(sh);
+		return 0;
+	}
+
+	/*
+	 * Shift back the entries after it that would be cut off from their
+	 * home buckets, rather than leave a tombstone: probe sequences stay as
+	 * short as the load allows however many keys come and go.
+	 */
+	b = sh->buckets;
+	mask = (size_t)sh->hdr->mask;
+	write_begin(sh);
+	for (j = i;;) {
+		j = (j + 1) & mask;
+		h = atomic_load_explicit(&b[j].hash, memory_order_relaxed);
+		if (!h) {
+			break;
+		}
+		home = (size_t)h & mask;
+		if (((j - home) & mask) < ((j - i) & mask)) {
+			continue;
+		}
+		atomic_store_explicit(&b[i].hash, h, memory_order_relaxed);
+		atomic_store_explicit(
+			&b[i].entry,
+			atomic_load_explicit(&b[j].entry, memory_order_relaxed),
+			memory_order_relaxed);
+		i = j;
+	}
+	atomic_store_explicit(&b[i].hash, 0, memory_order_relaxed);
+	atomic_store_explicit(
+		&sh->hdr->len,
+		atomic_load_explicit(&sh->hdr->len, memory_order_relaxed) - 1,
+		memory_order_relaxed);
+	write_end(sh);
+
+	unlock(sh);
+	return 1;
+}
+
+static shm_htable_t *map(int fd, size_t size)
+{
+	shm_htable_t *sh;
+	void *p;
+
+	sh = malloc(sizeof(*sh));
+	if (sh == NULL) {
+		return NULL;
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		free(sh);
+		return NULL;
+	}
+	sh->hdr = p;
+	sh->buckets = NULL;
+	sh->arena = NULL;
+	sh->size = size;
+	return sh;
+}
+
+static void locate(shm_htable_t *sh)
+{
+	unsigned char *base = (unsigned char *)sh->hdr;
+
+	sh->buckets = (struct bucket *)(base + sh->hdr->buckets_off);
+	sh->arena = base + sh->hdr->arena_off;
+}
+
+static int check(shm_htable_t *sh)
+{
+	struct header *hdr = sh->hdr;
+	uint64_t n;
+
+	if (atomic_load_explicit(&hdr->magic, memory_order_acquire) !=
+	    MAGIC) {
+		return -1;
+	}
+	n = hdr->mask + 1;
+	if (!n || n & hdr->mask || !hdr->cap || hdr->cap >= n ||
+	    hdr->size != sh->size ||
+	    hdr->buckets_off != ALIGN(sizeof(struct header), 64) ||
+	    sh->size < hdr->buckets_off ||
+	    n > (sh->size - hdr->buckets_off) / sizeof(struct bucket) ||
+	    hdr->arena_off != hdr->buckets_off + n * sizeof(struct bucket) ||
+	    hdr->arena_size != sh->size - hdr->arena_off) {
+		return -1;
+	}
+	return 0;
+}
+
+static uint64_t key_hash(const void *key, size_t klen)
+{
+	uint64_t h = hash_bytes_fnv_1a(key, klen);
+
+	return h ? h : 1;
+}
+
+static const struct entry *entry_at(shm_htable_t *sh, uint64_t off)
+{
+	const struct entry *e;
+	uint64_t left;
+
+	if (off % 8 || off > sh->hdr->arena_size - sizeof(struct entry)) {
+		return NULL;
+	}
+	e = (const struct entry *)(sh->arena + off);
+	left = sh->hdr->arena_size - off - sizeof(struct entry);
+	if (e->klen > left || e->vlen > left - e->klen) {
+		return NULL;
+	}
+	return e;
+}
+
+static int probe(shm_htable_t *sh, uint64_t hash, const void *key,
+		 size_t klen, size_t *i, const struct entry **e)
+{
+	struct bucket *b = sh->buckets;
+	size_t mask = (size_t)sh->hdr->mask;
+	size_t j, n;
+	uint64_t h;
+
+	for (j = (size_t)hash & mask, n = 0; n <= mask;
+	     j = (j + 1) & mask, n++) {
+		h = atomic_load_explicit(&b[j].hash, memory_order_relaxed);
+		if (!h) {
+			*i = j;
+			return 0;
+		}
+		if (h != hash) {
+			continue;
+		}
+		*e = entry_at(sh, atomic_load_explicit(&b[j].entry,
+						       memory_order_relaxed));
+		if (*e == NULL) {
+			return -1;
+		}
+		if ((*e)->klen == klen && !memcmp((*e)->data, key, klen)) {
+			*i = j;
+			return 1;
+		}
+	}
+	return -1;
+}
+
+static uint64_t append(shm_htable_t *sh, const void *key, size_t klen,
+		       const void *val, size_t vlen)
+{
+	struct header *hdr = sh->hdr;
+	struct entry *e;
+	uint64_t off, left;
+
+	off = atomic_load_explicit(&hdr->arena_used, memory_order_relaxed);
+	left = hdr->arena_size - off;
+	if (left < sizeof(struct entry) ||
+	    klen > left - sizeof(struct entry) ||
+	    vlen > left - sizeof(struct entry) - klen) {
+		errno = ENOSPC;
+		return (uint64_t)-1;
+	}
+
+	e = (struct entry *)(sh->arena + off);
+	e->klen = klen;
+	e->vlen = vlen;
+	if (klen) {
+		memcpy(e->data, key, klen);
+	}
+	if (vlen) {
+		memcpy(e->data + klen, val, vlen);
+	}
+	/* The arena's size is a multiple of 8, so this still fits. */
+	atomic_store_explicit(&hdr->arena_used,
+			      off + ALIGN(sizeof(*e) + klen + vlen, 8),
+			      memory_order_relaxed);
+	return off;
+}
+
+static int lock(shm_htable_t *sh)
+{
+	int r;
+
+	r = pthread_mutex_lock(&sh->hdr->lock);
+	if (r == EOWNERDEAD) {
+		return recover(sh);
+	}
+	if (r) {
+		errno = r;
+		return -1;
+	}
+	return 0;
+}
+
+static int reader_recover(shm_htable_t *sh)
+{
+	int r;
+
+	/* Busy if the writer is alive; it lets readers through itself. */
+	r = pthread_mutex_trylock(&sh->hdr->lock);
+	if (r == EBUSY) {
+		return 0;
+	}
+	if (r == EOWNERDEAD) {
+		if (recover(sh)) {
+			return -1;
+		}
+	} else if (r) {
+		errno = r;
+		return -1;
+	}
+	unlock(sh);
+	return 0;
+}
+
+static int recover(shm_htable_t *sh)
+{
+	struct header *hdr = sh->hdr;
+	unsigned seq;
+	int r;
+
+	/* The table is taken as the dead writer left it, and readers let
+	 * through if it was mid-change. */
+	seq = atomic_load_explicit(&hdr->seq, memory_order_relaxed);
+	if (seq & 1) {
+		atomic_store_explicit(&hdr->seq, seq + 1,
+				      memory_order_release);
+	}
+
+	r = pthread_mutex_consistent(&hdr->lock);
+	if (r) {
+		pthread_mutex_unlock(&hdr->lock);
+		errno = r;
+		return -1;
+	}
+	return 0;
+}
+
+static void unlock(shm_htable_t *sh)
+{
+	pthread_mutex_unlock(&sh->hdr->lock);
+}
+
+static void write_begin(shm_htable_t *sh)
+{
+	unsigned seq;
+
+	seq = atomic_load_explicit(&sh->hdr->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&sh->hdr->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void write_end(shm_htable_t *sh)
+{
+	unsigned seq;
+
+	seq = atomic_load_explicit(&sh->hdr->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&sh->hdr->seq, seq + 1, memory_order_release);
+}
@@ -0,0 +1,72 @@
+#ifndef SHM_HTABLE_H
+#define SHM_HTABLE_H
+
+/*
+ * A hash table of byte-string keys and values living entirely in a POSIX
+ * shared memory object, so that processes mapping it share one copy and see
+ * each other's updates. Buckets hold offsets into an arena in the same
+ * object rather than pointers, so the object maps anywhere.
+ *
+ * Writers take a process-shared, robust mutex, and bracket changes to the
+ * buckets with a seqlock; readers take no lock, retrying lookups that overlap
+ * a change. A writer dying mid-change leaves the lock to the next writer, or
+ * to a reader that has waited on the change for long, and the table as it
+ * stood - possibly missing, or doubling, the one entry changed.
+ *
+ * The table is sized when created and doesn't grow. Entries are appended to
+ * the arena and never moved or freed, which is what lets readers use them
+ * without a lock: values replaced and entries removed keep their space.
+ * All processes must be of the same ABI.
+ */
+
+#include <stddef.h>
+
+typedef struct shm_htable_t shm_htable_t;
+
+/*
+ * Create the shared memory object name (as for shm_open) with the given
+ * permissions, holding a table of at least cap entries and arena_size bytes
+ * of keys and values, and map it. Fails if it already exists.
+ *
+ * Returns NULL with errno set on failure.
+ */
+shm_htable_t *shm_htable_create(const char *name, size_t cap,
+				size_t arena_size, int mode);
+
+/* Map the table created as name by some process. Returns NULL with errno set
+ * on failure, with EINVAL if the object isn't such a table (yet). */
+shm_htable_t *shm_htable_open(const char *name);
+
+/* Unmap the table. Views of its values are invalid after this. */
+void shm_htable_close(shm_htable_t *sh);
+
+/* Remove the shared memory object name; mappings of it remain. */
+int shm_htable_unlink(const char *name);
+
+size_t shm_htable_cap(shm_htable_t *sh);
+size_t shm_htable_len(shm_htable_t *sh);
+
+/* Bytes of the arena taken, and in all. */
+size_t shm_htable_arena_used(shm_htable_t *sh);
+size_t shm_htable_arena_size(shm_htable_t *sh);
+
+/*
+ * Look up key, and if it is there, point *val at its value in the mapping
+ * (valid until closed; never changed, though it may be replaced) and set
+ * *vlen to its length. Returns 1 if found, 0 otherwise, or -1 with errno set
+ * if a writer died mid-change and the lock can't be recovered.
+ */
+int shm_htable_get(shm_htable_t *sh, const void *key, size_t klen,
+		   const void **val, size_t *vlen);
+
+/* Set key to a copy of val. Returns 1 if it replaced a value, 0 if it is a new
+ * key, or -1 with errno ENOSPC if the table or its arena is full, or as set by
+ * pthread_mutex_lock if the writers' lock can't be had. */
+int shm_htable_set(shm_htable_t *sh, const void *key, size_t klen,
+		   const void *val, size_t vlen);
+
+/* Remove key. Returns 1 if it was there, 0 otherwise, or -1 with errno set if
+ * the writers' lock can't be had. */
+int shm_htable_remove(shm_htable_t *sh, const void *key, size_t klen);
+
+#endif /* SHM_HTABLE_H */
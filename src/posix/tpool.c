@@ -0,0 +1,603 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tpool.h"
+
+/* Rounds an idle thread looks for work, yielding between them, before it
+ * sleeps. */
+#ifndef TPOOL_SPINS
+#define TPOOL_SPINS 64
+#endif
+
+/* Slots of a deque to start with; it doubles as needed. */
+#define DEQUE_MIN 64
+
+/* Pieces per worker that parallel loops aim for, absent a grain. */
+#define PIECES_PER_THREAD 8
+
+/* Tasks still to run, in a tpool_wait or a parallel loop. */
+struct group {
+	atomic_size_t pending;
+};
+
+/* Either a submitted fn(arg), or a piece of a parallel loop when range_fn is
+ * set. */
+struct task {
+	struct task *next; /* in the injection queue */
+	struct group *group;
+
+	tpool_task_fn fn;
+	void *arg;
+
+	tpool_range_fn range_fn;
+	size_t begin, end, grain;
+};
+
+/*
+ * A Chase-Lev deque, with the memory orders of Le et al., "Correct and
+ * Efficient Work-Stealing for Weak Memory Models" (2013). The owner pushes
+ * and takes at bottom; thieves steal at top. Arrays outgrown are kept, as
+ * thieves may still be reading them, until the pool is destroyed.
+ */
+struct deque_array {
+	size_t mask;
+	struct deque_array *prev;
+	_Atomic(struct task *) buf[];
+};
+
+struct deque {
+	atomic_int_least64_t top, bottom;
+	_Atomic(struct deque_array *) array;
+};
+
+struct worker {
+	tpool_t *tp;
+	struct deque dq;
+	unsigned long rng; /* for picking victims */
+	pthread_t thread;
+};
+
+struct tpool_t {
+	struct worker *workers;
+	unsigned nthreads;
+
+	/* Tasks submitted from outside the pool, first in first out. */
+	pthread_mutex_t inject_mtx;
+	struct task *inject_head, *inject_tail;
+	atomic_size_t n_injected;
+
+	/*
+	 * Sleeping: a sleeper notes the epoch before its last look for work,
+	 * and sleeps only if no one has bumped it since. Wakers bump it after
+	 * making work (or finishing a group), then wake sleepers if any.
+	 */
+	pthread_mutex_t mtx;
+	pthread_cond_t wake;
+	atomic_size_t epoch;
+	atomic_uint sleepers;
+	atomic_int stopping;
+
+	struct group submitted;
+};
+
+/* The worker running on this thread, of whichever pool. */
+static _Thread_local struct worker *current;
+
+/* The calling thread's worker if it is one of tp's, else NULL. */
+static struct worker *self(tpool_t *tp);
+
+/* Deque operations; take and steal return NULL when there is nothing (or,
+ * for steal, on losing a race). */
+static int deque_init(struct deque *dq);
+static void deque_free(struct deque *dq);
+static int deque_push(struct deque *dq, struct task *t);
+static struct task *deque_take(struct deque *dq);
+static struct task *deque_steal(struct deque *dq);
+
+/* Queue a task on w's deque, or if w is NULL or its deque can't grow, on the
+ * injection queue, and wake a sleeper to run it. */
+static void push(tpool_t *tp, struct worker *w, struct task *t);
+
+/* A task to run next, for w (NULL for threads outside the pool). */
+static struct task *find_task(tpool_t *tp, struct worker *w);
+
+static void run_task(tpool_t *tp, struct worker *w, struct task *t);
+
+/* Run fn over [begin, end), first splitting off halves for others to take
+ * until at most grain remain. */
+static void run_range(tpool_t *tp, struct worker *w, struct group *g,
+		      tpool_range_fn fn, void *arg, size_t begin, size_t end,
+		      size_t grain);
+
+/* Mark a task of g done, waking waiters if it was the last. */
+static void finish(tpool_t *tp, struct group *g);
+
+/* Run tasks until g has none pending, sleeping while there are none to
+ * run. */
+static void help_until_done(tpool_t *tp, struct worker *w, struct group *g);
+
+/* Sleep until woken, unless the epoch has moved past e, the pool is stopping,
+ * or g (if not NULL) has nothing pending. */
+static void sleep_unless(tpool_t *tp, size_t e, struct group *g);
+
+/* Bump the epoch and wake one sleeper, or all of them. */
+static void notify(tpool_t *tp, int all);
+
+static void *worker_main(void *arg);
+
+tpool_t *tpool_create(unsigned nthreads)
+{
+	tpool_t *tp;
+	unsigned i, j = 0;
+	long ncpu;
+
+	if (!nthreads) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (unsigned)ncpu : 1;
+	}
+
+	tp = malloc(sizeof(*tp));
+	if (tp == NULL) {
+		return NULL;
+	}
+	tp->workers = calloc(nthreads, sizeof(*tp->workers));
+	if (tp->workers == NULL) {
+		free(tp);
+		return NULL;
+	}
+	tp->nthreads = nthreads;
+
+	pthread_mutex_init(&tp->inject_mtx, NULL);
+	tp->inject_head = tp->inject_tail = NULL;
+	atomic_init(&tp->n_injected, 0);
+	pthread_mutex_init(&tp->mtx, NULL);
+	pthread_cond_init(&tp->wake, NULL);
+	atomic_init(&tp->epoch, 0);
+	atomic_init(&tp->sleepers, 0);
+	atomic_init(&tp->stopping, 0);
+	atomic_init(&tp->submitted.pending, 0);
+
+	for (i = 0; i < nthreads; i++) {
+		tp->workers[i].tp = tp;
+		tp->workers[i].rng = 2 * i + 1;
+		if (deque_init(&tp->workers[i].dq)) {
+			goto fail;
+		}
+	}
+
+	for (j = 0; j < nthreads; j++) {
+		if (pthread_create(&tp->workers[j].thread, NULL, worker_main,
+				   &tp->workers[j])) {
+			goto fail;
+		}
+	}
+
+	return tp;
+fail:
+	atomic_store(&tp->stopping, 1);
+	notify(tp, 1);
+	while (j--) {
+		pthread_join(tp->workers[j].thread, NULL);
+	}
+	while (i--) {
+		deque_free(&tp->workers[i].dq);
+	}
+	pthread_cond_destroy(&tp->wake);
+	pthread_mutex_destroy(&tp->mtx);
+	pthread_mutex_destroy(&tp->inject_mtx);
+	free(tp->workers);
+	free(tp);
+	return NULL;
+}
+
+void tpool_destroy(tpool_t *tp)
+{
+	unsigned i;
+
+	assert(tp != NULL);
+
+	tpool_wait(tp);
+
+	atomic_store(&tp->stopping, 1);
+	notify(tp, 1);
+	for (i = 0; i < tp->nthreads; i++) {
+		pthread_join(tp->workers[i].thread, NULL);
+	}
+
+	for (i = 0; i < tp->nthreads; i++) {
+		deque_free(&tp->workers[i].dq);
+	}
+	pthread_cond_destroy(&tp->wake);
+	pthread_mutex_destroy(&tp->mtx);
+	pthread_mutex_destroy(&tp->inject_mtx);
+	free(tp->workers);
+	free(tp);
+}
+
+unsigned tpool_threads(tpool_t *tp)
+{
+	assert(tp != NULL);
+
+	return tp->nthreads;
+}
+
+int tpool_submit(tpool_t *tp, tpool_task_fn fn, void *arg)
+{
+	struct task *t;
+
+	assert(tp != NULL);
+	assert(fn != NULL);
+
+	t = malloc(sizeof(*t));
+	if (t == NULL) {
+		return -1;
+	}
+	t->group = &tp->submitted;
+	t->fn = fn;
+	t->arg = arg;
+	t->range_fn = NULL;
+
+	atomic_fetch_add(&tp->submitted.pending, 1);
+	push(tp, self(tp), t);
+	return 0;
+}
+
+void tpool_wait(tpool_t *tp)
+{
+	assert(tp != NULL);
+
+	help_until_done(tp, self(tp), &tp->submitted);
+}
+
+void tpool_parallel_for(tpool_t *tp, size_t begin, size_t end, size_t grain,
+			tpool_range_fn fn, void *arg)
+{
+	struct group g;
+	struct worker *w;
+
+	assert(fn != NULL);
+
+	if (begin >= end) {
+		return;
+	}
+	if (!grain) {
+		grain = tp != NULL ? (end - begin) / ((size_t)tp->nthreads *
+						      PIECES_PER_THREAD) :
+				     end - begin;
+		grain = grain ? grain : 1;
+	}
+	if (tp == NULL || end - begin <= grain) {
+		fn(arg, begin, end);
+		return;
+	}
+
+	/* The calling thread takes the first piece, and helps with the rest
+	 * until all are done. */
+	w = self(tp);
+	atomic_init(&g.pending, 1);
+	run_range(tp, w, &g, fn, arg, begin, end, grain);
+	finish(tp, &g);
+	help_until_done(tp, w, &g);
+}
+
+static struct worker *self(tpool_t *tp)
+{
+	return current != NULL && current->tp == tp ? current : NULL;
+}
+
+static int deque_init(struct deque *dq)
+{
+	struct deque_array *a;
+
+	a = malloc(sizeof(*a) + DEQUE_MIN * sizeof(a->buf[0]));
+	if (a == NULL) {
+		return -1;
+	}
+	a->mask = DEQUE_MIN - 1;
+	a->prev = NULL;
+	atomic_init(&dq->top, 0);
+	atomic_init(&dq->bottom, 0);
+	atomic_init(&dq->array, a);
+	return 0;
+}
+
+static void deque_free(struct deque *dq)
+{
+	struct deque_array *a, *prev;
+
+	for (a = atomic_load(&dq->array); a != NULL; a = prev) {
+		prev = a->prev;
+		free(a);
+	}
+}
+
+static int deque_push(struct deque *dq, struct task *t)
+{
+	struct deque_array *a, *grown;
+	int_least64_t b, top, i;
+
+	b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+	top = atomic_load_explicit(&dq->top, memory_order_acquire);
+	a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+
+	if ((size_t)(b - top) > a->mask) {
+		size_t n = (a->mask + 1) * 2;
+
+		grown = malloc(sizeof(*grown) + n * sizeof(grown->buf[0]));
+		if (grown == NULL) {
+			return -1;
+		}
+		grown->mask = n - 1;
+		grown->prev = a;
+		for (i = top; i < b; i++) {
+			atomic_store_explicit(
+				&grown->buf[(size_t)i & grown->mask],
+				atomic_load_explicit(&a->buf[(size_t)i & a->mask],
+						     memory_order_relaxed),
+				memory_order_relaxed);
+		}
+		atomic_store_explicit(&dq->array, grown, memory_order_release);
+		a = grown;
+	}
+
+	atomic_store_explicit(&a->buf[(size_t)b & a->mask], t,
+			      memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+	return 0;
+}
+
+static struct task *deque_take(struct deque *dq)
+{
+	struct deque_array *a;
+	struct task *t;
+	int_least64_t b, top;
+
+	b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+	a = atomic_load_explicit(&dq->array, memory_order_relaxed);
+	atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	top = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+	if (top > b) {
+		atomic_store_explicit(&dq->bottom, b + 1,
+				      memory_order_relaxed);
+		return NULL;
+	}
+
+	t = atomic_load_explicit(&a->buf[(size_t)b & a->mask],
+				 memory_order_relaxed);
+	if (top == b) {
+		/* The last task: race thieves for it. */
+		if (!atomic_compare_exchange_strong_explicit(
+			    &dq->top, &top, top + 1, memory_order_seq_cst,
+			    memory_order_relaxed)) {
+			t = NULL;
+		}
+		atomic_store_explicit(&dq->bottom, b + 1,
+				      memory_order_relaxed);
+	}
+	return t;
+}
+
+static struct task *deque_steal(struct deque *dq)
+{
+	struct deque_array *a;
+	struct task *t;
+	int_least64_t b, top;
+
+	top = atomic_load_explicit(&dq->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+	if (top >= b) {
+		return NULL;
+	}
+
+	a = atomic_load_explicit(&dq->array, memory_order_acquire);
+	t = atomic_load_explicit(&a->buf[(size_t)top & a->mask],
+				 memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&dq->top, &top, top + 1,
+						     memory_order_seq_cst,
+						     memory_order_relaxed)) {
+		return NULL;
+	}
+	return t;
+}
+
+static void push(tpool_t *tp, struct worker *w, struct task *t)
+{
+	if (w == NULL || deque_push(&w->dq, t)) {
+		t->next = NULL;
+		pthread_mutex_lock(&tp->inject_mtx);
+		if (tp->inject_tail != NULL) {
+			tp->inject_tail->next = t;
+		} else {
+			tp->inject_head = t;
+		}
+		tp->inject_tail = t;
+		atomic_fetch_add(&tp->n_injected, 1);
+		pthread_mutex_unlock(&tp->inject_mtx);
+	}
+	notify(tp, 0);
+}
+
+static struct task *find_task(tpool_t *tp, struct worker *w)
+{
+	struct task *t;
+	unsigned i, start;
+
+	if (w != NULL) {
+		t = deque_take(&w->dq);
+		if (t != NULL) {
+			return t;
+		}
+	}
+
+	if (atomic_load_explicit(&tp->n_injected, memory_order_relaxed)) {
+		pthread_mutex_lock(&tp->inject_mtx);
+		t = tp->inject_head;
+		if (t != NULL) {
+			tp->inject_head = t->next;
+			if (tp->inject_head == NULL) {
+				tp->inject_tail = NULL;
+			}
+			atomic_fetch_sub(&tp->n_injected, 1);
+		}
+		pthread_mutex_unlock(&tp->inject_mtx);
+		if (t != NULL) {
+			return t;
+		}
+	}
+
+	/* Every other worker once, from a random one on. */
+	if (w != NULL) {
+		w->rng ^= w->rng << 13;
+		w->rng ^= w->rng >> 7;
+		w->rng ^= w->rng << 17;
+		start = (unsigned)(w->rng % tp->nthreads);
+	} else {
+		start = 0;
+	}
+	for (i = 0; i < tp->nthreads; i++) {
+		struct worker *victim = &tp->workers[(start + i) % tp->nthreads];
+
+		if (victim != w) {
+			t = deque_steal(&victim->dq);
+			if (t != NULL) {
+				return t;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void run_task(tpool_t *tp, struct worker *w, struct task *t)
+{
+	struct group *g = t->group;
+
+	if (t->range_fn != NULL) {
+		run_range(tp, w, g, t->range_fn, t->arg, t->begin, t->end,
+			  t->grain);
+	} else {
+		t->fn(t->arg);
+	}
+	free(t);
+	finish(tp, g);
+}
+
+static void run_range(tpool_t *tp, struct worker *w, struct group *g,
+		      tpool_range_fn fn, void *arg, size_t begin, size_t end,
+		      size_t grain)
+{
+	struct task *t;
+	size_t mid;
+
+	while (end - begin > grain) {
+		t = malloc(sizeof(*t));
+		if (t == NULL) {
+			break;
+		}
+		mid = begin + (end - begin) / 2;
+		t->group = g;
+		t->fn = NULL;
+		t->arg = arg;
+		t->range_fn = fn;
+		t->begin = mid;
+		t->end = end;
+		t->grain = grain;
+
+		atomic_fetch_add(&g->pending, 1);
+		push(tp, w, t);
+		end = mid;
+	}
+	fn(arg, begin, end);
+}
+
+static void finish(tpool_t *tp, struct group *g)
+{
+	if (atomic_fetch_sub(&g->pending, 1) == 1) {
+		notify(tp, 1);
+	}
+}
+
+static void help_until_done(tpool_t *tp, struct worker *w, struct group *g)
+{
+	struct task *t;
+	unsigned spins = 0;
+	size_t e;
+
+	while (atomic_load(&g->pending)) {
+		e = atomic_load(&tp->epoch);
+		t = find_task(tp, w);
+		if (t != NULL) {
+			run_task(tp, w, t);
+			spins = 0;
+		} else if (++spins < TPOOL_SPINS) {
+			sched_yield();
+		} else {
+			sleep_unless(tp, e, g);
+		}
+	}
+}
+
+static void sleep_unless(tpool_t *tp, size_t e, struct group *g)
+{
+	pthread_mutex_lock(&tp->mtx);
+	atomic_fetch_add(&tp->sleepers, 1);
+	if (atomic_load(&tp->epoch) == e && !atomic_load(&tp->stopping) &&
+	    (g == NULL || atomic_load(&g->pending))) {
+		pthread_cond_wait(&tp->wake, &tp->mtx);
+	}
+	atomic_fetch_sub(&tp->sleepers, 1);
+	pthread_mutex_unlock(&tp->mtx);
+}
+
+static void notify(tpool_t *tp, int all)
+{
+	atomic_fetch_add(&tp->epoch, 1);
+	if (!atomic_load(&tp->sleepers)) {
+		return;
+	}
+
+	pthread_mutex_lock(&tp->mtx);
+	if (all) {
+		pthread_cond_broadcast(&tp->wake);
+	} else {
+		pthread_cond_signal(&tp->wake);
+	}
+	pthread_mutex_unlock(&tp->mtx);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	tpool_t *tp = w->tp;
+	struct task *t;
+	unsigned spins = 0;
+	size_t e;
+
+	current = w;
+	for (;;) {
+		e = atomic_load(&tp->epoch);
+		t = find_task(tp, w);
+		if (t != NULL) {
+			run_task(tp, w, t);
+			spins = 0;
+		} else if (atomic_load(&tp->stopping)) {
+			break;
+		} else if (++spins < TPOOL_SPINS) {
+			sched_yield();
+		} else {
+			sleep_unless(tp, e, NULL);
+		}
+	}
+	current = NULL;
+
+	return NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef TPOOL_H
+#define TPOOL_H
+
+/*
+ * A work-stealing thread pool. Each worker runs tasks from its own Chase-Lev
+ * deque, newest first, and when that is empty takes from the queue of tasks
+ * submitted from outside the pool, or steals the oldest task of another
+ * worker. Idle workers spin briefly, then sleep until work arrives.
+ *
+ * Threads waiting on the pool - in tpool_wait or tpool_parallel_for - run
+ * tasks while they wait, so tasks may themselves submit tasks and run
+ * parallel loops without deadlocking the pool.
+ */
+
+#include <stddef.h>
+
+typedef struct tpool_t tpool_t;
+
+typedef void (*tpool_task_fn)(void *arg);
+
+/* Process indices [begin, end) of a parallel loop. */
+typedef void (*tpool_range_fn)(void *arg, size_t begin, size_t end);
+
+/* Create a pool of nthreads workers, or one per online CPU if 0, or return
+ * NULL if memory or the threads couldn't be had. */
+tpool_t *tpool_create(unsigned nthreads);
+
+/* Wait for every task submitted, and stop the workers. */
+void tpool_destroy(tpool_t *tp);
+
+unsigned tpool_threads(tpool_t *tp);
+
+/* Queue fn(arg) to run on the pool. Returns 0, or -1 on allocation
+ * failure. */
+int tpool_submit(tpool_t *tp, tpool_task_fn fn, void *arg);
+
+/* Wait until every task submitted has run, including those they submitted.
+ * Not for use from the pool's own tasks, which would wait on themselves. */
+void tpool_wait(tpool_t *tp);
+
+/*
+ * Run fn over [begin, end) in pieces of at most grain indices (or a size
+ * chosen for the pool if 0), spread over the pool's workers by splitting the
+ * range in halves that idle workers steal. Returns once every piece has run.
+ *
+ * tp may be NULL, to run fn over the whole range on the calling thread, so
+ * callers can take an optional pool. Pieces that can't be allocated run on
+ * the thread that split them.
+ */
+void tpool_parallel_for(tpool_t *tp, size_t begin, size_t end, size_t grain,
+			tpool_range_fn fn, void *arg);
+
+#endif /* TPOOL_H */